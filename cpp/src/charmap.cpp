@@ -146,3 +146,232 @@ GlobalCharMap[][5]
     0b1000'0000,
   },
 };
+
+// SUPER-CHIP digits, 8x10 pixels each. See `LD HF, Vx`.
+static u8
+GlobalBigCharMap[][10]
+{
+  // 0
+  {
+    0b1111'1111,
+    0b1111'1111,
+    0b1100'0011,
+    0b1100'0011,
+    0b1100'0011,
+    0b1100'0011,
+    0b1100'0011,
+    0b1100'0011,
+    0b1111'1111,
+    0b1111'1111,
+  },
+
+  // 1
+  {
+    0b0001'1000,
+    0b0111'1000,
+    0b0111'1000,
+    0b0001'1000,
+    0b0001'1000,
+    0b0001'1000,
+    0b0001'1000,
+    0b0001'1000,
+    0b1111'1111,
+    0b1111'1111,
+  },
+
+  // 2
+  {
+    0b1111'1111,
+    0b1111'1111,
+    0b0000'0011,
+    0b0000'0011,
+    0b1111'1111,
+    0b1111'1111,
+    0b1100'0000,
+    0b1100'0000,
+    0b1111'1111,
+    0b1111'1111,
+  },
+
+  // 3
+  {
+    0b1111'1111,
+    0b1111'1111,
+    0b0000'0011,
+    0b0000'0011,
+    0b1111'1111,
+    0b1111'1111,
+    0b0000'0011,
+    0b0000'0011,
+    0b1111'1111,
+    0b1111'1111,
+  },
+
+  // 4
+  {
+    0b1100'0011,
+    0b1100'0011,
+    0b1100'0011,
+    0b1100'0011,
+    0b1111'1111,
+    0b1111'1111,
+    0b0000'0011,
+    0b0000'0011,
+    0b0000'0011,
+    0b0000'0011,
+  },
+
+  // 5
+  {
+    0b1111'1111,
+    0b1111'1111,
+    0b1100'0000,
+    0b1100'0000,
+    0b1111'1111,
+    0b1111'1111,
+    0b0000'0011,
+    0b0000'0011,
+    0b1111'1111,
+    0b1111'1111,
+  },
+
+  // 6
+  {
+    0b1111'1111,
+    0b1111'1111,
+    0b1100'0000,
+    0b1100'0000,
+    0b1111'1111,
+    0b1111'1111,
+    0b1100'0011,
+    0b1100'0011,
+    0b1111'1111,
+    0b1111'1111,
+  },
+
+  // 7
+  {
+    0b1111'1111,
+    0b1111'1111,
+    0b0000'0011,
+    0b0000'0011,
+    0b0000'0110,
+    0b0000'1100,
+    0b0001'1000,
+    0b0001'1000,
+    0b0001'1000,
+    0b0001'1000,
+  },
+
+  // 8
+  {
+    0b1111'1111,
+    0b1111'1111,
+    0b1100'0011,
+    0b1100'0011,
+    0b1111'1111,
+    0b1111'1111,
+    0b1100'0011,
+    0b1100'0011,
+    0b1111'1111,
+    0b1111'1111,
+  },
+
+  // 9
+  {
+    0b1111'1111,
+    0b1111'1111,
+    0b1100'0011,
+    0b1100'0011,
+    0b1111'1111,
+    0b1111'1111,
+    0b0000'0011,
+    0b0000'0011,
+    0b1111'1111,
+    0b1111'1111,
+  },
+
+  // A
+  {
+    0b0111'1110,
+    0b1111'1111,
+    0b1100'0011,
+    0b1100'0011,
+    0b1100'0011,
+    0b1111'1111,
+    0b1111'1111,
+    0b1100'0011,
+    0b1100'0011,
+    0b1100'0011,
+  },
+
+  // B
+  {
+    0b1111'1100,
+    0b1111'1100,
+    0b1100'0011,
+    0b1100'0011,
+    0b1111'1100,
+    0b1111'1100,
+    0b1100'0011,
+    0b1100'0011,
+    0b1111'1100,
+    0b1111'1100,
+  },
+
+  // C
+  {
+    0b0011'1100,
+    0b1111'1111,
+    0b1100'0011,
+    0b1100'0000,
+    0b1100'0000,
+    0b1100'0000,
+    0b1100'0000,
+    0b1100'0011,
+    0b1111'1111,
+    0b0011'1100,
+  },
+
+  // D
+  {
+    0b1111'1100,
+    0b1111'1110,
+    0b1100'0011,
+    0b1100'0011,
+    0b1100'0011,
+    0b1100'0011,
+    0b1100'0011,
+    0b1100'0011,
+    0b1111'1110,
+    0b1111'1100,
+  },
+
+  // E
+  {
+    0b1111'1111,
+    0b1111'1111,
+    0b1100'0000,
+    0b1100'0000,
+    0b1111'1111,
+    0b1111'1111,
+    0b1100'0000,
+    0b1100'0000,
+    0b1111'1111,
+    0b1111'1111,
+  },
+
+  // F
+  {
+    0b1111'1111,
+    0b1111'1111,
+    0b1100'0000,
+    0b1100'0000,
+    0b1111'1111,
+    0b1111'1111,
+    0b1100'0000,
+    0b1100'0000,
+    0b1100'0000,
+    0b1100'0000,
+  },
+};
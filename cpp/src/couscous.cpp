@@ -20,6 +20,10 @@ GetArgumentTypeAsString(argument_type Value)
         case argument_type::F:        Result = "F"; break;
         case argument_type::B:        Result = "B"; break;
         case argument_type::ATI:      Result = "ATI"; break;
+        case argument_type::HF:       Result = "HF"; break;
+        case argument_type::R:        Result = "R"; break;
+        case argument_type::LONG:     Result = "LONG"; break;
+        case argument_type::PITCH:    Result = "PITCH"; break;
         case argument_type::CONSTANT: Result = "CONSTANT"; break;
         default:
             MTB_ASSERT(false);
@@ -55,6 +59,10 @@ MakeArgumentTypeFromString(size_t CodeLen, char const* Code)
             case 'F': MAKE_ARGUMENT_TYPE_FROM_STRING_CASE(F);        break;
             case 'B': MAKE_ARGUMENT_TYPE_FROM_STRING_CASE(B);        break;
             case 'A': MAKE_ARGUMENT_TYPE_FROM_STRING_CASE(ATI);      break;
+            case 'H': MAKE_ARGUMENT_TYPE_FROM_STRING_CASE(HF);       break;
+            case 'R': MAKE_ARGUMENT_TYPE_FROM_STRING_CASE(R);        break;
+            case 'L': MAKE_ARGUMENT_TYPE_FROM_STRING_CASE(LONG);     break;
+            case 'P': MAKE_ARGUMENT_TYPE_FROM_STRING_CASE(PITCH);    break;
             case 'C': MAKE_ARGUMENT_TYPE_FROM_STRING_CASE(CONSTANT); break;
         }
     }
@@ -145,6 +153,47 @@ GetArgumentAsString(argument Argument, size_t BufferSize, u8* Buffer)
             Result = 1;
         } break;
 
+        case argument_type::HF:
+        {
+            if (BufferSize > 1)
+            {
+                Buffer[0] = 'H';
+                Buffer[1] = 'F';
+                Result = 2;
+            }
+        } break;
+
+        case argument_type::R:
+        {
+            Buffer[0] = 'R';
+            Result = 1;
+        } break;
+
+        case argument_type::LONG:
+        {
+            if (BufferSize > 3)
+            {
+                Buffer[0] = 'L';
+                Buffer[1] = 'O';
+                Buffer[2] = 'N';
+                Buffer[3] = 'G';
+                Result = 4;
+            }
+        } break;
+
+        case argument_type::PITCH:
+        {
+            if (BufferSize > 4)
+            {
+                Buffer[0] = 'P';
+                Buffer[1] = 'I';
+                Buffer[2] = 'T';
+                Buffer[3] = 'C';
+                Buffer[4] = 'H';
+                Result = 5;
+            }
+        } break;
+
         case argument_type::ATI:
         {
             if (BufferSize > 2)
@@ -196,9 +245,9 @@ MakeArgumentFromString(size_t CodeLen, char const* CodeInput)
 
     if (CodeLen > 0)
     {
-        if (CodeLen <= 3)
+        if (CodeLen <= 5)
         {
-            char Code[3]{};
+            char Code[5]{};
             for (size_t CharIndex = 0; CharIndex < CodeLen; ++CharIndex)
                 Code[CharIndex] = CodeInput[CharIndex];
             ToUpper(str{ (int)CodeLen, Code });
@@ -276,6 +325,34 @@ MakeArgumentFromString(size_t CodeLen, char const* CodeInput)
                     break;
                 }
 
+                case 'H':
+                {
+                    if (CodeLen == 2 && mtb::string::StringEquals(PtrSlice(Code, CodeLen), ConstZ("HF")))
+                        Result.Type = argument_type::HF;
+                    break;
+                }
+
+                case 'R':
+                {
+                    if (CodeLen == 1)
+                        Result.Type = argument_type::R;
+                    break;
+                }
+
+                case 'L':
+                {
+                    if (CodeLen == 4 && mtb::string::StringEquals(PtrSlice(Code, CodeLen), ConstZ("LONG")))
+                        Result.Type = argument_type::LONG;
+                    break;
+                }
+
+                case 'P':
+                {
+                    if (CodeLen == 5 && mtb::string::StringEquals(PtrSlice(Code, CodeLen), ConstZ("PITCH")))
+                        Result.Type = argument_type::PITCH;
+                    break;
+                }
+
                 case '[':
                 {
                     if (CodeLen == 3)
@@ -349,6 +426,15 @@ GetInstructionTypeAsString(instruction_type Value)
         case instruction_type::DRW:     Result = "DRW"; break;
         case instruction_type::SKP:     Result = "SKP"; break;
         case instruction_type::SKNP:    Result = "SKNP"; break;
+        case instruction_type::SCD:     Result = "SCD"; break;
+        case instruction_type::SCR:     Result = "SCR"; break;
+        case instruction_type::SCL:     Result = "SCL"; break;
+        case instruction_type::EXIT:    Result = "EXIT"; break;
+        case instruction_type::LOW:     Result = "LOW"; break;
+        case instruction_type::HIGH:    Result = "HIGH"; break;
+        case instruction_type::SCU:     Result = "SCU"; break;
+        case instruction_type::PLANE:   Result = "PLANE"; break;
+        case instruction_type::AUDIO:   Result = "AUDIO"; break;
         default:
             MTB_ASSERT(false);
             break;
@@ -371,9 +457,9 @@ MakeInstructionTypeFromString(size_t CodeLen, char const* CodeInput)
 
     mtb::tSlice<char const> CodeSlice = mtb::PtrSlice(CodeInput, CodeLen);
     instruction_type Result{};
-    if (CodeLen > 0 && CodeLen <= 4)
+    if (CodeLen > 0 && CodeLen <= 5)
     {
-        char Code[4]{};
+        char Code[5]{};
         for (size_t CharIndex = 0; CharIndex < CodeLen; ++CharIndex)
             Code[CharIndex] = CodeInput[CharIndex];
         ToUpper(str{ (int)CodeLen, Code });
@@ -382,6 +468,7 @@ MakeInstructionTypeFromString(size_t CodeLen, char const* CodeInput)
         {
             case 'A': MAKE_INSTRUCTION_TYPE_FROM_STRING_CASE(ADD);
                 MAKE_INSTRUCTION_TYPE_FROM_STRING_CASE(AND);
+                MAKE_INSTRUCTION_TYPE_FROM_STRING_CASE(AUDIO);
                 break;
 
             case 'C': MAKE_INSTRUCTION_TYPE_FROM_STRING_CASE(CALL);
@@ -391,15 +478,25 @@ MakeInstructionTypeFromString(size_t CodeLen, char const* CodeInput)
             case 'D': MAKE_INSTRUCTION_TYPE_FROM_STRING_CASE(DRW);
                 break;
 
+            case 'E': MAKE_INSTRUCTION_TYPE_FROM_STRING_CASE(EXIT);
+                break;
+
+            case 'H': MAKE_INSTRUCTION_TYPE_FROM_STRING_CASE(HIGH);
+                break;
+
             case 'J': MAKE_INSTRUCTION_TYPE_FROM_STRING_CASE(JP);
                 break;
 
             case 'L': MAKE_INSTRUCTION_TYPE_FROM_STRING_CASE(LD);
+                MAKE_INSTRUCTION_TYPE_FROM_STRING_CASE(LOW);
                 break;
 
             case 'O': MAKE_INSTRUCTION_TYPE_FROM_STRING_CASE(OR);
                 break;
 
+            case 'P': MAKE_INSTRUCTION_TYPE_FROM_STRING_CASE(PLANE);
+                break;
+
             case 'R': MAKE_INSTRUCTION_TYPE_FROM_STRING_CASE(RET);
                 MAKE_INSTRUCTION_TYPE_FROM_STRING_CASE(RND);
                 break;
@@ -408,6 +505,12 @@ MakeInstructionTypeFromString(size_t CodeLen, char const* CodeInput)
             {
                 if (CodeLen > 1) switch (Code[1])
                 {
+                    case 'C': MAKE_INSTRUCTION_TYPE_FROM_STRING_CASE(SCD);
+                        MAKE_INSTRUCTION_TYPE_FROM_STRING_CASE(SCL);
+                        MAKE_INSTRUCTION_TYPE_FROM_STRING_CASE(SCR);
+                        MAKE_INSTRUCTION_TYPE_FROM_STRING_CASE(SCU);
+                        break;
+
                     case 'E': MAKE_INSTRUCTION_TYPE_FROM_STRING_CASE(SE);
                         break;
 
@@ -448,269 +551,862 @@ GetDigitSpriteAddress(machine* M, u8 Digit)
     return Result;
 }
 
-void
-DrawSprite(machine* M, int StartX, int StartY, sprite Sprite)
+u16
+GetBigDigitSpriteAddress(machine* M, u8 Digit)
 {
-    MTB_ASSERT(Sprite.Length <= 15); // As per 2.4 "Chip-8 sprites may be up to 15 bytes, [...]"
+    u16 Result = (u16)BIG_CHAR_MEMORY_OFFSET + (10 * (u16)(Digit & 0xF));
+    return Result;
+}
 
-    int SpriteWidth = 8; // Always 1 byte.
-    int SpriteHeight = Sprite.Length;
+// Number of registers copied by `LD R, Vx` and `LD Vx, R`, which copy V0 through Vx, at most V7.
+static u8
+GetNumFlagRegisters(u16 X)
+{
+    u8 Result = X < NUM_FLAG_REGISTERS ? (u8)(X + 1) : (u8)NUM_FLAG_REGISTERS;
+    return Result;
+}
 
-    bool32 HasCollision = false;
-    for (int SpriteY = 0; SpriteY < SpriteHeight; ++SpriteY)
-    {
-        u8* SpritePixel = Sprite.Pixels + SpriteY;
-        int ScreenY = (StartY + SpriteY) % SCREEN_HEIGHT;
-        for (int SpriteX = 0; SpriteX < SpriteWidth; ++SpriteX)
-        {
-            int ScreenX = (StartX + SpriteX) % SCREEN_WIDTH;
+// XO-CHIP `LD [I], Vx, Vy` and `LD Vx, Vy, [I]` copy Vx through Vy, in
+// reverse order if x is greater than y. I stays the same.
+static void
+SaveRegisterRange(machine* M, u16 X, u16 Y)
+{
+    int Step = X <= Y ? 1 : -1;
+    u32 NumBytes = (u32)(X <= Y ? Y - X : X - Y) + 1;
+    u8 Bytes[16];
+    for (u32 ByteIndex = 0; ByteIndex < NumBytes; ++ByteIndex)
+        Bytes[ByteIndex] = M->V[X + Step * (int)ByteIndex];
+    WriteMemory(M, M->I, NumBytes, Bytes);
+}
 
-            int ScreenOffset = (ScreenY * SCREEN_WIDTH) + ScreenX;
-            bool32* ScreenPixel = M->Screen + ScreenOffset;
+static void
+LoadRegisterRange(machine* M, u16 X, u16 Y)
+{
+    int Step = X <= Y ? 1 : -1;
+    u32 NumBytes = (u32)(X <= Y ? Y - X : X - Y) + 1;
+    u8 Bytes[16];
+    ReadMemory(M, M->I, NumBytes, Bytes);
+    for (u32 ByteIndex = 0; ByteIndex < NumBytes; ++ByteIndex)
+        M->V[X + Step * (int)ByteIndex] = Bytes[ByteIndex];
+}
 
-            bool32 SpriteColor = IsBitSet((u32)*SpritePixel, 7 - SpriteX);
-            bool32 ScreenColor = *ScreenPixel;
-            HasCollision |= ScreenColor & SpriteColor;
-            *ScreenPixel = ScreenColor ^ SpriteColor;
-        }
+static void
+MarkRowsChanged(machine* M, u64 ChangedRows)
+{
+    if (ChangedRows)
+    {
+        M->DirtyRows |= ChangedRows;
+        ++M->DisplayGeneration;
     }
+}
 
-    M->V[0xF] = !!HasCollision;
+void
+EnableXOChip(machine* M, xochip_state* XOChip)
+{
+    M->XOChip = XOChip;
+    M->SelectedPlanes = 1;
+    M->AudioPitch = 64; // 4000 Hz
 }
 
-u8
-ReadByte(void* Ptr)
+u32
+GetMemorySize(machine const* M)
 {
-    u8 Result = *(u8*)Ptr;
+    u32 Result = M->XOChip ? (u32)XOCHIP_MEMORY_SIZE : (u32)sizeof(M->Memory);
     return Result;
 }
 
-bool
-IsLittleEndian()
+static u8*
+GetMemoryByte(machine* M, u32 Address)
 {
-    uint16_t Test = 0x0001;
-    return ((uint8_t const*)&Test)[0] == 0x01;
+    Address &= GetMemorySize(M) - 1;
+
+    u8* Result;
+    if (Address < sizeof(M->Memory)) Result = M->Memory + Address;
+    else                             Result = M->XOChip->ExtendedMemory + (Address - sizeof(M->Memory));
+
+    return Result;
 }
 
-u16
-ReadWord(void* Ptr)
+// Only XO-CHIP ROMs go beyond machine::Memory, so that case is checked first
+// and everything else goes byte by byte.
+
+void
+ReadMemory(machine* M, u32 Address, u32 NumBytes, u8* Dest)
 {
-    u16 Result = *(u16*)Ptr;
-    if(IsLittleEndian()) {
-        Result = (u16)((Result << 8) | (Result >> 8));
+    if (Address + NumBytes <= sizeof(M->Memory))
+    {
+        mtb::CopyBytes(Dest, M->Memory + Address, NumBytes);
+    }
+    else
+    {
+        for (u32 ByteIndex = 0; ByteIndex < NumBytes; ++ByteIndex)
+            Dest[ByteIndex] = *GetMemoryByte(M, Address + ByteIndex);
     }
-    return Result;
 }
 
 void
-WriteByte(void* Ptr, u8 Value)
+WriteMemory(machine* M, u32 Address, u32 NumBytes, u8 const* Source)
 {
-    *(u8*)Ptr = Value;
+    if (NumBytes == 0)
+        return;
+
+    if (Address + NumBytes <= sizeof(M->Memory))
+    {
+        mtb::CopyBytes(M->Memory + Address, Source, NumBytes);
+        InvalidateDecodeCache(M, (u16)Address, (u16)NumBytes);
+
+        u32 FirstPage = Address / MEMORY_PAGE_SIZE;
+        u32 LastPage = (Address + NumBytes - 1) / MEMORY_PAGE_SIZE;
+        M->WrittenPages |= (~0ull >> (63 - (LastPage - FirstPage))) << FirstPage;
+    }
+    else
+    {
+        for (u32 ByteIndex = 0; ByteIndex < NumBytes; ++ByteIndex)
+        {
+            u32 WrappedAddress = (Address + ByteIndex) & (GetMemorySize(M) - 1);
+            *GetMemoryByte(M, WrappedAddress) = Source[ByteIndex];
+            if (WrappedAddress < sizeof(M->Memory))
+            {
+                InvalidateDecodeCache(M, (u16)WrappedAddress, 1);
+                M->WrittenPages |= 1ull << (WrappedAddress / MEMORY_PAGE_SIZE);
+            }
+        }
+    }
 }
 
-void
-WriteWord(void* Ptr, u16 Value)
+u8 const*
+GetMemoryBytes(machine* M, u32 Address, u32 NumBytes, u8* Scratch)
 {
-    if(IsLittleEndian()) {
-        Value = (u16)((Value << 8) | (Value >> 8));
+    u8 const* Result = M->Memory + Address;
+    if (Address + NumBytes > sizeof(M->Memory))
+    {
+        ReadMemory(M, Address, NumBytes, Scratch);
+        Result = Scratch;
     }
-    *(u16*)Ptr = Value;
+
+    return Result;
 }
 
-tick_result
-Tick(machine* M)
+u64*
+GetPlane(machine* M, int PlaneIndex)
 {
-    tick_result Result{};
-    Result.Continue = true;
+    MTB_ASSERT(PlaneIndex == 0 || (M->XOChip && PlaneIndex < XOCHIP_MAX_PLANES));
 
-    // Fetch new instruction.
-    instruction_decoder Decoder;
-    Decoder.Data = ReadWord(M->Memory + M->ProgramCounter);
-    instruction Instruction = DecodeInstruction(Decoder);
-#if 0
-    text DisassembledInstruction = DisassembleInstruction(Instruction);
-    printf("[%llu] " STR_FMT " (0x%04X)\n", M->CurrentCycle, STR_FMTARG(DisassembledInstruction), Decoder.Data);
-#endif
+    u64* Result;
+    if (PlaneIndex == 0) Result = M->Screen;
+    else                 Result = &M->XOChip->Planes[PlaneIndex - 1][0][0];
 
-    if (Instruction.Type != instruction_type::INVALID)
+    return Result;
+}
+
+u32
+GetSelectedPlanes(machine const* M)
+{
+    u32 Result = M->XOChip ? (u32)M->SelectedPlanes : 1u;
+    return Result;
+}
+
+// Calls Function for every selected plane. It returns the rows it changed, which are marked here.
+template<typename function>
+static void
+ForEachSelectedPlane(machine* M, function Function)
+{
+    u32 Planes = GetSelectedPlanes(M);
+    u64 ChangedRows = 0;
+    for (int PlaneIndex = 0; (Planes >> PlaneIndex) != 0; ++PlaneIndex)
     {
-        // Advance the program counter.
-        M->ProgramCounter += 2;
+        if ((Planes >> PlaneIndex) & 1)
+            ChangedRows |= Function(GetPlane(M, PlaneIndex));
+    }
 
-        // Execute the fetched instruction.
-        ExecuteInstruction(M, Instruction);
+    MarkRowsChanged(M, ChangedRows);
+}
+
+// XORs the left aligned Pixels into a high resolution row, rotated right by X
+// so they wrap around. Returns the pixels that were turned off.
+static u64
+XorHighResRow(u64* PlaneRow, u64 Pixels, u32 X)
+{
+    u32 Shift = X % HIRES_SCREEN_WIDTH;
+    u64 Left = Pixels;
+    u64 Right = 0;
+    if (Shift >= 64)
+    {
+        Right = Left;
+        Left = 0;
+        Shift -= 64;
     }
-    else
+    if (Shift)
     {
-        Result.Continue = false;
+        u64 NewLeft = (Left >> Shift) | (Right << (64 - Shift));
+        Right = (Right >> Shift) | (Left << (64 - Shift));
+        Left = NewLeft;
     }
 
-    return Result;
+    u64 Collision = (PlaneRow[0] & Left) | (PlaneRow[1] & Right);
+    PlaneRow[0] ^= Left;
+    PlaneRow[1] ^= Right;
+
+    return Collision;
 }
 
-instruction
-DecodeInstruction(instruction_decoder Decoder)
+// XORs Height rows of 8 or 16 pixels into a plane in the current resolution,
+// wrapping around the edges. Adds the rows drawn to to ChangedRows and returns
+// the pixels that were turned off.
+template<int BytesPerRow>
+static u64
+XorSprite(machine* M, u64* Plane, int StartX, int StartY, int Height, u8 const* Pixels, u64* ChangedRows)
 {
-    using inst = instruction_type;
-    using arg = argument_type;
-
-    instruction Result{};
+    static_assert(BytesPerRow == 1 || BytesPerRow == 2, "Sprites are 8 or 16 pixels wide.");
 
-    switch (Decoder.Group)
+    u32 FirstRow = (u32)StartY;
+    u64 Collision = 0;
+    if (!M->IsHighResolution)
     {
-        case 0x0:
+        // Sprites are at most 16 pixels wide, so each sprite row becomes a
+        // whole screen row, rotated into place so it wraps around. SSE2 and
+        // AVX2 versions that do 2 or 4 rows at a time were slower than this for
+        // every sprite height. Building the vectors and the reduction cost more
+        // than the single rotate, AND, and XOR per row.
+        u32 Shift = (u32)StartX % SCREEN_WIDTH;
+        for (int SpriteY = 0; SpriteY < Height; ++SpriteY)
         {
-            switch (Decoder.Data)
-            {
-                case 0x0000: // NULL instruction?
-                    break;
-                case 0x00E0: // 00E0 - CLS
-                    Result.Type = inst::CLS;
-                    break;
-                case 0x00EE: // 00EE - RET
-                    Result.Type = inst::RET;
-                    break;
-                default: // 0nnn - SYS addr
-                    Result.Type = inst::SYS;
-                    Result.Args[0].Type = arg::CONSTANT;
-                    Result.Args[0].Value = Decoder.Address;
-                    break;
-            }
-            break;
+            u32 Row = (FirstRow + SpriteY) % SCREEN_HEIGHT;
+            u64 SpriteRow = (u64)Pixels[BytesPerRow * SpriteY] << 56;
+            if (BytesPerRow == 2)
+                SpriteRow |= (u64)Pixels[BytesPerRow * SpriteY + 1] << 48;
+            SpriteRow = RotateRight(SpriteRow, Shift);
+            Collision |= Plane[Row] & SpriteRow;
+            Plane[Row] ^= SpriteRow;
+            *ChangedRows |= (u64)(SpriteRow != 0) << Row;
         }
-        case 0x1: // 1nnn - JP addr
+    }
+    else
+    {
+        for (int SpriteY = 0; SpriteY < Height; ++SpriteY)
         {
-            Result.Type = inst::JP;
-            Result.Args[0].Type = arg::CONSTANT;
-            Result.Args[0].Value = Decoder.Address;
-            break;
+            u32 Row = (FirstRow + SpriteY) % HIRES_SCREEN_HEIGHT;
+            u64 SpriteRow = (u64)Pixels[BytesPerRow * SpriteY] << 56;
+            if (BytesPerRow == 2)
+                SpriteRow |= (u64)Pixels[BytesPerRow * SpriteY + 1] << 48;
+            Collision |= XorHighResRow(Plane + 2 * Row, SpriteRow, (u32)StartX);
+            *ChangedRows |= (u64)(SpriteRow != 0) << Row;
         }
-        case 0x2: // 2nnn - CALL addr
+    }
+
+    return Collision;
+}
+
+void
+DrawSprite(machine* M, int StartX, int StartY, sprite Sprite)
+{
+    MTB_ASSERT(Sprite.Length <= 15); // As per 2.4 "Chip-8 sprites may be up to 15 bytes, [...]"
+
+    u64 ChangedRows = 0;
+    u64 Collision = XorSprite<1>(M, M->Screen, StartX, StartY, Sprite.Length, Sprite.Pixels, &ChangedRows);
+
+    M->V[0xF] = Collision != 0;
+    MarkRowsChanged(M, ChangedRows);
+}
+
+void
+DrawLargeSprite(machine* M, int StartX, int StartY, u8 const* Pixels)
+{
+    u64 ChangedRows = 0;
+    u64 Collision = XorSprite<2>(M, M->Screen, StartX, StartY, 16, Pixels, &ChangedRows);
+
+    M->V[0xF] = Collision != 0;
+    MarkRowsChanged(M, ChangedRows);
+}
+
+void
+DrawSpriteFromMemory(machine* M, int X, int Y, int Height)
+{
+    // XO-CHIP draws 16x16 sprites in low resolution as well.
+    bool IsLarge = Height == 0 && (M->IsHighResolution || M->XOChip);
+    u32 NumBytes = IsLarge ? 32 : (u32)Height;
+
+    u32 Planes = GetSelectedPlanes(M);
+    u32 Address = M->I;
+    u64 Collision = 0;
+    u64 ChangedRows = 0;
+    for (int PlaneIndex = 0; (Planes >> PlaneIndex) != 0; ++PlaneIndex)
+    {
+        if ((Planes >> PlaneIndex) & 1)
         {
-            Result.Type = inst::CALL;
-            Result.Args[0].Type = arg::CONSTANT;
-            Result.Args[0].Value = Decoder.Address;
-            break;
+            u8 Scratch[32];
+            u8 const* Pixels = GetMemoryBytes(M, Address, NumBytes, Scratch);
+            u64* Plane = GetPlane(M, PlaneIndex);
+            if (IsLarge) Collision |= XorSprite<2>(M, Plane, X, Y, 16, Pixels, &ChangedRows);
+            else         Collision |= XorSprite<1>(M, Plane, X, Y, Height, Pixels, &ChangedRows);
+            Address += NumBytes;
         }
-        case 0x3: // 3xkk - SE Vx, byte
+    }
+
+    M->V[0xF] = Collision != 0;
+    MarkRowsChanged(M, ChangedRows);
+}
+
+// The plane helpers below work in the current resolution and return the rows
+// that changed. Scrolling moves whole rows, or shifts each row as a whole, in
+// place.
+
+static u64
+ClearPlane(machine* M, u64* Plane)
+{
+    u64 ChangedRows = 0;
+    if (!M->IsHighResolution)
+    {
+        for (u32 Row = 0; Row < SCREEN_HEIGHT; ++Row)
+            ChangedRows |= (u64)(Plane[Row] != 0) << Row;
+    }
+    else
+    {
+        for (u32 Row = 0; Row < HIRES_SCREEN_HEIGHT; ++Row)
+            ChangedRows |= (u64)((Plane[2 * Row] | Plane[2 * Row + 1]) != 0) << Row;
+    }
+
+    if (ChangedRows)
+        mtb::SliceSetZero(mtb::PtrSlice(Plane, 2 * HIRES_SCREEN_HEIGHT));
+
+    return ChangedRows;
+}
+
+// Down for positive NumRows, up for negative ones.
+static u64
+ScrollPlaneVertically(machine* M, u64* Plane, int NumRows)
+{
+    int Height = GetScreenHeight(M);
+    int RowSize = M->IsHighResolution ? 2 : 1;
+    u64 ChangedRows = 0;
+    for (int Index = 0; Index < Height; ++Index)
+    {
+        // Go against the scroll direction so every row is read before it is overwritten.
+        int Row = NumRows > 0 ? Height - 1 - Index : Index;
+        int SourceRow = Row - NumRows;
+        bool HasSource = SourceRow >= 0 && SourceRow < Height;
+        for (int Half = 0; Half < RowSize; ++Half)
         {
-            Result.Type = inst::SE;
-            Result.Args[0].Type = arg::V;
-            Result.Args[0].Value = Decoder.X;
-            Result.Args[1].Type = arg::CONSTANT;
-            Result.Args[1].Value = Decoder.LSB;
-            break;
+            u64 NewValue = HasSource ? Plane[RowSize * SourceRow + Half] : 0;
+            ChangedRows |= (u64)(Plane[RowSize * Row + Half] != NewValue) << Row;
+            Plane[RowSize * Row + Half] = NewValue;
         }
-        case 0x4: // 4xkk - SNE Vx, byte
+    }
+
+    return ChangedRows;
+}
+
+// Right for positive NumPixels, left for negative ones.
+static u64
+ScrollPlaneHorizontally(machine* M, u64* Plane, int NumPixels)
+{
+    MTB_ASSERT(NumPixels != 0 && NumPixels > -64 && NumPixels < 64);
+
+    u64 ChangedRows = 0;
+    if (!M->IsHighResolution)
+    {
+        for (u32 Row = 0; Row < SCREEN_HEIGHT; ++Row)
         {
-            Result.Type = inst::SNE;
-            Result.Args[0].Type = arg::V;
-            Result.Args[0].Value = Decoder.X;
-            Result.Args[1].Type = arg::CONSTANT;
-            Result.Args[1].Value = Decoder.LSB;
-            break;
+            u64 NewRow = NumPixels > 0 ? Plane[Row] >> NumPixels : Plane[Row] << -NumPixels;
+            ChangedRows |= (u64)(Plane[Row] != NewRow) << Row;
+            Plane[Row] = NewRow;
         }
-        case 0x5: // 5xy0 - SE Vx, Vy
+    }
+    else
+    {
+        for (u32 Row = 0; Row < HIRES_SCREEN_HEIGHT; ++Row)
         {
-            Result.Type = inst::SE;
-            Result.Args[0].Type = arg::V;
-            Result.Args[0].Value = Decoder.X;
-            Result.Args[1].Type = arg::V;
-            Result.Args[1].Value = Decoder.Y;
-            break;
+            u64* PlaneRow = Plane + 2 * Row;
+            ChangedRows |= (u64)((PlaneRow[0] | PlaneRow[1]) != 0) << Row;
+            if (NumPixels > 0)
+            {
+                PlaneRow[1] = (PlaneRow[1] >> NumPixels) | (PlaneRow[0] << (64 - NumPixels));
+                PlaneRow[0] >>= NumPixels;
+            }
+            else
+            {
+                PlaneRow[0] = (PlaneRow[0] << -NumPixels) | (PlaneRow[1] >> (64 + NumPixels));
+                PlaneRow[1] <<= -NumPixels;
+            }
         }
-        case 0x6: // 6xkk - LD Vx, byte
-        {
-            Result.Type = inst::LD;
-            Result.Args[0].Type = arg::V;
-            Result.Args[0].Value = Decoder.X;
-            Result.Args[1].Type = arg::CONSTANT;
-            Result.Args[1].Value = Decoder.LSB;
-            break;
-        }
-        case 0x7: // 7xkk - ADD Vx, byte
+    }
+
+    return ChangedRows;
+}
+
+void
+ClearScreen(machine* M)
+{
+    ForEachSelectedPlane(M, [M](u64* Plane) { return ClearPlane(M, Plane); });
+}
+
+void
+ScrollDown(machine* M, int NumRows)
+{
+    ForEachSelectedPlane(M, [M, NumRows](u64* Plane) { return ScrollPlaneVertically(M, Plane, NumRows); });
+}
+
+void
+ScrollUp(machine* M, int NumRows)
+{
+    ForEachSelectedPlane(M, [M, NumRows](u64* Plane) { return ScrollPlaneVertically(M, Plane, -NumRows); });
+}
+
+void
+ScrollRight(machine* M, int NumPixels)
+{
+    ForEachSelectedPlane(M, [M, NumPixels](u64* Plane) { return ScrollPlaneHorizontally(M, Plane, NumPixels); });
+}
+
+void
+ScrollLeft(machine* M, int NumPixels)
+{
+    ForEachSelectedPlane(M, [M, NumPixels](u64* Plane) { return ScrollPlaneHorizontally(M, Plane, -NumPixels); });
+}
+
+void
+SetHighResolution(machine* M, bool IsHighResolution)
+{
+    if (M->IsHighResolution != IsHighResolution)
+    {
+        // Every row of the new resolution is marked, hosts have to redraw
+        // the whole screen anyway.
+        mtb::SliceSetZero(mtb::ArraySlice(M->HighResScreen));
+        if (M->XOChip)
+            mtb::SliceSetZero(mtb::ArraySlice(M->XOChip->Planes));
+        M->IsHighResolution = IsHighResolution;
+        M->DirtyRows = 0;
+        MarkRowsChanged(M, IsHighResolution ? ~0ull : 0xFFFF'FFFFull);
+    }
+}
+
+int
+GetScreenWidth(machine const* M)
+{
+    int Result = M->IsHighResolution ? HIRES_SCREEN_WIDTH : SCREEN_WIDTH;
+    return Result;
+}
+
+int
+GetScreenHeight(machine const* M)
+{
+    int Result = M->IsHighResolution ? HIRES_SCREEN_HEIGHT : SCREEN_HEIGHT;
+    return Result;
+}
+
+// Works for any plane, see `GetPlane`.
+static bool
+IsPixelSet(machine const* M, u64 const* Plane, int X, int Y)
+{
+    bool Result;
+    if (M->IsHighResolution) Result = IsBitSet(Plane[2 * Y + X / 64], (u64)(63 - X % 64));
+    else                     Result = IsPixelSet(Plane, X, Y);
+
+    return Result;
+}
+
+bool
+IsPixelSet(u64 const* Screen, int X, int Y)
+{
+    bool Result = IsBitSet(Screen[Y], (u64)(SCREEN_WIDTH - 1 - X));
+
+    return Result;
+}
+
+bool
+IsPixelSet(machine const* M, int X, int Y)
+{
+    bool Result = IsPixelSet(M, M->Screen, X, Y);
+
+    return Result;
+}
+
+u32
+GetPixelColorIndex(machine const* M, int X, int Y)
+{
+    u32 Result = IsPixelSet(M, M->Screen, X, Y);
+    if (M->XOChip)
+    {
+        for (int PlaneIndex = 1; PlaneIndex < XOCHIP_MAX_PLANES; ++PlaneIndex)
+            Result |= (u32)IsPixelSet(M, &M->XOChip->Planes[PlaneIndex - 1][0][0], X, Y) << PlaneIndex;
+    }
+
+    return Result;
+}
+
+u64
+TakeDirtyRows(machine* M)
+{
+    u64 Result = M->DirtyRows;
+    M->DirtyRows = 0;
+
+    return Result;
+}
+
+u64
+TakeWrittenPages(machine* M)
+{
+    u64 Result = M->WrittenPages;
+    M->WrittenPages = 0;
+
+    return Result;
+}
+
+u8
+ReadByte(void* Ptr)
+{
+    u8 Result = *(u8*)Ptr;
+    return Result;
+}
+
+bool
+IsLittleEndian()
+{
+    uint16_t Test = 0x0001;
+    return ((uint8_t const*)&Test)[0] == 0x01;
+}
+
+u16
+ReadWord(void* Ptr)
+{
+    u16 Result = *(u16*)Ptr;
+    if(IsLittleEndian()) {
+        Result = (u16)((Result << 8) | (Result >> 8));
+    }
+    return Result;
+}
+
+void
+WriteByte(void* Ptr, u8 Value)
+{
+    *(u8*)Ptr = Value;
+}
+
+void
+WriteWord(void* Ptr, u16 Value)
+{
+    if(IsLittleEndian()) {
+        Value = (u16)((Value << 8) | (Value >> 8));
+    }
+    *(u16*)Ptr = Value;
+}
+
+// Runs the engine selected by COUSCOUS_ENGINE, see `ExecuteThreaded` for when it stops early.
+static u64
+ExecuteEngine(machine* M, u64 MaxInstructions)
+{
+    return M->EngineHandler(M, MaxInstructions);
+}
+
+tick_result
+Tick(machine* M)
+{
+    tick_result Result{};
+    Result.Continue = ExecuteEngine(M, 1) == 1;
+
+    return Result;
+}
+
+micro_op
+FetchMicroOp(machine* M, u16 Address)
+{
+    micro_op Result;
+
+    if (Address > sizeof(M->Memory) - 2)
+    {
+        // Ran off the end of memory, e.g. after `JP V0, addr`.
+        Result.Data = 0;
+        Result.Form = OP_INVALID;
+    }
+    // Instructions at odd addresses would share a cache slot with their
+    // even neighbor, so they are simply decoded every time.
+    else if (Address & 1)
+    {
+        instruction_decoder Decoder;
+        Decoder.Data = ReadWord(M->Memory + Address);
+        Result = DecodeMicroOp(Decoder);
+    }
+    else
+    {
+        micro_op* Entry = M->DecodeCache + (Address / 2);
+        Result = *Entry;
+        if (Result.Data == 0)
         {
-            Result.Type = inst::ADD;
-            Result.Args[0].Type = arg::V;
-            Result.Args[0].Value = Decoder.X;
-            Result.Args[1].Type = arg::CONSTANT;
-            Result.Args[1].Value = Decoder.LSB;
-            break;
+            instruction_decoder Decoder;
+            Decoder.Data = ReadWord(M->Memory + Address);
+            Result = DecodeMicroOp(Decoder);
+            *Entry = Result;
         }
-        case 0x8:
+    }
+
+    return Result;
+}
+
+void
+InvalidateDecodeCache(machine* M, u16 Address, u16 NumBytes)
+{
+    if (NumBytes > 0 && Address < MTB_ARRAY_SIZE(M->Memory))
+    {
+        int LastAddress = Address + NumBytes - 1;
+        if (LastAddress >= (int)MTB_ARRAY_SIZE(M->Memory))
+            LastAddress = (int)MTB_ARRAY_SIZE(M->Memory) - 1;
+
+        for (int CacheIndex = Address / 2; CacheIndex <= LastAddress / 2; ++CacheIndex)
+            M->DecodeCache[CacheIndex].Data = 0;
+
+        // Drop every block that covers any of the written bytes. Blocks are
+        // limited in size, so only a few start addresses need to be checked.
+        block_cache* Cache = &M->BlockCache;
+        if (Cache->NumBlocks > 0)
         {
-            Result.Args[0].Type = arg::V;
-            Result.Args[0].Value = Decoder.X;
-            Result.Args[1].Type = arg::V;
-            Result.Args[1].Value = Decoder.Y;
-            switch (Decoder.LSN)
+            int FirstStartAddress = Address - (2 * MAX_CODE_BLOCK_OPS - 1);
+            if (FirstStartAddress < 0)
+                FirstStartAddress = 0;
+
+            for (int StartAddress = FirstStartAddress; StartAddress <= LastAddress; ++StartAddress)
             {
-                case 0x0: Result.Type = inst::LD; break;   // 8xy0 - LD   Vx, Vy
-                case 0x1: Result.Type = inst::OR; break;   // 8xy1 - OR   Vx, Vy
-                case 0x2: Result.Type = inst::AND; break;  // 8xy2 - AND  Vx, Vy
-                case 0x3: Result.Type = inst::XOR; break;  // 8xy3 - XOR  Vx, Vy
-                case 0x4: Result.Type = inst::ADD; break;  // 8xy4 - ADD  Vx, Vy
-                case 0x5: Result.Type = inst::SUB; break;  // 8xy5 - SUB  Vx, Vy
-                case 0x6: Result.Type = inst::SHR; break;  // 8xy6 - SHR  Vx {, Vy}
-                case 0x7: Result.Type = inst::SUBN; break; // 8xy7 - SUBN Vx, Vy
-                case 0xE: Result.Type = inst::SHL; break;  // 8xyE - SHL  Vx {, Vy}
+                u16 BlockIndexPlusOne = Cache->BlockIndexPlusOne[StartAddress];
+                if (BlockIndexPlusOne)
+                {
+                    code_block* Block = Cache->Blocks + (BlockIndexPlusOne - 1);
+                    if (StartAddress + 2 * Block->NumInstructions > Address)
+                        Cache->BlockIndexPlusOne[StartAddress] = 0;
+                }
             }
-            break;
         }
-        case 0x9: // 9xy0 - SNE Vx, Vy
+    }
+}
+
+void
+InvalidateDecodeCache(machine* M)
+{
+    mtb::SliceSetZero(mtb::ArraySlice(M->DecodeCache));
+
+    M->BlockCache.NumBlocks = 0;
+    M->BlockCache.NumOps = 0;
+    mtb::SliceSetZero(mtb::ArraySlice(M->BlockCache.BlockIndexPlusOne));
+}
+
+instruction
+DecodeInstruction(instruction_decoder Decoder)
+{
+    using inst = instruction_type;
+    using arg = argument_type;
+
+    instruction Result{};
+
+    switch (Decoder.Group)
+    {
+        case 0x0:
         {
-            Result.Type = inst::SNE;
-            Result.Args[0].Type = arg::V;
-            Result.Args[0].Value = Decoder.X;
-            Result.Args[1].Type = arg::V;
-            Result.Args[1].Value = Decoder.Y;
+            switch (Decoder.Data)
+            {
+                case 0x0000: // NULL instruction?
+                    break;
+                case 0x00E0: // 00E0 - CLS
+                    Result.Type = inst::CLS;
+                    break;
+                case 0x00EE: // 00EE - RET
+                    Result.Type = inst::RET;
+                    break;
+                case 0x00FB: // 00FB - SCR
+                    Result.Type = inst::SCR;
+                    break;
+                case 0x00FC: // 00FC - SCL
+                    Result.Type = inst::SCL;
+                    break;
+                case 0x00FD: // 00FD - EXIT
+                    Result.Type = inst::EXIT;
+                    break;
+                case 0x00FE: // 00FE - LOW
+                    Result.Type = inst::LOW;
+                    break;
+                case 0x00FF: // 00FF - HIGH
+                    Result.Type = inst::HIGH;
+                    break;
+                default:
+                    if ((Decoder.Data & 0xFFF0) == 0x00C0) // 00Cn - SCD nibble
+                    {
+                        Result.Type = inst::SCD;
+                        Result.Args[0].Type = arg::CONSTANT;
+                        Result.Args[0].Value = Decoder.LSN;
+                    }
+                    else if ((Decoder.Data & 0xFFF0) == 0x00D0) // 00Dn - SCU nibble
+                    {
+                        Result.Type = inst::SCU;
+                        Result.Args[0].Type = arg::CONSTANT;
+                        Result.Args[0].Value = Decoder.LSN;
+                    }
+                    else // 0nnn - SYS addr
+                    {
+                        Result.Type = inst::SYS;
+                        Result.Args[0].Type = arg::CONSTANT;
+                        Result.Args[0].Value = Decoder.Address;
+                    }
+                    break;
+            }
             break;
         }
-        case 0xA: // Annn - LD I, addr
+        case 0x1: // 1nnn - JP addr
         {
-            Result.Type = inst::LD;
-            Result.Args[0].Type = arg::I;
-            Result.Args[1].Type = arg::CONSTANT;
-            Result.Args[1].Value = Decoder.Address;
+            Result.Type = inst::JP;
+            Result.Args[0].Type = arg::CONSTANT;
+            Result.Args[0].Value = Decoder.Address;
             break;
         }
-        case 0xB: // Bnnn - JP V0, addr
+        case 0x2: // 2nnn - CALL addr
         {
-            Result.Type = inst::JP;
-            Result.Args[0].Type = arg::V;
-            Result.Args[0].Value = 0;
-            Result.Args[1].Type = arg::CONSTANT;
-            Result.Args[1].Value = Decoder.Address;
+            Result.Type = inst::CALL;
+            Result.Args[0].Type = arg::CONSTANT;
+            Result.Args[0].Value = Decoder.Address;
             break;
         }
-        case 0xC: // Cxkk - RND Vx, byte
+        case 0x3: // 3xkk - SE Vx, byte
         {
-            Result.Type = inst::RND;
+            Result.Type = inst::SE;
             Result.Args[0].Type = arg::V;
             Result.Args[0].Value = Decoder.X;
             Result.Args[1].Type = arg::CONSTANT;
             Result.Args[1].Value = Decoder.LSB;
             break;
         }
-        case 0xD: // Dxyn - DRW Vx, Vy, nibble
+        case 0x4: // 4xkk - SNE Vx, byte
         {
-            Result.Type = inst::DRW;
+            Result.Type = inst::SNE;
             Result.Args[0].Type = arg::V;
             Result.Args[0].Value = Decoder.X;
-            Result.Args[1].Type = arg::V;
-            Result.Args[1].Value = Decoder.Y;
-            Result.Args[2].Type = arg::CONSTANT;
-            Result.Args[2].Value = Decoder.LSN;
+            Result.Args[1].Type = arg::CONSTANT;
+            Result.Args[1].Value = Decoder.LSB;
             break;
         }
-        case 0xE:
+        case 0x5:
         {
-            Result.Args[0].Type = arg::V;
-            Result.Args[0].Value = Decoder.X;
-            switch (Decoder.LSB)
+            switch (Decoder.LSN)
             {
-                case 0x9E: Result.Type = inst::SKP;  break; // Ex9E - SKP Vx
-                case 0xA1: Result.Type = inst::SKNP; break; // ExA1 - SKNP Vx
+                case 0x2: // 5xy2 - LD [I], Vx, Vy
+                {
+                    Result.Type = inst::LD;
+                    Result.Args[0].Type = arg::ATI;
+                    Result.Args[1].Type = arg::V;
+                    Result.Args[1].Value = Decoder.X;
+                    Result.Args[2].Type = arg::V;
+                    Result.Args[2].Value = Decoder.Y;
+                    break;
+                }
+                case 0x3: // 5xy3 - LD Vx, Vy, [I]
+                {
+                    Result.Type = inst::LD;
+                    Result.Args[0].Type = arg::V;
+                    Result.Args[0].Value = Decoder.X;
+                    Result.Args[1].Type = arg::V;
+                    Result.Args[1].Value = Decoder.Y;
+                    Result.Args[2].Type = arg::ATI;
+                    break;
+                }
+                default: // 5xy0 - SE Vx, Vy
+                {
+                    Result.Type = inst::SE;
+                    Result.Args[0].Type = arg::V;
+                    Result.Args[0].Value = Decoder.X;
+                    Result.Args[1].Type = arg::V;
+                    Result.Args[1].Value = Decoder.Y;
+                    break;
+                }
+            }
+            break;
+        }
+        case 0x6: // 6xkk - LD Vx, byte
+        {
+            Result.Type = inst::LD;
+            Result.Args[0].Type = arg::V;
+            Result.Args[0].Value = Decoder.X;
+            Result.Args[1].Type = arg::CONSTANT;
+            Result.Args[1].Value = Decoder.LSB;
+            break;
+        }
+        case 0x7: // 7xkk - ADD Vx, byte
+        {
+            Result.Type = inst::ADD;
+            Result.Args[0].Type = arg::V;
+            Result.Args[0].Value = Decoder.X;
+            Result.Args[1].Type = arg::CONSTANT;
+            Result.Args[1].Value = Decoder.LSB;
+            break;
+        }
+        case 0x8:
+        {
+            Result.Args[0].Type = arg::V;
+            Result.Args[0].Value = Decoder.X;
+            Result.Args[1].Type = arg::V;
+            Result.Args[1].Value = Decoder.Y;
+            switch (Decoder.LSN)
+            {
+                case 0x0: Result.Type = inst::LD; break;   // 8xy0 - LD   Vx, Vy
+                case 0x1: Result.Type = inst::OR; break;   // 8xy1 - OR   Vx, Vy
+                case 0x2: Result.Type = inst::AND; break;  // 8xy2 - AND  Vx, Vy
+                case 0x3: Result.Type = inst::XOR; break;  // 8xy3 - XOR  Vx, Vy
+                case 0x4: Result.Type = inst::ADD; break;  // 8xy4 - ADD  Vx, Vy
+                case 0x5: Result.Type = inst::SUB; break;  // 8xy5 - SUB  Vx, Vy
+                case 0x6: Result.Type = inst::SHR; break;  // 8xy6 - SHR  Vx {, Vy}
+                case 0x7: Result.Type = inst::SUBN; break; // 8xy7 - SUBN Vx, Vy
+                case 0xE: Result.Type = inst::SHL; break;  // 8xyE - SHL  Vx {, Vy}
+            }
+            break;
+        }
+        case 0x9: // 9xy0 - SNE Vx, Vy
+        {
+            Result.Type = inst::SNE;
+            Result.Args[0].Type = arg::V;
+            Result.Args[0].Value = Decoder.X;
+            Result.Args[1].Type = arg::V;
+            Result.Args[1].Value = Decoder.Y;
+            break;
+        }
+        case 0xA: // Annn - LD I, addr
+        {
+            Result.Type = inst::LD;
+            Result.Args[0].Type = arg::I;
+            Result.Args[1].Type = arg::CONSTANT;
+            Result.Args[1].Value = Decoder.Address;
+            break;
+        }
+        case 0xB: // Bnnn - JP V0, addr
+        {
+            Result.Type = inst::JP;
+            Result.Args[0].Type = arg::V;
+            Result.Args[0].Value = 0;
+            Result.Args[1].Type = arg::CONSTANT;
+            Result.Args[1].Value = Decoder.Address;
+            break;
+        }
+        case 0xC: // Cxkk - RND Vx, byte
+        {
+            Result.Type = inst::RND;
+            Result.Args[0].Type = arg::V;
+            Result.Args[0].Value = Decoder.X;
+            Result.Args[1].Type = arg::CONSTANT;
+            Result.Args[1].Value = Decoder.LSB;
+            break;
+        }
+        case 0xD: // Dxyn - DRW Vx, Vy, nibble
+        {
+            Result.Type = inst::DRW;
+            Result.Args[0].Type = arg::V;
+            Result.Args[0].Value = Decoder.X;
+            Result.Args[1].Type = arg::V;
+            Result.Args[1].Value = Decoder.Y;
+            Result.Args[2].Type = arg::CONSTANT;
+            Result.Args[2].Value = Decoder.LSN;
+            break;
+        }
+        case 0xE:
+        {
+            Result.Args[0].Type = arg::V;
+            Result.Args[0].Value = Decoder.X;
+            switch (Decoder.LSB)
+            {
+                case 0x9E: Result.Type = inst::SKP;  break; // Ex9E - SKP Vx
+                case 0xA1: Result.Type = inst::SKNP; break; // ExA1 - SKNP Vx
             }
             break;
         }
@@ -718,6 +1414,29 @@ DecodeInstruction(instruction_decoder Decoder)
         {
             switch (Decoder.LSB)
             {
+                case 0x00: // F000 - LD I, LONG
+                {
+                    if (Decoder.X == 0)
+                    {
+                        Result.Type = inst::LD;
+                        Result.Args[0].Type = arg::I;
+                        Result.Args[1].Type = arg::LONG;
+                    }
+                    break;
+                }
+                case 0x01: // Fn01 - PLANE nibble
+                {
+                    Result.Type = inst::PLANE;
+                    Result.Args[0].Type = arg::CONSTANT;
+                    Result.Args[0].Value = Decoder.X;
+                    break;
+                }
+                case 0x02: // F002 - AUDIO
+                {
+                    if (Decoder.X == 0)
+                        Result.Type = inst::AUDIO;
+                    break;
+                }
                 case 0x07: // Fx07 - LD Vx, DT
                 {
                     Result.Type = inst::LD;
@@ -766,6 +1485,14 @@ DecodeInstruction(instruction_decoder Decoder)
                     Result.Args[1].Value = Decoder.X;
                     break;
                 }
+                case 0x30: // Fx30 - LD HF, Vx
+                {
+                    Result.Type = inst::LD;
+                    Result.Args[0].Type = arg::HF;
+                    Result.Args[1].Type = arg::V;
+                    Result.Args[1].Value = Decoder.X;
+                    break;
+                }
                 case 0x33: // Fx33 - LD B, Vx
                 {
                     Result.Type = inst::LD;
@@ -774,6 +1501,14 @@ DecodeInstruction(instruction_decoder Decoder)
                     Result.Args[1].Value = Decoder.X;
                     break;
                 }
+                case 0x3A: // Fx3A - LD PITCH, Vx
+                {
+                    Result.Type = inst::LD;
+                    Result.Args[0].Type = arg::PITCH;
+                    Result.Args[1].Type = arg::V;
+                    Result.Args[1].Value = Decoder.X;
+                    break;
+                }
                 case 0x55: // Fx55 - LD [I], Vx
                 {
                     Result.Type = inst::LD;
@@ -790,6 +1525,22 @@ DecodeInstruction(instruction_decoder Decoder)
                     Result.Args[1].Type = arg::ATI;
                     break;
                 }
+                case 0x75: // Fx75 - LD R, Vx
+                {
+                    Result.Type = inst::LD;
+                    Result.Args[0].Type = arg::R;
+                    Result.Args[1].Type = arg::V;
+                    Result.Args[1].Value = Decoder.X;
+                    break;
+                }
+                case 0x85: // Fx85 - LD Vx, R
+                {
+                    Result.Type = inst::LD;
+                    Result.Args[0].Type = arg::V;
+                    Result.Args[0].Value = Decoder.X;
+                    Result.Args[1].Type = arg::R;
+                    break;
+                }
             }
         }
     }
@@ -833,6 +1584,84 @@ EncodeInstruction(instruction Instruction)
             break;
         }
 
+        case instruction_type::SCD:
+        {
+            switch (Instruction.Args[0].Type)
+            {
+                case argument_type::CONSTANT:
+                {
+                    Decoder.Data = 0x00C0;
+                    Decoder.LSN = Instruction.Args[0].Value;
+                    break;
+                }
+            }
+            break;
+        }
+
+        case instruction_type::SCU:
+        {
+            switch (Instruction.Args[0].Type)
+            {
+                case argument_type::CONSTANT:
+                {
+                    Decoder.Data = 0x00D0;
+                    Decoder.LSN = Instruction.Args[0].Value;
+                    break;
+                }
+            }
+            break;
+        }
+
+        case instruction_type::SCR:
+        {
+            Decoder.Data = 0x00FB;
+            break;
+        }
+
+        case instruction_type::SCL:
+        {
+            Decoder.Data = 0x00FC;
+            break;
+        }
+
+        case instruction_type::EXIT:
+        {
+            Decoder.Data = 0x00FD;
+            break;
+        }
+
+        case instruction_type::LOW:
+        {
+            Decoder.Data = 0x00FE;
+            break;
+        }
+
+        case instruction_type::HIGH:
+        {
+            Decoder.Data = 0x00FF;
+            break;
+        }
+
+        case instruction_type::PLANE:
+        {
+            switch (Instruction.Args[0].Type)
+            {
+                case argument_type::CONSTANT:
+                {
+                    Decoder.Data = 0xF001;
+                    Decoder.X = Instruction.Args[0].Value;
+                    break;
+                }
+            }
+            break;
+        }
+
+        case instruction_type::AUDIO:
+        {
+            Decoder.Data = 0xF002;
+            break;
+        }
+
         case instruction_type::JP:
         {
             switch (Instruction.Args[0].Type)
@@ -927,6 +1756,15 @@ EncodeInstruction(instruction Instruction)
                     {
                         case argument_type::V:
                         {
+                            if (Instruction.Args[2].Type == argument_type::V)
+                            {
+                                Decoder.Group = 0x5;
+                                Decoder.X = Instruction.Args[1].Value;
+                                Decoder.Y = Instruction.Args[2].Value;
+                                Decoder.LSN = 0x2;
+                                break;
+                            }
+
                             Decoder.Group = 0xF;
                             Decoder.X = Instruction.Args[1].Value;
                             Decoder.LSB = 0x55;
@@ -977,6 +1815,48 @@ EncodeInstruction(instruction Instruction)
                     }
                     break;
                 }
+                case argument_type::HF:
+                {
+                    switch (Instruction.Args[1].Type)
+                    {
+                        case argument_type::V:
+                        {
+                            Decoder.Group = 0xF;
+                            Decoder.X = Instruction.Args[1].Value;
+                            Decoder.LSB = 0x30;
+                            break;
+                        }
+                    }
+                    break;
+                }
+                case argument_type::R:
+                {
+                    switch (Instruction.Args[1].Type)
+                    {
+                        case argument_type::V:
+                        {
+                            Decoder.Group = 0xF;
+                            Decoder.X = Instruction.Args[1].Value;
+                            Decoder.LSB = 0x75;
+                            break;
+                        }
+                    }
+                    break;
+                }
+                case argument_type::PITCH:
+                {
+                    switch (Instruction.Args[1].Type)
+                    {
+                        case argument_type::V:
+                        {
+                            Decoder.Group = 0xF;
+                            Decoder.X = Instruction.Args[1].Value;
+                            Decoder.LSB = 0x3A;
+                            break;
+                        }
+                    }
+                    break;
+                }
                 case argument_type::I:
                 {
                     switch (Instruction.Args[1].Type)
@@ -987,6 +1867,11 @@ EncodeInstruction(instruction Instruction)
                             Decoder.Address = Instruction.Args[1].Value;
                             break;
                         }
+                        case argument_type::LONG:
+                        {
+                            Decoder.Data = 0xF000;
+                            break;
+                        }
                     }
                     break;
                 }
@@ -1036,11 +1921,20 @@ EncodeInstruction(instruction Instruction)
                             Decoder.LSB = 0x0A;
                             break;
                         }
-                        case argument_type::V:
+                        case argument_type::R:
                         {
-                            Decoder.Group = 0x8;
+                            Decoder.Group = 0xF;
+                            Decoder.X = Instruction.Args[0].Value;
+                            Decoder.LSB = 0x85;
+                            break;
+                        }
+                        case argument_type::V:
+                        {
+                            Decoder.Group = Instruction.Args[2].Type == argument_type::ATI ? 0x5 : 0x8;
                             Decoder.X = Instruction.Args[0].Value;
                             Decoder.Y = Instruction.Args[1].Value;
+                            if (Instruction.Args[2].Type == argument_type::ATI)
+                                Decoder.LSN = 0x3;
                             break;
                         }
                     }
@@ -1336,14 +2230,14 @@ ExecuteInstruction(machine* M, instruction Instruction)
     {
         case instruction_type::CLS:
         {
-            mtb::SliceSetZero(mtb::ArraySlice(M->Screen));
+            ClearScreen(M);
         } return;
 
         case instruction_type::RET:
         {
             if (M->StackPointer > 0)
             {
-                M->ProgramCounter = M->Stack[--M->StackPointer];
+                M->ProgramCounter = M->Stack[--M->StackPointer % MTB_ARRAY_COUNT(M->Stack)];
             }
         } return;
 
@@ -1352,6 +2246,52 @@ ExecuteInstruction(machine* M, instruction Instruction)
             MTB_ASSERT(!"not implemented");
         } return;
 
+        case instruction_type::SCD:
+        {
+            ScrollDown(M, (int)Instruction.Args[0].Value);
+        } return;
+
+        case instruction_type::SCU:
+        {
+            ScrollUp(M, (int)Instruction.Args[0].Value);
+        } return;
+
+        case instruction_type::SCR:
+        {
+            ScrollRight(M, 4);
+        } return;
+
+        case instruction_type::SCL:
+        {
+            ScrollLeft(M, 4);
+        } return;
+
+        case instruction_type::EXIT:
+        {
+            // There's no interpreter to return to, so EXIT loops on itself forever.
+            M->ProgramCounter -= 2;
+        } return;
+
+        case instruction_type::LOW:
+        {
+            SetHighResolution(M, false);
+        } return;
+
+        case instruction_type::HIGH:
+        {
+            SetHighResolution(M, true);
+        } return;
+
+        case instruction_type::PLANE:
+        {
+            M->SelectedPlanes = (u8)Instruction.Args[0].Value;
+        } return;
+
+        case instruction_type::AUDIO:
+        {
+            ReadMemory(M, M->I, AUDIO_PATTERN_SIZE, M->AudioPattern);
+        } return;
+
         case instruction_type::JP:
         {
             switch (Instruction.Args[0].Type)
@@ -1359,6 +2299,8 @@ ExecuteInstruction(machine* M, instruction Instruction)
                 case argument_type::V:
                 {
                     u8* Reg = M->V + Instruction.Args[0].Value;
+                    if ((M->Quirks & quirk_flags::JumpOffsetFromVx) != quirk_flags::NONE)
+                        Reg = M->V + ((Instruction.Args[1].Value >> 8) & 0xF);
                     M->ProgramCounter = Instruction.Args[1].Value + *Reg;
                 } return;
 
@@ -1375,7 +2317,7 @@ ExecuteInstruction(machine* M, instruction Instruction)
             {
                 case argument_type::CONSTANT:
                 {
-                    M->Stack[M->StackPointer++] = M->ProgramCounter;
+                    M->Stack[M->StackPointer++ % MTB_ARRAY_COUNT(M->Stack)] = M->ProgramCounter;
                     M->ProgramCounter = Instruction.Args[0].Value;
                 } return;
             }
@@ -1394,14 +2336,14 @@ ExecuteInstruction(machine* M, instruction Instruction)
                         {
                             u8 Rhs = M->V[Instruction.Args[1].Value];
                             if (Lhs == Rhs)
-                                M->ProgramCounter += 2;
+                                SkipInstruction(M);
                         } return;
 
                         case argument_type::CONSTANT:
                         {
                             u8 Rhs = (u8)Instruction.Args[1].Value;
                             if (Lhs == Rhs)
-                                M->ProgramCounter += 2;
+                                SkipInstruction(M);
                         } return;
                     }
                 } break;
@@ -1421,7 +2363,7 @@ ExecuteInstruction(machine* M, instruction Instruction)
                             u8 Lhs = M->V[Instruction.Args[0].Value];
                             u8 Rhs = M->V[Instruction.Args[1].Value];
                             if (Lhs != Rhs)
-                                M->ProgramCounter += 2;
+                                SkipInstruction(M);
                         } return;
 
                         case argument_type::CONSTANT:
@@ -1429,7 +2371,7 @@ ExecuteInstruction(machine* M, instruction Instruction)
                             u8 Lhs = M->V[Instruction.Args[0].Value];
                             u8 Rhs = (u8)Instruction.Args[1].Value;
                             if (Lhs != Rhs)
-                                M->ProgramCounter += 2;
+                                SkipInstruction(M);
                         } return;
                     }
                 } return;
@@ -1446,10 +2388,16 @@ ExecuteInstruction(machine* M, instruction Instruction)
                     {
                         case argument_type::V:
                         {
+                            if (Instruction.Args[2].Type == argument_type::V)
+                            {
+                                SaveRegisterRange(M, Instruction.Args[1].Value, Instruction.Args[2].Value);
+                                return;
+                            }
+
                             u16 Range = Instruction.Args[1].Value;
-                            u8* Dest = M->Memory + M->I;
-                            u8* Source = M->V + 0;
-                            mtb::CopyBytes(Dest, Source, Range);
+                            WriteMemory(M, M->I, Range, M->V);
+                            if ((M->Quirks & quirk_flags::LoadStoreIncrementsI) != quirk_flags::NONE)
+                                M->I += Range;
                         } return;
                     }
                 } break;
@@ -1461,13 +2409,11 @@ ExecuteInstruction(machine* M, instruction Instruction)
                         case argument_type::V:
                         {
                             u8* Reg = M->V + Instruction.Args[1].Value;
-                            u8* HundredsDigit = M->Memory + (M->I + 0);
-                            u8* TensDigit = M->Memory + (M->I + 1);
-                            u8* SingleDigit = M->Memory + (M->I + 2);
-
-                            *HundredsDigit = (*Reg / 100);
-                            *TensDigit = (*Reg / 10) % 10;
-                            *SingleDigit = *Reg % 10;
+                            u8 Digits[3];
+                            Digits[0] = (*Reg / 100);
+                            Digits[1] = (*Reg / 10) % 10;
+                            Digits[2] = *Reg % 10;
+                            WriteMemory(M, M->I, 3, Digits);
                         } return;
                     }
                 } break;
@@ -1496,6 +2442,30 @@ ExecuteInstruction(machine* M, instruction Instruction)
                     }
                 } break;
 
+                case argument_type::HF:
+                {
+                    switch (Instruction.Args[1].Type)
+                    {
+                        case argument_type::V:
+                        {
+                            u8* Reg = M->V + Instruction.Args[1].Value;
+                            M->I = GetBigDigitSpriteAddress(M, *Reg);
+                        } return;
+                    }
+                } break;
+
+                case argument_type::R:
+                {
+                    switch (Instruction.Args[1].Type)
+                    {
+                        case argument_type::V:
+                        {
+                            u8 Num = GetNumFlagRegisters(Instruction.Args[1].Value);
+                            mtb::CopyBytes(M->FlagRegisters, M->V, Num);
+                        } return;
+                    }
+                } break;
+
                 case argument_type::I:
                 {
                     switch (Instruction.Args[1].Type)
@@ -1504,6 +2474,26 @@ ExecuteInstruction(machine* M, instruction Instruction)
                         {
                             M->I = Instruction.Args[1].Value;
                         } return;
+
+                        case argument_type::LONG:
+                        {
+                            // The address is the next word, which is skipped over.
+                            u8 Address[2];
+                            ReadMemory(M, M->ProgramCounter, 2, Address);
+                            M->I = ReadWord(Address);
+                            M->ProgramCounter += 2;
+                        } return;
+                    }
+                } break;
+
+                case argument_type::PITCH:
+                {
+                    switch (Instruction.Args[1].Type)
+                    {
+                        case argument_type::V:
+                        {
+                            M->AudioPitch = M->V[Instruction.Args[1].Value];
+                        } return;
                     }
                 } break;
 
@@ -1526,9 +2516,9 @@ ExecuteInstruction(machine* M, instruction Instruction)
                         case argument_type::ATI:
                         {
                             u8 Num = (u8)Instruction.Args[0].Value;
-                            u8* Dest = M->V + 0;
-                            u8* Source = M->Memory + M->I;
-                            mtb::CopyBytes(Dest, Source, Num);
+                            ReadMemory(M, M->I, Num, M->V);
+                            if ((M->Quirks & quirk_flags::LoadStoreIncrementsI) != quirk_flags::NONE)
+                                M->I += Num;
                         } return;
 
                         case argument_type::CONSTANT:
@@ -1550,8 +2540,20 @@ ExecuteInstruction(machine* M, instruction Instruction)
                             M->RequiredInputRegisterIndexPlusOne = mtb::IntCast<u8>(Instruction.Args[0].Value + 1);
                         } return;
 
+                        case argument_type::R:
+                        {
+                            u8 Num = GetNumFlagRegisters(Instruction.Args[0].Value);
+                            mtb::CopyBytes(M->V, M->FlagRegisters, Num);
+                        } return;
+
                         case argument_type::V:
                         {
+                            if (Instruction.Args[2].Type == argument_type::ATI)
+                            {
+                                LoadRegisterRange(M, Instruction.Args[0].Value, Instruction.Args[1].Value);
+                                return;
+                            }
+
                             u8* RegA = M->V + Instruction.Args[0].Value;
                             u8* RegB = M->V + Instruction.Args[1].Value;
                             *RegA = *RegB;
@@ -1684,6 +2686,8 @@ ExecuteInstruction(machine* M, instruction Instruction)
                 {
                     u8* RegA = M->V + Instruction.Args[0].Value;
                     u8* RegB = M->V + Instruction.Args[1].Value;
+                    if ((M->Quirks & quirk_flags::ShiftReadsVx) != quirk_flags::NONE)
+                        RegB = RegA;
                     M->V[0xF] = *RegB & 0b0000'0001;
                     *RegB >>= 1;
                     *RegA = *RegB;
@@ -1719,6 +2723,8 @@ ExecuteInstruction(machine* M, instruction Instruction)
                 {
                     u8* RegA = M->V + Instruction.Args[0].Value;
                     u8* RegB = M->V + Instruction.Args[1].Value;
+                    if ((M->Quirks & quirk_flags::ShiftReadsVx) != quirk_flags::NONE)
+                        RegB = RegA;
                     M->V[0xF] = *RegB & 0b0000'0001;
                     *RegB <<= 1;
                     *RegA = *RegB;
@@ -1762,10 +2768,7 @@ ExecuteInstruction(machine* M, instruction Instruction)
                                 {
                                     u8* RegA = M->V + Instruction.Args[0].Value;
                                     u8* RegB = M->V + Instruction.Args[1].Value;
-                                    sprite Sprite;
-                                    Sprite.Length = (int)Instruction.Args[2].Value;
-                                    Sprite.Pixels = (u8*)(M->Memory + M->I);
-                                    DrawSprite(M, *RegA, *RegB, Sprite);
+                                    DrawSpriteFromMemory(M, *RegA, *RegB, (int)Instruction.Args[2].Value);
                                 } return;
                             }
                         } break;
@@ -1783,7 +2786,7 @@ ExecuteInstruction(machine* M, instruction Instruction)
                     u8 KeyIndex = (u8)Instruction.Args[0].Value;
                     if (IsKeyDown(M->InputState, KeyIndex))
                     {
-                        M->ProgramCounter += 2;
+                        SkipInstruction(M);
                     }
                 } return;
             }
@@ -1798,7 +2801,7 @@ ExecuteInstruction(machine* M, instruction Instruction)
                     u8 KeyIndex = (u8)Instruction.Args[0].Value;
                     if (!IsKeyDown(M->InputState, KeyIndex))
                     {
-                        M->ProgramCounter += 2;
+                        SkipInstruction(M);
                     }
                 } return;
             }
@@ -1811,6 +2814,1382 @@ ExecuteInstruction(machine* M, instruction Instruction)
     #endif
 }
 
+//
+// Opcode table
+//
+// The names in `COUSCOUS_OPCODE_FORMS` double as opcode patterns: hex digits
+// have to match, x and y name registers, and n and k are the immediate. Both
+// the decoder below and `InstructionSignatures` are built from these names,
+// so they can't drift apart.
+//
+
+struct opcode_pattern
+{
+    u16 Mask; // Nibbles that are fixed by the pattern.
+    u16 Value;
+    u16 ImmediateMask;
+    bool HasX;
+    bool HasY;
+    int NumFixedNibbles;
+};
+
+constexpr opcode_pattern
+ParseOpcodePattern(opcode_form Form, char const* Pattern)
+{
+    opcode_pattern Result{};
+    for (int NibbleIndex = 0; NibbleIndex < 4; ++NibbleIndex)
+    {
+        char Char = Pattern[NibbleIndex];
+        int Shift = 12 - 4 * NibbleIndex;
+        int Digit = -1;
+        if (Char >= '0' && Char <= '9')
+            Digit = Char - '0';
+        else if (Char >= 'A' && Char <= 'F')
+            Digit = Char - 'A' + 10;
+
+        if (Digit >= 0)
+        {
+            Result.Mask |= (u16)(0xF << Shift);
+            Result.Value |= (u16)(Digit << Shift);
+            ++Result.NumFixedNibbles;
+        }
+        else if (Char == 'x')
+        {
+            Result.HasX = true;
+        }
+        else if (Char == 'y')
+        {
+            Result.HasY = true;
+        }
+        else
+        {
+            Result.ImmediateMask |= (u16)(0xF << Shift);
+        }
+    }
+
+    // The last nibble of 5xy0 and 9xy0 is ignored, just like `DecodeInstruction` does.
+    if (Form == OP_5xy0 || Form == OP_9xy0)
+    {
+        Result.Mask &= 0xFFF0;
+        --Result.NumFixedNibbles;
+    }
+
+    return Result;
+}
+
+// Packs the fields in the same order as `micro_op`. Kept to a single
+// expression since the compiler limits the steps for building the table.
+constexpr u32
+MakeMicroOpData(opcode_form Form, opcode_pattern Pattern, u16 Opcode)
+{
+    return (u32)Form |
+        (Pattern.HasX ? (u32)((Opcode >> 8) & 0xF) << 8 : 0) |
+        (Pattern.HasY ? (u32)((Opcode >> 4) & 0xF) << 12 : 0) |
+        (u32)(Opcode & Pattern.ImmediateMask) << 16;
+}
+
+struct opcode_table
+{
+    u32 MicroOps[1 << 16]; // `micro_op::Data` by raw opcode.
+};
+
+constexpr opcode_table
+BuildOpcodeTable()
+{
+#define COUSCOUS_OPCODE_PATTERN(Suffix) #Suffix,
+    char const* const Patterns[] = { "", COUSCOUS_OPCODE_FORMS(COUSCOUS_OPCODE_PATTERN) };
+#undef COUSCOUS_OPCODE_PATTERN
+
+    opcode_table Result{};
+
+    // Less specific patterns go first so that e.g. 00E0 overwrites 0nnn.
+    for (int NumFixedNibbles = 1; NumFixedNibbles <= 4; ++NumFixedNibbles)
+    {
+        for (int FormIndex = OP_INVALID + 1; FormIndex < OP_COUNT; ++FormIndex)
+        {
+            opcode_form Form = (opcode_form)FormIndex;
+            opcode_pattern Pattern = ParseOpcodePattern(Form, Patterns[FormIndex]);
+            if (Pattern.NumFixedNibbles != NumFixedNibbles)
+                continue;
+
+            // Visit every opcode that matches the pattern by counting through the free bits.
+            u16 FreeBits = (u16)~Pattern.Mask;
+            u16 Bits = 0;
+            do
+            {
+                Result.MicroOps[Pattern.Value | Bits] = MakeMicroOpData(Form, Pattern, (u16)(Pattern.Value | Bits));
+                Bits = (u16)((Bits - FreeBits) & FreeBits);
+            } while (Bits != 0);
+        }
+    }
+
+    // 0000 is not considered a SYS instruction.
+    Result.MicroOps[0x0000] = 0;
+
+    return Result;
+}
+
+static constexpr opcode_table OpcodeTable = BuildOpcodeTable();
+
+opcode_form
+GetOpcodeForm(u16 Opcode)
+{
+    return (opcode_form)(OpcodeTable.MicroOps[Opcode] & 0xFF);
+}
+
+micro_op
+DecodeMicroOp(instruction_decoder Decoder)
+{
+    micro_op Result;
+    Result.Data = OpcodeTable.MicroOps[Decoder.Data];
+    return Result;
+}
+
+//
+// Opcode handlers, one per `opcode_form`. The ProgramCounter already points to the next instruction.
+// Handlers are templates on the `quirk_flags` they implement, see COUSCOUS_SELECT_QUIRKS.
+//
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_00E0(machine* M, micro_op Op)
+{
+    ClearScreen(M);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_00EE(machine* M, micro_op Op)
+{
+    if (M->StackPointer > 0)
+    {
+        M->ProgramCounter = M->Stack[--M->StackPointer % MTB_ARRAY_COUNT(M->Stack)];
+    }
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_00Cn(machine* M, micro_op Op)
+{
+    ScrollDown(M, (int)Op.Imm);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_00Dn(machine* M, micro_op Op)
+{
+    ScrollUp(M, (int)Op.Imm);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_00FB(machine* M, micro_op Op)
+{
+    ScrollRight(M, 4);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_00FC(machine* M, micro_op Op)
+{
+    ScrollLeft(M, 4);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_00FD(machine* M, micro_op Op)
+{
+    M->ProgramCounter -= 2;
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_00FE(machine* M, micro_op Op)
+{
+    SetHighResolution(M, false);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_00FF(machine* M, micro_op Op)
+{
+    SetHighResolution(M, true);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_0nnn(machine* M, micro_op Op)
+{
+    MTB_ASSERT(!"not implemented");
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_1nnn(machine* M, micro_op Op)
+{
+    M->ProgramCounter = Op.Imm;
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_2nnn(machine* M, micro_op Op)
+{
+    // ROMs that never return wrap around instead of writing past the stack.
+    M->Stack[M->StackPointer++ % MTB_ARRAY_COUNT(M->Stack)] = M->ProgramCounter;
+    M->ProgramCounter = Op.Imm;
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_3xkk(machine* M, micro_op Op)
+{
+    if (M->V[Op.X] == Op.Imm)
+        SkipInstruction(M);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_4xkk(machine* M, micro_op Op)
+{
+    if (M->V[Op.X] != Op.Imm)
+        SkipInstruction(M);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_5xy0(machine* M, micro_op Op)
+{
+    if (M->V[Op.X] == M->V[Op.Y])
+        SkipInstruction(M);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_5xy2(machine* M, micro_op Op)
+{
+    SaveRegisterRange(M, Op.X, Op.Y);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_5xy3(machine* M, micro_op Op)
+{
+    LoadRegisterRange(M, Op.X, Op.Y);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_6xkk(machine* M, micro_op Op)
+{
+    M->V[Op.X] = (u8)Op.Imm;
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_7xkk(machine* M, micro_op Op)
+{
+    M->V[Op.X] += (u8)Op.Imm;
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_8xy0(machine* M, micro_op Op)
+{
+    M->V[Op.X] = M->V[Op.Y];
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_8xy1(machine* M, micro_op Op)
+{
+    M->V[Op.X] |= M->V[Op.Y];
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_8xy2(machine* M, micro_op Op)
+{
+    M->V[Op.X] &= M->V[Op.Y];
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_8xy3(machine* M, micro_op Op)
+{
+    M->V[Op.X] ^= M->V[Op.Y];
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_8xy4(machine* M, micro_op Op)
+{
+    u16 Sum = (u16)M->V[Op.X] + (u16)M->V[Op.Y];
+    M->V[0xF] = (u8)(Sum > 255);
+    M->V[Op.X] = (u8)(Sum & 0xFF);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_8xy5(machine* M, micro_op Op)
+{
+    u8* RegA = M->V + Op.X;
+    u8* RegB = M->V + Op.Y;
+    M->V[0xF] = (*RegA > *RegB) ? 1 : 0;
+    *RegA = *RegA - *RegB;
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_8xy6(machine* M, micro_op Op)
+{
+    u8* RegA = M->V + Op.X;
+    u8* RegB = (Quirks & quirk_flags::ShiftReadsVx) != quirk_flags::NONE ? RegA : M->V + Op.Y;
+    M->V[0xF] = *RegB & 0b0000'0001;
+    *RegB >>= 1;
+    *RegA = *RegB;
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_8xy7(machine* M, micro_op Op)
+{
+    u8* RegA = M->V + Op.X;
+    u8* RegB = M->V + Op.Y;
+    M->V[0xF] = (*RegB > *RegA) ? 1 : 0;
+    *RegA = *RegB - *RegA;
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_8xyE(machine* M, micro_op Op)
+{
+    u8* RegA = M->V + Op.X;
+    u8* RegB = (Quirks & quirk_flags::ShiftReadsVx) != quirk_flags::NONE ? RegA : M->V + Op.Y;
+    M->V[0xF] = *RegB & 0b0000'0001;
+    *RegB <<= 1;
+    *RegA = *RegB;
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_9xy0(machine* M, micro_op Op)
+{
+    if (M->V[Op.X] != M->V[Op.Y])
+        SkipInstruction(M);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_Annn(machine* M, micro_op Op)
+{
+    M->I = Op.Imm;
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_Bnnn(machine* M, micro_op Op)
+{
+    u8 Offset = (Quirks & quirk_flags::JumpOffsetFromVx) != quirk_flags::NONE ? M->V[(Op.Imm >> 8) & 0xF] : M->V[0];
+    M->ProgramCounter = Op.Imm + Offset;
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_Cxkk(machine* M, micro_op Op)
+{
+    u8 Rand = (u8)M->RNG.RandomBetween_u32(0, 255);
+    M->V[Op.X] = (u8)Op.Imm & Rand;
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_Dxyn(machine* M, micro_op Op)
+{
+    DrawSpriteFromMemory(M, M->V[Op.X], M->V[Op.Y], (int)Op.Imm);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_Ex9E(machine* M, micro_op Op)
+{
+    if (IsKeyDown(M->InputState, Op.X))
+        SkipInstruction(M);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_ExA1(machine* M, micro_op Op)
+{
+    if (!IsKeyDown(M->InputState, Op.X))
+        SkipInstruction(M);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_F000(machine* M, micro_op Op)
+{
+    u8 Address[2];
+    ReadMemory(M, M->ProgramCounter, 2, Address);
+    M->I = ReadWord(Address);
+    M->ProgramCounter += 2;
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_Fn01(machine* M, micro_op Op)
+{
+    M->SelectedPlanes = (u8)((Op.Imm >> 8) & 0xF);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_F002(machine* M, micro_op Op)
+{
+    ReadMemory(M, M->I, AUDIO_PATTERN_SIZE, M->AudioPattern);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_Fx07(machine* M, micro_op Op)
+{
+    M->V[Op.X] = M->DT;
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_Fx0A(machine* M, micro_op Op)
+{
+    M->RequiredInputRegisterIndexPlusOne = (u8)(Op.X + 1);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_Fx15(machine* M, micro_op Op)
+{
+    M->DT = M->V[Op.X];
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_Fx18(machine* M, micro_op Op)
+{
+    M->ST = M->V[Op.X];
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_Fx1E(machine* M, micro_op Op)
+{
+    M->I += M->V[Op.X];
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_Fx29(machine* M, micro_op Op)
+{
+    M->I = GetDigitSpriteAddress(M, M->V[Op.X]);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_Fx30(machine* M, micro_op Op)
+{
+    M->I = GetBigDigitSpriteAddress(M, M->V[Op.X]);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_Fx33(machine* M, micro_op Op)
+{
+    u8 Value = M->V[Op.X];
+    u8 Digits[3] = { (u8)(Value / 100), (u8)((Value / 10) % 10), (u8)(Value % 10) };
+    WriteMemory(M, M->I, 3, Digits);
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_Fx3A(machine* M, micro_op Op)
+{
+    M->AudioPitch = M->V[Op.X];
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_Fx55(machine* M, micro_op Op)
+{
+    WriteMemory(M, M->I, Op.X, M->V);
+    if ((Quirks & quirk_flags::LoadStoreIncrementsI) != quirk_flags::NONE)
+        M->I += Op.X;
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_Fx65(machine* M, micro_op Op)
+{
+    ReadMemory(M, M->I, Op.X, M->V);
+    if ((Quirks & quirk_flags::LoadStoreIncrementsI) != quirk_flags::NONE)
+        M->I += Op.X;
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_Fx75(machine* M, micro_op Op)
+{
+    mtb::CopyBytes(M->FlagRegisters, M->V, GetNumFlagRegisters(Op.X));
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteOp_Fx85(machine* M, micro_op Op)
+{
+    mtb::CopyBytes(M->V, M->FlagRegisters, GetNumFlagRegisters(Op.X));
+}
+
+//
+// Fused handlers. The ProgramCounter already points past both instructions.
+// They return the number of instructions actually executed, which is only 1
+// if a skip skipped over the jump.
+//
+
+template<quirk_flags Quirks>
+inline u32
+ExecuteOp_3xkk_1nnn(machine* M, micro_op Op, micro_op Fused)
+{
+    if (M->V[Op.X] != Op.Imm)
+    {
+        M->ProgramCounter = Fused.Imm;
+        return 2;
+    }
+
+    return 1;
+}
+
+template<quirk_flags Quirks>
+inline u32
+ExecuteOp_4xkk_1nnn(machine* M, micro_op Op, micro_op Fused)
+{
+    if (M->V[Op.X] == Op.Imm)
+    {
+        M->ProgramCounter = Fused.Imm;
+        return 2;
+    }
+
+    return 1;
+}
+
+template<quirk_flags Quirks>
+inline u32
+ExecuteOp_5xy0_1nnn(machine* M, micro_op Op, micro_op Fused)
+{
+    if (M->V[Op.X] != M->V[Op.Y])
+    {
+        M->ProgramCounter = Fused.Imm;
+        return 2;
+    }
+
+    return 1;
+}
+
+template<quirk_flags Quirks>
+inline u32
+ExecuteOp_9xy0_1nnn(machine* M, micro_op Op, micro_op Fused)
+{
+    if (M->V[Op.X] == M->V[Op.Y])
+    {
+        M->ProgramCounter = Fused.Imm;
+        return 2;
+    }
+
+    return 1;
+}
+
+template<quirk_flags Quirks>
+inline u32
+ExecuteOp_6xkk_7xkk(machine* M, micro_op Op, micro_op Fused)
+{
+    ExecuteOp_6xkk<Quirks>(M, Op);
+    ExecuteOp_7xkk<Quirks>(M, Fused);
+    return 2;
+}
+
+template<quirk_flags Quirks>
+inline u32
+ExecuteOp_6xkk_8xy4(machine* M, micro_op Op, micro_op Fused)
+{
+    ExecuteOp_6xkk<Quirks>(M, Op);
+    ExecuteOp_8xy4<Quirks>(M, Fused);
+    return 2;
+}
+
+template<quirk_flags Quirks>
+inline u32
+ExecuteOp_Annn_Dxyn(machine* M, micro_op Op, micro_op Fused)
+{
+    ExecuteOp_Annn<Quirks>(M, Op);
+    ExecuteOp_Dxyn<Quirks>(M, Fused);
+    return 2;
+}
+
+template<quirk_flags Quirks>
+inline void
+ExecuteMicroOpWithQuirks(machine* M, micro_op Op)
+{
+#define COUSCOUS_HANDLER(Suffix) case OP_##Suffix: ExecuteOp_##Suffix<Quirks>(M, Op); break;
+
+    switch (Op.Form)
+    {
+        COUSCOUS_OPCODE_FORMS(COUSCOUS_HANDLER)
+    }
+
+#undef COUSCOUS_HANDLER
+}
+
+void
+ExecuteMicroOp(machine* M, micro_op Op)
+{
+    M->MicroOpHandler(M, Op);
+}
+
+void
+SkipInstruction(machine* M)
+{
+    u16 Skipped = M->ProgramCounter;
+    M->ProgramCounter += 2;
+    if (M->XOChip && Skipped < sizeof(M->Memory) - 1 && M->Memory[Skipped] == 0xF0 && M->Memory[Skipped + 1] == 0x00)
+        M->ProgramCounter += 2;
+}
+
+template<quirk_flags Quirks>
+static u64
+ExecuteSwitchWithQuirks(machine* M, u64 MaxInstructions)
+{
+    u64 NumExecuted = 0;
+    while (NumExecuted < MaxInstructions && !M->RequiredInputRegisterIndexPlusOne)
+    {
+        // Fetch new instruction.
+        micro_op Op = FetchMicroOp(M, M->ProgramCounter);
+        if (Op.Form == OP_INVALID)
+            break;
+
+        // Advance the program counter.
+        M->ProgramCounter += 2;
+
+        // Execute the fetched instruction.
+        ExecuteMicroOpWithQuirks<Quirks>(M, Op);
+        ++NumExecuted;
+    }
+
+    return NumExecuted;
+}
+
+u64
+ExecuteSwitch(machine* M, u64 MaxInstructions)
+{
+    COUSCOUS_SELECT_QUIRKS(M->Quirks, return ExecuteSwitchWithQuirks, M, MaxInstructions);
+}
+
+// Returns the number of instructions executed.
+template<quirk_flags Quirks>
+static u32
+ExecuteBlockOp(machine* M, block_op* BlockOp)
+{
+#define COUSCOUS_HANDLER(Suffix) case OP_##Suffix: ExecuteOp_##Suffix<Quirks>(M, BlockOp->Op); break;
+#define COUSCOUS_FUSED_HANDLER(Suffix) case OP_##Suffix: Result = ExecuteOp_##Suffix<Quirks>(M, BlockOp->Op, BlockOp->Fused); break;
+
+    u32 Result = 1;
+    switch (BlockOp->Op.Form)
+    {
+        COUSCOUS_OPCODE_FORMS(COUSCOUS_HANDLER)
+        COUSCOUS_FUSED_OPCODE_FORMS(COUSCOUS_FUSED_HANDLER)
+    }
+
+#undef COUSCOUS_FUSED_HANDLER
+#undef COUSCOUS_HANDLER
+
+    return Result;
+}
+
+// Label tables for computed goto. The order matches `opcode_form`.
+#define COUSCOUS_LABEL_ADDRESS(Suffix) &&Label_##Suffix,
+
+template<quirk_flags Quirks>
+static u64
+ExecuteThreadedWithQuirks(machine* M, u64 MaxInstructions)
+{
+    if (M->RequiredInputRegisterIndexPlusOne)
+        return 0;
+
+    u64 NumExecuted = 0;
+    micro_op Op;
+
+    // Every handler ends by fetching and dispatching the next instruction
+    // itself (direct threading). With computed goto, each handler gets its
+    // own indirect jump which the branch predictor can learn separately.
+    // Otherwise we fall back to a single flat switch.
+#define COUSCOUS_FETCH()                                              \
+    if (NumExecuted == MaxInstructions)                               \
+        goto Done;                                                    \
+    Op = FetchMicroOp(M, M->ProgramCounter);                          \
+    if (Op.Form == OP_INVALID)                                        \
+        goto Done;                                                    \
+    M->ProgramCounter += 2;                                           \
+    ++NumExecuted
+
+    // The condition is constant, so this costs nothing in all other handlers.
+#define COUSCOUS_STOP_IF_WAITING(Suffix) if (OP_##Suffix == OP_Fx0A) goto Done
+
+#if COUSCOUS_COMPUTED_GOTO
+    static void* const Labels[] = { &&Label_INVALID, COUSCOUS_OPCODE_FORMS(COUSCOUS_LABEL_ADDRESS) };
+    static_assert(MTB_ARRAY_COUNT(Labels) == OP_COUNT, "Missing handlers.");
+
+#define COUSCOUS_DISPATCH() do { COUSCOUS_FETCH(); goto *Labels[Op.Form]; } while (false)
+#define COUSCOUS_HANDLER(Suffix) Label_##Suffix: ExecuteOp_##Suffix<Quirks>(M, Op); COUSCOUS_STOP_IF_WAITING(Suffix); COUSCOUS_DISPATCH();
+
+    COUSCOUS_DISPATCH();
+    Label_INVALID: goto Done; // Unreachable, invalid instructions never leave COUSCOUS_FETCH.
+    COUSCOUS_OPCODE_FORMS(COUSCOUS_HANDLER)
+#else
+#define COUSCOUS_HANDLER(Suffix) case OP_##Suffix: ExecuteOp_##Suffix<Quirks>(M, Op); COUSCOUS_STOP_IF_WAITING(Suffix); continue;
+
+    while (true)
+    {
+        COUSCOUS_FETCH();
+        switch (Op.Form)
+        {
+            COUSCOUS_OPCODE_FORMS(COUSCOUS_HANDLER)
+        }
+    }
+#endif
+
+#undef COUSCOUS_HANDLER
+#undef COUSCOUS_DISPATCH
+#undef COUSCOUS_STOP_IF_WAITING
+#undef COUSCOUS_FETCH
+
+Done:
+    return NumExecuted;
+}
+
+u64
+ExecuteThreaded(machine* M, u64 MaxInstructions)
+{
+    COUSCOUS_SELECT_QUIRKS(M->Quirks, return ExecuteThreadedWithQuirks, M, MaxInstructions);
+}
+
+static bool
+EndsCodeBlock(opcode_form Form)
+{
+    bool Result = false;
+    switch (Form)
+    {
+        case OP_00EE: // RET
+        case OP_00FD: // EXIT
+        case OP_0nnn: // SYS addr
+        case OP_1nnn: // JP addr
+        case OP_2nnn: // CALL addr
+        case OP_3xkk: // SE Vx, byte
+        case OP_4xkk: // SNE Vx, byte
+        case OP_5xy0: // SE Vx, Vy
+        case OP_5xy2: // LD [I], Vx, Vy
+        case OP_9xy0: // SNE Vx, Vy
+        case OP_Bnnn: // JP V0, addr
+        case OP_Ex9E: // SKP Vx
+        case OP_ExA1: // SKNP Vx
+        case OP_F000: // LD I, LONG, reads the word at the ProgramCounter
+        case OP_Fx0A: // LD Vx, K
+        case OP_Fx33: // LD B, Vx
+        case OP_Fx55: // LD [I], Vx
+            Result = true;
+            break;
+    }
+
+    return Result;
+}
+
+static u32 GlobalNextCodeBlockId = 1;
+
+// Replaces pairs of ops in place and returns the new number of ops. Only the
+// last op of a block can be a skip, and blocks are looked up by their start
+// address, so a jump into the middle of a fused pair simply ends up in a
+// different block.
+static int
+FuseBlockOps(block_cache* Cache, block_op* Ops, int NumOps)
+{
+    int NumResultOps = 0;
+    for (int OpIndex = 0; OpIndex < NumOps; ++OpIndex)
+    {
+        block_op BlockOp = Ops[OpIndex];
+        if (OpIndex + 1 < NumOps)
+        {
+            micro_op Next = Ops[OpIndex + 1].Op;
+            opcode_form FusedForm = OP_INVALID;
+            switch (BlockOp.Op.Form)
+            {
+                case OP_3xkk: if (Next.Form == OP_1nnn) FusedForm = OP_3xkk_1nnn; break;
+                case OP_4xkk: if (Next.Form == OP_1nnn) FusedForm = OP_4xkk_1nnn; break;
+                case OP_5xy0: if (Next.Form == OP_1nnn) FusedForm = OP_5xy0_1nnn; break;
+                case OP_9xy0: if (Next.Form == OP_1nnn) FusedForm = OP_9xy0_1nnn; break;
+                case OP_6xkk:
+                {
+                    if (Next.Form == OP_7xkk) FusedForm = OP_6xkk_7xkk;
+                    else if (Next.Form == OP_8xy4) FusedForm = OP_6xkk_8xy4;
+                } break;
+                case OP_Annn: if (Next.Form == OP_Dxyn) FusedForm = OP_Annn_Dxyn; break;
+            }
+
+            if (FusedForm != OP_INVALID)
+            {
+                BlockOp.Op.Form = FusedForm;
+                BlockOp.Fused = Next;
+                ++Cache->NumFusedOpsBuilt[FusedForm - OP_COUNT];
+                ++OpIndex;
+            }
+        }
+
+        Ops[NumResultOps++] = BlockOp;
+    }
+
+    return NumResultOps;
+}
+
+code_block*
+FindOrBuildBlock(machine* M, u16 Address)
+{
+    block_cache* Cache = &M->BlockCache;
+    code_block* Result = nullptr;
+
+    if (Address < MTB_ARRAY_SIZE(M->Memory) - 1)
+    {
+        u16 BlockIndexPlusOne = Cache->BlockIndexPlusOne[Address];
+        if (BlockIndexPlusOne)
+        {
+            Result = Cache->Blocks + (BlockIndexPlusOne - 1);
+        }
+        else
+        {
+            // Start over once we run out of space.
+            if (Cache->NumBlocks == MAX_CODE_BLOCKS || Cache->NumOps + MAX_CODE_BLOCK_OPS > CODE_BLOCK_OP_POOL_SIZE)
+            {
+                Cache->NumBlocks = 0;
+                Cache->NumOps = 0;
+                mtb::SliceSetZero(mtb::ArraySlice(Cache->BlockIndexPlusOne));
+            }
+
+            code_block Block{};
+            Block.Id = GlobalNextCodeBlockId++;
+            if (Block.Id == 0)
+                Block.Id = GlobalNextCodeBlockId++;
+            Block.StartAddress = Address;
+            Block.FirstOp = (u16)Cache->NumOps;
+
+            block_op* Ops = Cache->Ops + Block.FirstOp;
+            u16 CurrentAddress = Address;
+            while (Block.NumInstructions < MAX_CODE_BLOCK_OPS && CurrentAddress < MTB_ARRAY_SIZE(M->Memory) - 1)
+            {
+                micro_op Op = FetchMicroOp(M, CurrentAddress);
+                opcode_form Form = (opcode_form)Op.Form;
+                if (Form == OP_INVALID)
+                    break;
+
+                Ops[Block.NumInstructions++] = block_op{ Op };
+                CurrentAddress += 2;
+
+                if (EndsCodeBlock(Form))
+                {
+#if COUSCOUS_FUSION
+                    // Pull in a JP right after a skip so the two can be fused.
+                    bool IsSkip = Form == OP_3xkk || Form == OP_4xkk || Form == OP_5xy0 || Form == OP_9xy0;
+                    if (IsSkip && Block.NumInstructions < MAX_CODE_BLOCK_OPS && CurrentAddress < MTB_ARRAY_SIZE(M->Memory) - 1)
+                    {
+                        Op = FetchMicroOp(M, CurrentAddress);
+                        if (Op.Form == OP_1nnn)
+                            Ops[Block.NumInstructions++] = block_op{ Op };
+                    }
+#endif
+                    break;
+                }
+            }
+
+#if COUSCOUS_FUSION
+            Block.NumOps = (u16)FuseBlockOps(Cache, Ops, Block.NumInstructions);
+#else
+            Block.NumOps = Block.NumInstructions;
+#endif
+
+            // A block starting with an invalid instruction is not registered.
+            if (Block.NumOps > 0)
+            {
+                Cache->NumOps += Block.NumOps;
+                Result = Cache->Blocks + Cache->NumBlocks++;
+                *Result = Block;
+                Cache->BlockIndexPlusOne[Address] = (u16)Cache->NumBlocks;
+            }
+        }
+    }
+
+    return Result;
+}
+
+template<quirk_flags Quirks>
+static u64
+ExecuteBlocksWithQuirks(machine* M, u64 MaxInstructions)
+{
+    block_cache* Cache = &M->BlockCache;
+    u64 NumExecuted = 0;
+    block_op* BlockOp;
+    block_op* OnePastLastOp;
+
+#if COUSCOUS_COMPUTED_GOTO
+    // Within a block, handlers dispatch directly to the next op, just like `ExecuteThreaded`.
+    static void* const Labels[] =
+    {
+        &&Label_INVALID,
+        COUSCOUS_OPCODE_FORMS(COUSCOUS_LABEL_ADDRESS)
+        COUSCOUS_FUSED_OPCODE_FORMS(COUSCOUS_LABEL_ADDRESS)
+    };
+    static_assert(MTB_ARRAY_COUNT(Labels) == OP_COUNT_INCLUDING_FUSED, "Missing handlers.");
+
+#define COUSCOUS_DISPATCH()                         \
+    if (++BlockOp < OnePastLastOp)                  \
+        goto *Labels[BlockOp->Op.Form];             \
+    goto EndOfBlock
+#define COUSCOUS_HANDLER(Suffix) Label_##Suffix: ExecuteOp_##Suffix<Quirks>(M, BlockOp->Op); COUSCOUS_DISPATCH();
+#if COUSCOUS_FUSION_STATS
+#define COUSCOUS_FUSED_HANDLER(Suffix) Label_##Suffix: ++Cache->NumFusedOpsExecuted[OP_##Suffix - OP_COUNT]; NumExecuted -= 2 - ExecuteOp_##Suffix<Quirks>(M, BlockOp->Op, BlockOp->Fused); COUSCOUS_DISPATCH();
+#else
+#define COUSCOUS_FUSED_HANDLER(Suffix) Label_##Suffix: NumExecuted -= 2 - ExecuteOp_##Suffix<Quirks>(M, BlockOp->Op, BlockOp->Fused); COUSCOUS_DISPATCH();
+#endif
+#endif
+
+    // LD Vx, K always ends a block, so waiting for a key is checked once per block.
+    while (NumExecuted < MaxInstructions && !M->RequiredInputRegisterIndexPlusOne)
+    {
+        // Fast path for blocks that already exist.
+        code_block* Block;
+        u16 BlockIndexPlusOne = Cache->BlockIndexPlusOne[M->ProgramCounter & 0xFFF];
+        if (BlockIndexPlusOne && M->ProgramCounter < MTB_ARRAY_SIZE(M->Memory))
+            Block = Cache->Blocks + (BlockIndexPlusOne - 1);
+        else
+            Block = FindOrBuildBlock(M, M->ProgramCounter);
+
+        if (Block && Block->NumInstructions <= MaxInstructions - NumExecuted)
+        {
+            // Only the last op of a block can read the ProgramCounter (CALL,
+            // skips) or write to memory. So the ProgramCounter is advanced
+            // for the whole block up front and the ops stay valid until the
+            // block is done.
+            M->ProgramCounter = (u16)(Block->StartAddress + 2 * Block->NumInstructions);
+            BlockOp = Cache->Ops + Block->FirstOp;
+            OnePastLastOp = BlockOp + Block->NumOps;
+#if COUSCOUS_COMPUTED_GOTO
+            NumExecuted += Block->NumInstructions; // Fused handlers correct this if they skipped something.
+            goto *Labels[BlockOp->Op.Form];
+
+            Label_INVALID: goto EndOfBlock; // Unreachable, blocks never contain invalid instructions.
+            COUSCOUS_OPCODE_FORMS(COUSCOUS_HANDLER)
+            COUSCOUS_FUSED_OPCODE_FORMS(COUSCOUS_FUSED_HANDLER)
+
+        EndOfBlock:;
+#else
+            for (; BlockOp < OnePastLastOp; ++BlockOp)
+            {
+#if COUSCOUS_FUSION_STATS
+                if (BlockOp->Op.Form >= OP_COUNT)
+                    ++Cache->NumFusedOpsExecuted[BlockOp->Op.Form - OP_COUNT];
+#endif
+                NumExecuted += ExecuteBlockOp<Quirks>(M, BlockOp);
+            }
+#endif
+        }
+        else
+        {
+            // Let the threaded engine deal with anything unusual, including
+            // budgets too small for the whole block.
+            u64 NumSingleStep = ExecuteThreadedWithQuirks<Quirks>(M, Block ? MaxInstructions - NumExecuted : 1);
+            if (NumSingleStep == 0)
+                break;
+
+            NumExecuted += NumSingleStep;
+        }
+    }
+
+#if COUSCOUS_COMPUTED_GOTO
+#undef COUSCOUS_FUSED_HANDLER
+#undef COUSCOUS_HANDLER
+#undef COUSCOUS_DISPATCH
+#endif
+
+    return NumExecuted;
+}
+
+u64
+ExecuteBlocks(machine* M, u64 MaxInstructions)
+{
+    COUSCOUS_SELECT_QUIRKS(M->Quirks, return ExecuteBlocksWithQuirks, M, MaxInstructions);
+}
+
+#undef COUSCOUS_LABEL_ADDRESS
+
+template<quirk_flags Quirks>
+u64
+ExecuteEngineWithQuirks(machine* M, u64 MaxInstructions)
+{
+#if COUSCOUS_ENGINE == COUSCOUS_ENGINE_THREADED
+    return ExecuteThreadedWithQuirks<Quirks>(M, MaxInstructions);
+#elif COUSCOUS_ENGINE == COUSCOUS_ENGINE_BLOCKS
+    return ExecuteBlocksWithQuirks<Quirks>(M, MaxInstructions);
+#else
+    return ExecuteSwitchWithQuirks<Quirks>(M, MaxInstructions);
+#endif
+}
+
+template<quirk_flags Quirks>
+static void
+SetQuirkHandlers(machine* M)
+{
+    M->MicroOpHandler = ExecuteMicroOpWithQuirks<Quirks>;
+    M->EngineHandler = ExecuteEngineWithQuirks<Quirks>;
+}
+
+void
+SetQuirks(machine* M, quirk_flags Quirks)
+{
+    M->Quirks = Quirks & quirk_flags::ALL;
+    COUSCOUS_SELECT_QUIRKS(M->Quirks, SetQuirkHandlers, M);
+}
+
+void
+PrintFusionStats(FILE* OutFile, block_cache* Cache)
+{
+#define COUSCOUS_FUSED_NAME(Suffix) #Suffix,
+    static char const* const Names[] = { COUSCOUS_FUSED_OPCODE_FORMS(COUSCOUS_FUSED_NAME) };
+#undef COUSCOUS_FUSED_NAME
+    static_assert(MTB_ARRAY_COUNT(Names) == NUM_FUSED_OPCODE_FORMS, "Missing names.");
+
+#if COUSCOUS_FUSION_STATS
+    fprintf(OutFile, "%-12s %12s %16s\n", "Fusion", "Built", "Executed");
+    for (int Index = 0; Index < NUM_FUSED_OPCODE_FORMS; ++Index)
+        fprintf(OutFile, "%-12s %12llu %16llu\n", Names[Index], (unsigned long long)Cache->NumFusedOpsBuilt[Index], (unsigned long long)Cache->NumFusedOpsExecuted[Index]);
+#else
+    fprintf(OutFile, "%-12s %12s\n", "Fusion", "Built");
+    for (int Index = 0; Index < NUM_FUSED_OPCODE_FORMS; ++Index)
+        fprintf(OutFile, "%-12s %12llu\n", Names[Index], (unsigned long long)Cache->NumFusedOpsBuilt[Index]);
+#endif
+}
+
+#if COUSCOUS_SKIP_IDLE_LOOPS
+
+enum
+{
+    IDLE_LOOP_MAX_INSTRUCTIONS = 16,
+    IDLE_LOOP_CHECK_INTERVAL = 4096,
+};
+
+// Whether the op only depends on and changes registers, timers, and the
+// ProgramCounter. Neither input nor timers change within `RunCycles`, so a
+// loop of these ops that comes back to the same state repeats forever.
+static bool
+IsIdleLoopOp(opcode_form Form)
+{
+    bool Result = false;
+    switch (Form)
+    {
+        case OP_1nnn: case OP_Bnnn:
+        case OP_3xkk: case OP_4xkk: case OP_5xy0: case OP_9xy0:
+        case OP_6xkk: case OP_7xkk:
+        case OP_8xy0: case OP_8xy1: case OP_8xy2: case OP_8xy3:
+        case OP_8xy4: case OP_8xy5: case OP_8xy6: case OP_8xy7: case OP_8xyE:
+        case OP_Annn:
+        case OP_Ex9E: case OP_ExA1:
+        case OP_Fx07: case OP_Fx15: case OP_Fx18: case OP_Fx1E: case OP_Fx29: case OP_Fx65:
+        case OP_00FD: case OP_Fx30: case OP_Fx85:
+            Result = true;
+            break;
+
+        default:
+            break;
+    }
+
+    return Result;
+}
+
+struct idle_loop_state
+{
+    u8 V[16];
+    u16 I;
+    u8 DT;
+    u8 ST;
+};
+
+static idle_loop_state
+GetIdleLoopState(machine* M)
+{
+    idle_loop_state Result;
+    mtb::CopyBytes(Result.V, M->V, sizeof(Result.V));
+    Result.I = M->I;
+    Result.DT = M->DT;
+    Result.ST = M->ST;
+
+    return Result;
+}
+
+// Executes instructions until the ProgramCounter and registers are back where
+// they started, i.e. the program is stuck in a loop like `JP self` or
+// `LD Vx, DT; SE Vx, 0; JP back`. Whole iterations within MaxInstructions are
+// then only counted. Gives up after IDLE_LOOP_MAX_INSTRUCTIONS or at the
+// first op that does anything else.
+// Returns the number of instructions executed or skipped.
+static u64
+SkipIdleLoop(machine* M, u64 MaxInstructions)
+{
+    u16 StartAddress = M->ProgramCounter;
+    idle_loop_state StartState = GetIdleLoopState(M);
+
+    u64 NumExecuted = 0;
+    u64 NumExecutedAtStart = 0;
+    while (NumExecuted < MaxInstructions && NumExecuted < IDLE_LOOP_MAX_INSTRUCTIONS)
+    {
+        micro_op Op = FetchMicroOp(M, M->ProgramCounter);
+        if (!IsIdleLoopOp((opcode_form)Op.Form))
+            break;
+
+        M->ProgramCounter += 2;
+        ExecuteMicroOp(M, Op);
+        ++NumExecuted;
+
+        if (M->ProgramCounter == StartAddress)
+        {
+            // The first iteration may still change something, e.g. load DT into Vx.
+            idle_loop_state State = GetIdleLoopState(M);
+            if (mtb::BytesAreEqual(&State, &StartState, sizeof(State)))
+            {
+                u64 LoopLength = NumExecuted - NumExecutedAtStart;
+                NumExecuted += (MaxInstructions - NumExecuted) / LoopLength * LoopLength;
+                break;
+            }
+
+            StartState = State;
+            NumExecutedAtStart = NumExecuted;
+        }
+    }
+
+    return NumExecuted;
+}
+
+#endif
+
+// Executes up to MaxInstructions for `RunCycles`, ignoring the timers.
+// Adds ScreenChanged or Breakpoint to Result if they stopped execution.
+static u64
+RunInstructions(machine* M, u64 MaxInstructions, stop_reason StopMask, bool IgnoreStartBreakpoint, stop_reason* Result)
+{
+    u64 NumExecuted = 0;
+
+    bool CheckBreakpoints = (StopMask & stop_reason::Breakpoint) != stop_reason::NONE && M->NumBreakpoints > 0;
+    bool CheckScreen = (StopMask & stop_reason::ScreenChanged) != stop_reason::NONE;
+    if (!CheckBreakpoints && !CheckScreen)
+    {
+#if COUSCOUS_SKIP_IDLE_LOOPS
+        // Looks for idle loops every now and then. Programs usually spin
+        // there until the timers or input change again.
+        while (NumExecuted < MaxInstructions)
+        {
+            NumExecuted += SkipIdleLoop(M, MaxInstructions - NumExecuted);
+
+            u64 NumToExecute = MaxInstructions - NumExecuted;
+            if (NumToExecute > IDLE_LOOP_CHECK_INTERVAL)
+                NumToExecute = IDLE_LOOP_CHECK_INTERVAL;
+
+            u64 NumEngineExecuted = ExecuteEngine(M, NumToExecute);
+            NumExecuted += NumEngineExecuted;
+            if (NumEngineExecuted < NumToExecute)
+                break;
+        }
+#else
+        NumExecuted = ExecuteEngine(M, MaxInstructions);
+#endif
+    }
+    else
+    {
+        // Every instruction has to be looked at here, so this steps through
+        // them one by one. Only debuggers should need this.
+        while (NumExecuted < MaxInstructions)
+        {
+            if (CheckBreakpoints && (NumExecuted > 0 || !IgnoreStartBreakpoint) && IsBreakpoint(M, M->ProgramCounter))
+            {
+                *Result = *Result | stop_reason::Breakpoint;
+                break;
+            }
+
+            micro_op Op = FetchMicroOp(M, M->ProgramCounter);
+            if (Op.Form == OP_INVALID)
+                break;
+
+            u32 DisplayGeneration = M->DisplayGeneration;
+            M->ProgramCounter += 2;
+            ExecuteMicroOp(M, Op);
+            ++NumExecuted;
+
+            if (Op.Form == OP_Fx0A)
+                break;
+
+            if (CheckScreen && M->DisplayGeneration != DisplayGeneration)
+            {
+                *Result = *Result | stop_reason::ScreenChanged;
+                break;
+            }
+        }
+    }
+
+    return NumExecuted;
+}
+
+u64
+GetNextTimerCycle(machine* M)
+{
+    MTB_ASSERT(M->InstructionsPerSecond > 0);
+
+    // Timer tick N happens at the first cycle C with C * TIMER_FREQUENCY /
+    // InstructionsPerSecond >= N, so speeds that are not a multiple of
+    // TIMER_FREQUENCY don't drift.
+    u64 InstructionsPerSecond = M->InstructionsPerSecond;
+    u64 NextTimerTick = M->CurrentCycle * TIMER_FREQUENCY / InstructionsPerSecond + 1;
+    return (NextTimerTick * InstructionsPerSecond + TIMER_FREQUENCY - 1) / TIMER_FREQUENCY;
+}
+
+static void
+CountDownTimers(machine* M)
+{
+    if (M->DT > 0)
+        --M->DT;
+    if (M->ST > 0)
+        --M->ST;
+}
+
+stop_reason
+RunCycles(machine* M, u64 MaxCycles, stop_reason StopMask)
+{
+    stop_reason Result = stop_reason::NONE;
+    u64 NumCycles = 0;
+
+    // Execution is split at every timer tick so DT and ST change at the
+    // same cycles no matter how hosts slice their budget.
+    while (NumCycles < MaxCycles && Result == stop_reason::NONE)
+    {
+        u64 NumToRun = MaxCycles - NumCycles;
+        u64 NextTimerCycle = 0;
+        if (M->InstructionsPerSecond)
+        {
+            NextTimerCycle = GetNextTimerCycle(M);
+            if (NumToRun > NextTimerCycle - M->CurrentCycle)
+                NumToRun = NextTimerCycle - M->CurrentCycle;
+        }
+
+        bool WasWaitingForKey = M->RequiredInputRegisterIndexPlusOne != 0;
+        u64 NumRun;
+        if (WasWaitingForKey)
+        {
+            // Nothing to execute until the key was provided, only time passes.
+            NumRun = M->InstructionsPerSecond ? NumToRun : 0;
+        }
+        else
+        {
+            NumRun = RunInstructions(M, NumToRun, StopMask, NumCycles == 0, &Result);
+        }
+
+        M->CurrentCycle += NumRun;
+        NumCycles += NumRun;
+
+        if (M->InstructionsPerSecond && M->CurrentCycle == NextTimerCycle)
+            CountDownTimers(M);
+
+        if (NumRun < NumToRun || (!WasWaitingForKey && M->RequiredInputRegisterIndexPlusOne))
+            break;
+    }
+
+    if (M->RequiredInputRegisterIndexPlusOne)
+        Result = Result | stop_reason::WaitingForKey;
+
+    if (NumCycles == MaxCycles)
+        Result = Result | stop_reason::CycleBudget;
+
+    // The only other way for the engines to stop early.
+    if (Result == stop_reason::NONE)
+        Result = stop_reason::InvalidOpcode;
+
+    return Result;
+}
+
+void
+SetInputState(machine* M, u16 InputState)
+{
+    u16 Pressed = (u16)(InputState & ~M->InputState);
+    M->InputState = InputState;
+
+    if (M->RequiredInputRegisterIndexPlusOne && Pressed)
+    {
+        u8 KeyIndex = 0;
+        while (!IsBitSet(Pressed, (u16)KeyIndex))
+            ++KeyIndex;
+
+        M->V[M->RequiredInputRegisterIndexPlusOne - 1] = KeyIndex;
+        M->RequiredInputRegisterIndexPlusOne = 0;
+    }
+}
+
+void
+RunFrame(machine* M, u16 InputState, u32 InstructionsPerFrame)
+{
+    SetInputState(M, InputState);
+
+    u64 EndCycle = M->CurrentCycle + InstructionsPerFrame;
+    while (M->CurrentCycle < EndCycle)
+    {
+        stop_reason StopReason = RunCycles(M, EndCycle - M->CurrentCycle, stop_reason::NONE);
+        if ((StopReason & stop_reason::InvalidOpcode) != stop_reason::NONE)
+        {
+            // Restarting the program costs a cycle, so this ends even if 0x200 is invalid.
+            u64 NextTimerCycle = M->InstructionsPerSecond ? GetNextTimerCycle(M) : 0;
+            M->ProgramCounter = 0x200;
+            ++M->CurrentCycle;
+            if (M->CurrentCycle == NextTimerCycle)
+                CountDownTimers(M);
+        }
+        else if ((StopReason & stop_reason::WaitingForKey) != stop_reason::NONE && !M->InstructionsPerSecond)
+        {
+            // Without timers no time passes while waiting.
+            break;
+        }
+    }
+}
+
+void
+SetBreakpoint(machine* M, u16 Address, bool IsSet)
+{
+    Address &= 0xFFF;
+    u64* Bits = M->Breakpoints + Address / 64;
+    if (IsBitSet(*Bits, (u64)(Address % 64)) != IsSet)
+    {
+        *Bits = IsSet ? SetBit(*Bits, (u64)(Address % 64)) : UnsetBit(*Bits, (u64)(Address % 64));
+        M->NumBreakpoints += IsSet ? 1 : -1;
+    }
+}
+
+bool
+IsBreakpoint(machine* M, u16 Address)
+{
+    bool Result = Address < 4096 && IsBitSet(M->Breakpoints[Address / 64], (u64)(Address % 64));
+
+    return Result;
+}
+
+void
+ClearBreakpoints(machine* M)
+{
+    mtb::SliceSetZero(mtb::ArraySlice(M->Breakpoints));
+    M->NumBreakpoints = 0;
+}
+
 bool
 IsKeyDown(u16 InputState, u16 KeyIndex)
 {
@@ -1848,48 +4227,65 @@ int GetNumArguments(instruction Instruction)
 
 #if COUSCOUSC
 
-#define I0(Hint, InstructionType)                               { Hint, instruction_type::InstructionType, 0 }
-#define I1(Hint, InstructionType, ArgType0)                     { Hint, instruction_type::InstructionType, 1, { argument_type::ArgType0 } }
-#define I2(Hint, InstructionType, ArgType0, ArgType1)           { Hint, instruction_type::InstructionType, 2, { argument_type::ArgType0, argument_type::ArgType1 } }
-#define I3(Hint, InstructionType, ArgType0, ArgType1, ArgType2) { Hint, instruction_type::InstructionType, 3, { argument_type::ArgType0, argument_type::ArgType1, argument_type::ArgType2 } }
+// The hint is one of `COUSCOUS_OPCODE_FORMS`, so a typo doesn't compile.
+#define I0(Hint, InstructionType)                               { #Hint, OP_##Hint, instruction_type::InstructionType, 0 }
+#define I1(Hint, InstructionType, ArgType0)                     { #Hint, OP_##Hint, instruction_type::InstructionType, 1, { argument_type::ArgType0 } }
+#define I2(Hint, InstructionType, ArgType0, ArgType1)           { #Hint, OP_##Hint, instruction_type::InstructionType, 2, { argument_type::ArgType0, argument_type::ArgType1 } }
+#define I3(Hint, InstructionType, ArgType0, ArgType1, ArgType2) { #Hint, OP_##Hint, instruction_type::InstructionType, 3, { argument_type::ArgType0, argument_type::ArgType1, argument_type::ArgType2 } }
 
 static instruction_signature InstructionSignatures[] =
 {
-    I2("Fx1E", ADD, I, V),           // ADD I, Vx          - Fx1E
-    I2("7xkk", ADD, V, CONSTANT),    // ADD Vx, byte       - 7xkk
-    I2("8xy4", ADD, V, V),           // ADD Vx, Vy         - 8xy4
-    I2("8xy2", AND, V, V),           // AND Vx, Vy         - 8xy2
-    I1("2nnn", CALL, CONSTANT),      // CALL addr          - 2nnn
-    I0("00E0", CLS),                 // CLS                - 00E0
-    I3("Dxyn", DRW, V, V, CONSTANT), // DRW Vx, Vy, nibble - Dxyn
-    I1("1nnn", JP, CONSTANT),        // JP addr            - 1nnn
-    I2("Bnnn", JP, V, CONSTANT),     // JP V0, addr        - Bnnn
-    I2("Fx55", LD, ATI, V),          // LD [I], Vx         - Fx55
-    I2("Fx33", LD, B, V),            // LD B, Vx           - Fx33
-    I2("Fx15", LD, DT, V),           // LD DT, Vx          - Fx15
-    I2("Fx29", LD, F, V),            // LD F, Vx           - Fx29
-    I2("Annn", LD, I, CONSTANT),     // LD I, addr         - Annn
-    I2("Fx18", LD, ST, V),           // LD ST, Vx          - Fx18
-    I2("Fx65", LD, V, ATI),          // LD Vx, [I]         - Fx65
-    I2("6xkk", LD, V, CONSTANT),     // LD Vx, byte        - 6xkk
-    I2("Fx07", LD, V, DT),           // LD Vx, DT          - Fx07
-    I2("Fx0A", LD, V, K),            // LD Vx, K           - Fx0A
-    I2("8xy0", LD, V, V),            // LD Vx, Vy          - 8xy0
-    I2("8xy1", OR, V, V),            // OR Vx, Vy          - 8xy1
-    I0("00EE", RET),                 // RET                - 00EE
-    I2("Cxkk", RND, V, CONSTANT),    // RND Vx, byte       - Cxkk
-    I2("3xkk", SE, V, CONSTANT),     // SE Vx, byte        - 3xkk
-    I2("5xy0", SE, V, V),            // SE Vx, Vy          - 5xy0
-    I2("8xyE", SHL, V, V),           // SHL Vx {, Vy}      - 8xyE
-    I2("8xy6", SHR, V, V),           // SHR Vx {, Vy}      - 8xy6
-    I1("ExA1", SKNP, V),             // SKNP Vx            - ExA1
-    I1("Ex9E", SKP, V),              // SKP Vx             - Ex9E
-    I2("4xkk", SNE, V, CONSTANT),    // SNE Vx, byte       - 4xkk
-    I2("9xy0", SNE, V, V),           // SNE Vx, Vy         - 9xy0
-    I2("8xy5", SUB, V, V),           // SUB Vx, Vy         - 8xy5
-    I2("8xy7", SUBN, V, V),          // SUBN Vx, Vy        - 8xy7
-    I1("0nnn", SYS, CONSTANT),       // SYS addr           - 0nnn
-    I2("8xy3", XOR, V, V),           // XOR Vx, Vy         - 8xy3
+    I2(Fx1E, ADD, I, V),             // ADD I, Vx          - Fx1E
+    I2(7xkk, ADD, V, CONSTANT),      // ADD Vx, byte       - 7xkk
+    I2(8xy4, ADD, V, V),             // ADD Vx, Vy         - 8xy4
+    I2(8xy2, AND, V, V),             // AND Vx, Vy         - 8xy2
+    I0(F002, AUDIO),                 // AUDIO              - F002
+    I1(2nnn, CALL, CONSTANT),        // CALL addr          - 2nnn
+    I0(00E0, CLS),                   // CLS                - 00E0
+    I3(Dxyn, DRW, V, V, CONSTANT),   // DRW Vx, Vy, nibble - Dxyn
+    I0(00FD, EXIT),                  // EXIT               - 00FD
+    I0(00FF, HIGH),                  // HIGH               - 00FF
+    I1(1nnn, JP, CONSTANT),          // JP addr            - 1nnn
+    I2(Bnnn, JP, V, CONSTANT),       // JP V0, addr        - Bnnn
+    I2(Fx55, LD, ATI, V),            // LD [I], Vx         - Fx55
+    I3(5xy2, LD, ATI, V, V),         // LD [I], Vx, Vy     - 5xy2
+    I2(Fx33, LD, B, V),              // LD B, Vx           - Fx33
+    I2(Fx15, LD, DT, V),             // LD DT, Vx          - Fx15
+    I2(Fx29, LD, F, V),              // LD F, Vx           - Fx29
+    I2(Fx30, LD, HF, V),             // LD HF, Vx          - Fx30
+    I2(Annn, LD, I, CONSTANT),       // LD I, addr         - Annn
+    I2(F000, LD, I, LONG),           // LD I, LONG         - F000
+    I2(Fx3A, LD, PITCH, V),          // LD PITCH, Vx       - Fx3A
+    I2(Fx75, LD, R, V),              // LD R, Vx           - Fx75
+    I2(Fx18, LD, ST, V),             // LD ST, Vx          - Fx18
+    I2(Fx65, LD, V, ATI),            // LD Vx, [I]         - Fx65
+    I2(6xkk, LD, V, CONSTANT),       // LD Vx, byte        - 6xkk
+    I2(Fx07, LD, V, DT),             // LD Vx, DT          - Fx07
+    I2(Fx0A, LD, V, K),              // LD Vx, K           - Fx0A
+    I2(Fx85, LD, V, R),              // LD Vx, R           - Fx85
+    I2(8xy0, LD, V, V),              // LD Vx, Vy          - 8xy0
+    I3(5xy3, LD, V, V, ATI),         // LD Vx, Vy, [I]     - 5xy3
+    I0(00FE, LOW),                   // LOW                - 00FE
+    I2(8xy1, OR, V, V),              // OR Vx, Vy          - 8xy1
+    I1(Fn01, PLANE, CONSTANT),       // PLANE nibble       - Fn01
+    I0(00EE, RET),                   // RET                - 00EE
+    I2(Cxkk, RND, V, CONSTANT),      // RND Vx, byte       - Cxkk
+    I1(00Cn, SCD, CONSTANT),         // SCD nibble         - 00Cn
+    I0(00FC, SCL),                   // SCL                - 00FC
+    I0(00FB, SCR),                   // SCR                - 00FB
+    I1(00Dn, SCU, CONSTANT),         // SCU nibble         - 00Dn
+    I2(3xkk, SE, V, CONSTANT),       // SE Vx, byte        - 3xkk
+    I2(5xy0, SE, V, V),              // SE Vx, Vy          - 5xy0
+    I2(8xyE, SHL, V, V),             // SHL Vx {, Vy}      - 8xyE
+    I2(8xy6, SHR, V, V),             // SHR Vx {, Vy}      - 8xy6
+    I1(ExA1, SKNP, V),               // SKNP Vx            - ExA1
+    I1(Ex9E, SKP, V),                // SKP Vx             - Ex9E
+    I2(4xkk, SNE, V, CONSTANT),      // SNE Vx, byte       - 4xkk
+    I2(9xy0, SNE, V, V),             // SNE Vx, Vy         - 9xy0
+    I2(8xy5, SUB, V, V),             // SUB Vx, Vy         - 8xy5
+    I2(8xy7, SUBN, V, V),            // SUBN Vx, Vy        - 8xy7
+    I1(0nnn, SYS, CONSTANT),         // SYS addr           - 0nnn
+    I2(8xy3, XOR, V, V),             // XOR Vx, Vy         - 8xy3
 };
 
 #undef I0
@@ -6,11 +6,63 @@
 #endif
 #endif
 
+// Execution engine used by `Tick` and `RunCycles`. All engines must produce identical results.
+#define COUSCOUS_ENGINE_SWITCH   0 // `ExecuteSwitch`
+#define COUSCOUS_ENGINE_THREADED 1 // `ExecuteThreaded`
+#define COUSCOUS_ENGINE_BLOCKS   2 // `ExecuteBlocks`
+
+#if !defined(COUSCOUS_ENGINE)
+#define COUSCOUS_ENGINE COUSCOUS_ENGINE_SWITCH
+#endif
+
+// Whether `ExecuteJit` is available. It generates x86-64 code, see couscous_jit.cpp.
+#if !defined(COUSCOUS_JIT)
+#if defined(__x86_64__) || defined(_M_X64)
+#define COUSCOUS_JIT 1
+#else
+#define COUSCOUS_JIT 0
+#endif
+#endif
+
+// Whether `FindOrBuildBlock` fuses common pairs of instructions.
+#if !defined(COUSCOUS_FUSION)
+#define COUSCOUS_FUSION 1
+#endif
+
+// Whether executed fused ops are counted. See `PrintFusionStats`.
+#if !defined(COUSCOUS_FUSION_STATS)
+#define COUSCOUS_FUSION_STATS 0
+#endif
+
+// Whether `RunCycles` skips over loops that can't make progress, e.g. waiting for DT to reach 0.
+#if !defined(COUSCOUS_SKIP_IDLE_LOOPS)
+#define COUSCOUS_SKIP_IDLE_LOOPS 1
+#endif
+
+// Whether the compiler supports "labels as values", i.e. `goto *Ptr;`.
+#if !defined(COUSCOUS_COMPUTED_GOTO)
+#if defined(__GNUC__) || defined(__clang__)
+#define COUSCOUS_COMPUTED_GOTO 1
+#else
+#define COUSCOUS_COMPUTED_GOTO 0
+#endif
+#endif
+
 enum
 {
     CHAR_MEMORY_OFFSET = 0,
+    BIG_CHAR_MEMORY_OFFSET = 0x50, // SUPER-CHIP 8x10 digits, right after the 16 small ones.
     SCREEN_WIDTH = 64,
     SCREEN_HEIGHT = 32,
+    HIRES_SCREEN_WIDTH = 128, // SUPER-CHIP high resolution mode, see `HIGH`.
+    HIRES_SCREEN_HEIGHT = 64,
+    NUM_FLAG_REGISTERS = 8, // SUPER-CHIP RPL user flags, see `LD R, Vx`.
+    XOCHIP_MAX_PLANES = 4, // XO-CHIP bitplanes, see `PLANE`.
+    XOCHIP_MEMORY_SIZE = 0x10000,
+    AUDIO_PATTERN_SIZE = 16, // XO-CHIP 1-bit samples, see `AUDIO`.
+    TIMER_FREQUENCY = 60, // DT and ST count down this many times per second.
+    CACHE_LINE_SIZE = 64,
+    MEMORY_PAGE_SIZE = 64, // Granularity of machine::WrittenPages.
 };
 
 struct sprite
@@ -19,40 +71,6 @@ struct sprite
     u8* Pixels;
 };
 
-struct machine
-{
-    u8 V[16];
-
-    u16 I;
-
-    u8 DT;
-    u8 ST;
-
-    // RAM
-    union
-    {
-        u8 Memory[4096];
-
-        struct
-        {
-            u8 InterpreterMemory[0x200];
-            u8 ProgramMemory[4096 - 0x200];
-        };
-    };
-
-    u8 StackPointer;
-    u16 Stack[16];
-
-    u16 ProgramCounter;
-
-    u16 InputState;
-    u8 RequiredInputRegisterIndexPlusOne; // "PlusOne" so it can be 0 by default.
-
-    bool32 Screen[SCREEN_HEIGHT * SCREEN_WIDTH];
-
-    mtb::tRNG RNG;
-    u64 CurrentCycle;
-};
 
 
 //
@@ -72,6 +90,10 @@ enum struct argument_type
     F,
     B,
     ATI, // [I], "at I"
+    HF, // SUPER-CHIP big digit sprite
+    R, // SUPER-CHIP RPL user flags
+    LONG, // XO-CHIP 16 bit address in the word after the instruction
+    PITCH, // XO-CHIP audio pitch
 
     CONSTANT,
 };
@@ -128,6 +150,19 @@ enum struct instruction_type
     DRW,
     SKP,
     SKNP,
+
+    // SUPER-CHIP
+    SCD,
+    SCR,
+    SCL,
+    EXIT,
+    LOW,
+    HIGH,
+
+    // XO-CHIP
+    SCU,
+    PLANE,
+    AUDIO,
 };
 
 static char const*
@@ -143,6 +178,87 @@ struct instruction
     argument Args[3];
 };
 
+// Every concrete encoding of an instruction, named after its opcode pattern.
+#define COUSCOUS_OPCODE_FORMS(X) \
+    X(00E0) /* CLS */ \
+    X(00EE) /* RET */ \
+    X(00Cn) /* SCD nibble */ \
+    X(00Dn) /* SCU nibble */ \
+    X(00FB) /* SCR */ \
+    X(00FC) /* SCL */ \
+    X(00FD) /* EXIT */ \
+    X(00FE) /* LOW */ \
+    X(00FF) /* HIGH */ \
+    X(0nnn) /* SYS addr */ \
+    X(1nnn) /* JP addr */ \
+    X(2nnn) /* CALL addr */ \
+    X(3xkk) /* SE Vx, byte */ \
+    X(4xkk) /* SNE Vx, byte */ \
+    X(5xy0) /* SE Vx, Vy */ \
+    X(5xy2) /* LD [I], Vx, Vy */ \
+    X(5xy3) /* LD Vx, Vy, [I] */ \
+    X(6xkk) /* LD Vx, byte */ \
+    X(7xkk) /* ADD Vx, byte */ \
+    X(8xy0) /* LD Vx, Vy */ \
+    X(8xy1) /* OR Vx, Vy */ \
+    X(8xy2) /* AND Vx, Vy */ \
+    X(8xy3) /* XOR Vx, Vy */ \
+    X(8xy4) /* ADD Vx, Vy */ \
+    X(8xy5) /* SUB Vx, Vy */ \
+    X(8xy6) /* SHR Vx {, Vy} */ \
+    X(8xy7) /* SUBN Vx, Vy */ \
+    X(8xyE) /* SHL Vx {, Vy} */ \
+    X(9xy0) /* SNE Vx, Vy */ \
+    X(Annn) /* LD I, addr */ \
+    X(Bnnn) /* JP V0, addr */ \
+    X(Cxkk) /* RND Vx, byte */ \
+    X(Dxyn) /* DRW Vx, Vy, nibble. Dxy0 draws 16x16 in high resolution and with XO-CHIP. */ \
+    X(Ex9E) /* SKP Vx */ \
+    X(ExA1) /* SKNP Vx */ \
+    X(F000) /* LD I, LONG. Takes 4 bytes, the address is the second word. */ \
+    X(Fn01) /* PLANE nibble */ \
+    X(F002) /* AUDIO */ \
+    X(Fx07) /* LD Vx, DT */ \
+    X(Fx0A) /* LD Vx, K */ \
+    X(Fx15) /* LD DT, Vx */ \
+    X(Fx18) /* LD ST, Vx */ \
+    X(Fx1E) /* ADD I, Vx */ \
+    X(Fx29) /* LD F, Vx */ \
+    X(Fx30) /* LD HF, Vx */ \
+    X(Fx33) /* LD B, Vx */ \
+    X(Fx3A) /* LD PITCH, Vx */ \
+    X(Fx55) /* LD [I], Vx */ \
+    X(Fx65) /* LD Vx, [I] */ \
+    X(Fx75) /* LD R, Vx */ \
+    X(Fx85) /* LD Vx, R */
+
+// Pairs of instructions that `FindOrBuildBlock` fuses into a single op.
+#define COUSCOUS_FUSED_OPCODE_FORMS(X) \
+    X(3xkk_1nnn) /* SE Vx, byte; JP addr */ \
+    X(4xkk_1nnn) /* SNE Vx, byte; JP addr */ \
+    X(5xy0_1nnn) /* SE Vx, Vy; JP addr */ \
+    X(9xy0_1nnn) /* SNE Vx, Vy; JP addr */ \
+    X(6xkk_7xkk) /* LD Vx, byte; ADD Vx, byte */ \
+    X(6xkk_8xy4) /* LD Vx, byte; ADD Vx, Vy */ \
+    X(Annn_Dxyn) /* LD I, addr; DRW Vx, Vy, nibble */
+
+enum opcode_form
+{
+    OP_INVALID,
+
+#define COUSCOUS_OPCODE_FORM_ENUM(Suffix) OP_##Suffix,
+    COUSCOUS_OPCODE_FORMS(COUSCOUS_OPCODE_FORM_ENUM)
+
+    OP_COUNT, // Number of forms `GetOpcodeForm` can return.
+
+    OP_FUSED_BASE = OP_COUNT - 1,
+    COUSCOUS_FUSED_OPCODE_FORMS(COUSCOUS_OPCODE_FORM_ENUM)
+#undef COUSCOUS_OPCODE_FORM_ENUM
+
+    OP_COUNT_INCLUDING_FUSED,
+    NUM_FUSED_OPCODE_FORMS = OP_COUNT_INCLUDING_FUSED - OP_COUNT,
+};
+
 union instruction_decoder
 {
     u16 Data; // xxxx
@@ -170,12 +286,349 @@ union instruction_decoder
 
 static_assert(sizeof(instruction_decoder) == sizeof(u16), "Invalid size for `instruction`.");
 
+// Decoded instruction as used by the execution engines. `instruction` is only
+// used by the assembler and disassembler.
+union micro_op
+{
+    u32 Data; // 0 for instructions that have not been decoded yet.
+
+    struct
+    {
+        u32 Form : 8; // opcode_form
+        u32 X : 4;
+        u32 Y : 4;
+        u32 Imm : 16; // nnn, kk, or n, depending on Form. 0 otherwise.
+    };
+};
+
+static_assert(sizeof(micro_op) == sizeof(u32), "Invalid size for `micro_op`.");
+
+//
+// Basic block cache
+//
+
+enum
+{
+    MAX_CODE_BLOCKS = 1024,
+    MAX_CODE_BLOCK_OPS = 32,
+    CODE_BLOCK_OP_POOL_SIZE = 4096,
+};
+
+struct block_op
+{
+    micro_op Op; // Op.Form may also be one of the fused forms.
+    micro_op Fused; // The second instruction of fused ops.
+};
+
+// A straight-line run of instructions. It ends with the first instruction
+// that may leave the run (JP, CALL, RET, skips, `LD I, LONG`) or write to memory. A skip
+// directly followed by JP is fused and ends the block after the JP.
+struct code_block
+{
+    u16 StartAddress;
+    u16 NumInstructions;
+    u16 NumOps; // Less than NumInstructions if some of them were fused.
+    u16 FirstOp; // Index into block_cache::Ops
+    u32 Id; // Unique across all machines, even if a machine is copied. Never 0.
+};
+
+struct block_cache
+{
+    u16 BlockIndexPlusOne[4096]; // By start address. "PlusOne" so it can be 0 by default.
+    int NumBlocks;
+    int NumOps;
+    code_block Blocks[MAX_CODE_BLOCKS];
+    block_op Ops[CODE_BLOCK_OP_POOL_SIZE];
+
+    // Indexed by `opcode_form - OP_COUNT`. Not reset along with the cache.
+    u64 NumFusedOpsBuilt[NUM_FUSED_OPCODE_FORMS];
+#if COUSCOUS_FUSION_STATS
+    u64 NumFusedOpsExecuted[NUM_FUSED_OPCODE_FORMS];
+#endif
+};
+
+// Behaviors that differ between interpreters, some ROMs depend on one or the other.
+// NONE is what couscous always did.
+enum struct quirk_flags
+{
+    NONE,
+
+    ShiftReadsVx         = 0b001, // SHR/SHL shift Vx in place instead of storing the shifted Vy in Vx and Vy.
+    JumpOffsetFromVx     = 0b010, // `JP V0, addr` (Bxnn) jumps to xnn + Vx instead of nnn + V0.
+    LoadStoreIncrementsI = 0b100, // LD [I], Vx and LD Vx, [I] advance I past the copied bytes.
+
+    ALL = 0b111,
+};
+inline quirk_flags operator|(quirk_flags A, quirk_flags B) { return (quirk_flags)((u32)A | (u32)B); }
+inline quirk_flags operator&(quirk_flags A, quirk_flags B) { return (quirk_flags)((u32)A & (u32)B); }
+inline quirk_flags operator~(quirk_flags A) { return (quirk_flags)(~(u32)A); }
+
+// The engines are templates on their quirks, so there's no quirk branch in
+// any handler. This picks the instantiation for the quirks known at runtime.
+// `Function` may be prefixed, e.g. `return ExecuteThreadedWithQuirks`.
+#define COUSCOUS_SELECT_QUIRKS(Quirks, Function, ...)                                                 \
+    switch ((u32)((Quirks) & quirk_flags::ALL))                                                      \
+    {                                                                                                \
+        case 0b000:              Function<(quirk_flags)0b000>(__VA_ARGS__); break;                   \
+        case 0b001:              Function<(quirk_flags)0b001>(__VA_ARGS__); break;                   \
+        case 0b010:              Function<(quirk_flags)0b010>(__VA_ARGS__); break;                   \
+        case 0b011:              Function<(quirk_flags)0b011>(__VA_ARGS__); break;                   \
+        case 0b100:              Function<(quirk_flags)0b100>(__VA_ARGS__); break;                   \
+        case 0b101:              Function<(quirk_flags)0b101>(__VA_ARGS__); break;                   \
+        case 0b110:              Function<(quirk_flags)0b110>(__VA_ARGS__); break;                   \
+        default:                 Function<(quirk_flags)0b111>(__VA_ARGS__); break;                   \
+    }
+static_assert((u32)quirk_flags::ALL == 0b111, "COUSCOUS_SELECT_QUIRKS must cover all combinations.");
+
+struct machine;
+
+// Instantiations for one set of quirks, picked by `SetQuirks`.
+typedef void micro_op_handler(machine* M, micro_op Op);
+typedef u64 engine_handler(machine* M, u64 MaxInstructions);
+
+template<quirk_flags Quirks>
+static void
+ExecuteMicroOpWithQuirks(machine* M, micro_op Op);
+
+// The engine selected by COUSCOUS_ENGINE.
+template<quirk_flags Quirks>
+static u64
+ExecuteEngineWithQuirks(machine* M, u64 MaxInstructions);
+
+// Everything XO-CHIP adds that plain CHIP-8 ROMs don't need. Only allocated
+// by the host for XO-CHIP ROMs, see `EnableXOChip`.
+struct xochip_state
+{
+    // Bitplanes 1 and up, laid out like machine::HighResScreen, which is plane 0.
+    // Every plane has its own rows, so drawing to one plane doesn't touch the
+    // cache lines of the others.
+    alignas(CACHE_LINE_SIZE) u64 Planes[XOCHIP_MAX_PLANES - 1][HIRES_SCREEN_HEIGHT][2];
+
+    // Addresses 0x1000 and up, the first 4 KB are still machine::Memory.
+    u8 ExtendedMemory[XOCHIP_MEMORY_SIZE - 4096];
+};
+
+// The registers every instruction touches come first and fill exactly one
+// cache line. The bulk data follows, each part starting on its own cache line.
+// See the static_asserts below before moving anything around.
+struct machine
+{
+    //
+    // Hot registers
+    //
+    alignas(CACHE_LINE_SIZE) u8 V[16];
+
+    u16 I;
+    u16 ProgramCounter;
+
+    u8 StackPointer;
+
+    u8 DT;
+    u8 ST;
+
+    u8 RequiredInputRegisterIndexPlusOne; // "PlusOne" so it can be 0 by default.
+    u16 InputState;
+
+    // One bit per plane that DRW, CLS, and the scrolls apply to, see `PLANE`.
+    // Only plane 0 exists without XOChip.
+    u8 SelectedPlanes;
+
+    bool IsHighResolution;
+
+    // Set by the host when loading a ROM.
+    quirk_flags Quirks;
+
+    u64 CurrentCycle;
+
+    // Null unless the ROM is an XO-CHIP ROM. Memory beyond 4 KB and the planes
+    // beyond the first exist only then, and so do the 4 byte skips over
+    // `LD I, LONG`. The XO-CHIP instructions below decode either way.
+    xochip_state* XOChip;
+
+    // Emulated speed used by `RunCycles` to count down DT and ST at TIMER_FREQUENCY.
+    // 0 leaves the timers to the host.
+    u32 InstructionsPerSecond;
+
+    // Incremented whenever CLS, DRW, a scroll, or a mode switch change any
+    // pixel. Hosts can skip converting and presenting the screen as long as
+    // it stays the same.
+    u32 DisplayGeneration;
+
+    // One bit per row of the current mode that changed since the last call to `TakeDirtyRows`.
+    u64 DirtyRows;
+
+    //
+    // Cold data
+    //
+
+    // RAM
+    union
+    {
+        u8 Memory[4096];
+
+        struct
+        {
+            u8 InterpreterMemory[0x200];
+            u8 ProgramMemory[4096 - 0x200];
+        };
+    };
+
+    // One row per u64, the leftmost pixel is the most significant bit. In
+    // high resolution each row is two u64, the left half first. See `IsPixelSet`.
+    union
+    {
+        u64 Screen[SCREEN_HEIGHT];
+        u64 HighResScreen[HIRES_SCREEN_HEIGHT][2];
+    };
+
+    // One bit per MEMORY_PAGE_SIZE bytes of Memory that were stored to since
+    // the last call to `TakeWrittenPages`. Everything that goes through
+    // `WriteMemory` sets them. Memory beyond 4 KB isn't tracked.
+    u64 WrittenPages;
+
+    u16 Stack[16];
+
+    mtb::tRNG RNG;
+
+    // SUPER-CHIP RPL user flags. Persist across ROMs on the HP48, here they're just part of the machine.
+    u8 FlagRegisters[NUM_FLAG_REGISTERS];
+
+    // Played while ST is not 0, see `AUDIO` and `LD PITCH, Vx`.
+    u8 AudioPitch;
+    u8 AudioPattern[AUDIO_PATTERN_SIZE];
+
+    //
+    // Caches and debugging, not part of the emulated state
+    //
+
+    // Already decoded instructions, indexed by `ProgramCounter / 2`. Entries
+    // that are 0 have not been decoded yet. Instructions that write to Memory
+    // reset the entries they touch.
+    alignas(CACHE_LINE_SIZE) micro_op DecodeCache[4096 / 2];
+
+    // Used by `ExecuteBlocks` only. Invalidated along with DecodeCache.
+    block_cache BlockCache;
+
+    // Addresses `RunCycles` stops at, one bit each.
+    u64 Breakpoints[4096 / 64];
+    int NumBreakpoints;
+
+    // Resolved from Quirks by `SetQuirks`, so nothing picks them per instruction.
+    micro_op_handler* MicroOpHandler = ExecuteMicroOpWithQuirks<quirk_flags::NONE>;
+    engine_handler* EngineHandler = ExecuteEngineWithQuirks<quirk_flags::NONE>;
+};
+
+static_assert(sizeof(machine::DecodeCache) == 8 * 1024, "The decoded program should fit in 8 KB.");
+static_assert(SCREEN_WIDTH == 64 && HIRES_SCREEN_WIDTH == 128, "Screen rows are stored as one or two u64.");
+static_assert(HIRES_SCREEN_HEIGHT <= 64, "Dirty rows are stored as u64.");
+static_assert(sizeof(machine::Memory) / MEMORY_PAGE_SIZE == 64, "Written pages are stored as u64.");
+static_assert(alignof(machine) == CACHE_LINE_SIZE, "Machines start on a cache line, also in arrays of them.");
+static_assert(offsetof(machine, DirtyRows) + sizeof(machine::DirtyRows) == CACHE_LINE_SIZE, "The hot registers fill exactly the first cache line.");
+static_assert(offsetof(machine, Memory) == CACHE_LINE_SIZE, "Memory starts right after the hot registers.");
+static_assert(offsetof(machine, Screen) % CACHE_LINE_SIZE == 0, "The screen starts on its own cache line.");
+static_assert(sizeof(xochip_state::Planes[0]) == sizeof(machine::HighResScreen), "All planes share the layout of plane 0.");
+static_assert((XOCHIP_MEMORY_SIZE & (XOCHIP_MEMORY_SIZE - 1)) == 0, "Addresses wrap around by masking.");
+
+// Enables XO-CHIP for the machine, see machine::XOChip. The state must stay
+// around as long as the machine uses it. Selects plane 0 and sets the default pitch.
+static void
+EnableXOChip(machine* M, xochip_state* XOChip);
+
+// Size of the address space, 64 KB with XO-CHIP and 4 KB otherwise. Addresses wrap around at the end.
+static u32
+GetMemorySize(machine const* M);
+
+// Copy from and to emulated memory, wrapping around at the end of it. Writes
+// invalidate the decode cache as needed.
+static void
+ReadMemory(machine* M, u32 Address, u32 NumBytes, u8* Dest);
+
+static void
+WriteMemory(machine* M, u32 Address, u32 NumBytes, u8 const* Source);
+
+// Returns a pointer to NumBytes of emulated memory at Address. If they aren't
+// contiguous in the machine, they're copied to Scratch first, which must hold NumBytes.
+static u8 const*
+GetMemoryBytes(machine* M, u32 Address, u32 NumBytes, u8* Scratch);
+
+
 static u16
 GetDigitSpriteAddress(machine* M, u8 Digit);
 
+static u16
+GetBigDigitSpriteAddress(machine* M, u8 Digit);
+
+// Plane 0 is machine::Screen, the others only exist with XO-CHIP. Each one is
+// HIRES_SCREEN_HEIGHT * 2 u64, laid out like machine::Screen in low and like
+// machine::HighResScreen in high resolution.
+static u64*
+GetPlane(machine* M, int PlaneIndex);
+
+// One bit per plane that drawing, clearing, and scrolling apply to.
+static u32
+GetSelectedPlanes(machine const* M);
+
+// Draws 8 pixel wide rows to plane 0 in the current resolution.
 static void
 DrawSprite(machine* M, int X, int Y, sprite Sprite);
 
+// Draws a 16x16 sprite of 32 bytes, two per row, to plane 0 in the current resolution.
+static void
+DrawLargeSprite(machine* M, int X, int Y, u8 const* Pixels);
+
+// `DRW` with the sprite at I. With XO-CHIP, every selected plane gets its own
+// sprite, one after the other in memory.
+static void
+DrawSpriteFromMemory(machine* M, int X, int Y, int Height);
+
+// Clears the selected planes.
+static void
+ClearScreen(machine* M);
+
+// Scroll the selected planes by a number of pixels of the current resolution. Pixels scrolled in are off.
+static void
+ScrollDown(machine* M, int NumRows);
+
+static void
+ScrollUp(machine* M, int NumRows);
+
+static void
+ScrollRight(machine* M, int NumPixels);
+
+static void
+ScrollLeft(machine* M, int NumPixels);
+
+// Switches between 64x32 and 128x64. Clears all planes if the resolution changes.
+static void
+SetHighResolution(machine* M, bool IsHighResolution);
+
+static int
+GetScreenWidth(machine const* M);
+
+static int
+GetScreenHeight(machine const* M);
+
+// Low resolution only.
+static bool
+IsPixelSet(u64 const* Screen, int X, int Y);
+
+// Plane 0 in the current resolution.
+static bool
+IsPixelSet(machine const* M, int X, int Y);
+
+// One bit per plane that has the pixel set, plane 0 is the least significant
+// one. Hosts map these to colors.
+static u32
+GetPixelColorIndex(machine const* M, int X, int Y);
+
+// Returns machine::DirtyRows and resets them.
+static u64
+TakeDirtyRows(machine* M);
+
+// Returns machine::WrittenPages and resets them.
+static u64
+TakeWrittenPages(machine* M);
+
 // TODO(Manuzor): Stuff like this could be put to the platform layer.
 static u8
 ReadByte(void* Ptr);
@@ -204,6 +657,8 @@ inline constexpr bool IsBitSet( u8 Bits,  u8 Position) { return !!(Bits & ( u8(1
 inline constexpr bool IsBitSet(u16 Bits, u16 Position) { return !!(Bits & (u16(1) << Position)); }
 inline constexpr bool IsBitSet(u32 Bits, u32 Position) { return !!(Bits & (u32(1) << Position)); }
 inline constexpr bool IsBitSet(u64 Bits, u64 Position) { return !!(Bits & (u64(1) << Position)); }
+
+inline constexpr u64 RotateRight(u64 Bits, u32 Amount) { return (Bits >> (Amount & 63)) | (Bits << ((64 - Amount) & 63)); }
 // clang-format on
 
 struct tick_result
@@ -217,12 +672,166 @@ Tick(machine* M);
 static instruction
 DecodeInstruction(instruction_decoder Decoder);
 
+static micro_op
+DecodeMicroOp(instruction_decoder Decoder);
+
+// Like `DecodeMicroOp` but goes through machine::DecodeCache. Addresses past
+// the end of machine::Memory decode to OP_INVALID.
+static micro_op
+FetchMicroOp(machine* M, u16 Address);
+
+// Must be called whenever memory that might contain code is written to from outside of `ExecuteInstruction`.
+static void
+InvalidateDecodeCache(machine* M, u16 Address, u16 NumBytes);
+
+static void
+InvalidateDecodeCache(machine* M);
+
 static u16
 EncodeInstruction(instruction Instruction);
 
+// Reference implementation working on `instruction`. None of the engines use
+// it, but the tests check them against it.
 static void
 ExecuteInstruction(machine* M, instruction Instruction);
 
+static opcode_form
+GetOpcodeForm(u16 Opcode);
+
+// Sets machine::Quirks and the handlers that implement them. Hosts call this
+// when loading a ROM, everything else that changes the quirks must as well.
+// Machines that were zeroed instead of initialized with `machine{}` need it
+// before they can run.
+static void
+SetQuirks(machine* M, quirk_flags Quirks);
+
+// Executes a single instruction with machine::MicroOpHandler. The ProgramCounter must already point to the next instruction.
+static void
+ExecuteMicroOp(machine* M, micro_op Op);
+
+// What the skip instructions do when they skip. Moves the ProgramCounter past
+// the next instruction, which is 4 bytes long if it is `LD I, LONG` with XO-CHIP.
+static void
+SkipInstruction(machine* M);
+
+// Executes up to MaxInstructions one `ExecuteMicroOp` at a time. Stops just like `ExecuteThreaded`.
+static u64
+ExecuteSwitch(machine* M, u64 MaxInstructions);
+
+// Executes up to MaxInstructions starting at the current ProgramCounter with one handler per `opcode_form`.
+// Stops early at an invalid instruction, leaving the ProgramCounter pointing at it, and right after
+// `LD Vx, K` so the key can be provided first. Executes nothing until then, which all engines agree on.
+// Returns the number of executed instructions.
+static u64
+ExecuteThreaded(machine* M, u64 MaxInstructions);
+
+// Same as `ExecuteThreaded` but runs whole cached basic blocks at a time.
+static u64
+ExecuteBlocks(machine* M, u64 MaxInstructions);
+
+static code_block*
+FindOrBuildBlock(machine* M, u16 Address);
+
+static void
+PrintFusionStats(FILE* OutFile, block_cache* Cache);
+
+#if COUSCOUS_JIT
+
+enum
+{
+    JIT_CODE_SIZE = 1024 * 1024,
+    JIT_DEFAULT_HOT_THRESHOLD = 16,
+};
+
+struct jit_block
+{
+    u32 BlockId; // The `code_block::Id` this entry belongs to.
+    u32 NativeOffsetPlusOne; // Into jit_cache::Code. "PlusOne" so it can be 0 by default.
+    u32 HitCount;
+};
+
+// Native code for the blocks of a `block_cache`, by block index. Blocks are
+// compiled once they ran HotThreshold times. Entries are only used if the
+// block id still matches, so invalidating a block in the machine invalidates
+// its native code as well.
+struct jit_cache
+{
+    u8* Code; // Executable memory of JIT_CODE_SIZE bytes.
+    u32 CodeUsed;
+    u32 ExitOffset; // Into Code, see couscous_jit.cpp.
+    u32 EnterOffset;
+    u32 DispatchOffset;
+    u32 HotThreshold;
+    quirk_flags Quirks; // The native code was generated for these, see machine::Quirks.
+    bool IsXOChip; // Skips are generated differently, see machine::XOChip.
+
+    jit_block Blocks[MAX_CODE_BLOCKS];
+};
+
+static bool
+InitJit(jit_cache* Jit);
+
+static void
+Deallocate(jit_cache* Jit);
+
+// Same as `ExecuteBlocks` but runs hot blocks as native code.
+static u64
+ExecuteJit(machine* M, jit_cache* Jit, u64 MaxInstructions);
+
+#endif
+
+enum struct stop_reason
+{
+    NONE,
+
+    CycleBudget     = 0b00001, // MaxCycles instructions were executed.
+    WaitingForKey   = 0b00010, // `LD Vx, K` needs machine::InputState to change first.
+    ScreenChanged   = 0b00100, // CLS or DRW changed a pixel, see machine::DisplayGeneration.
+    Breakpoint      = 0b01000, // The ProgramCounter is at one of machine::Breakpoints.
+    InvalidOpcode   = 0b10000, // The ProgramCounter points at an invalid instruction.
+
+    ALL = 0b11111,
+};
+inline stop_reason operator|(stop_reason A, stop_reason B) { return (stop_reason)((u32)A | (u32)B); }
+inline stop_reason operator&(stop_reason A, stop_reason B) { return (stop_reason)((u32)A & (u32)B); }
+inline stop_reason operator~(stop_reason A) { return (stop_reason)(~(u32)A); }
+
+// Executes up to MaxCycles instructions with the engine selected by COUSCOUS_ENGINE and advances
+// machine::CurrentCycle accordingly. Running out of cycles, waiting for a key, and invalid
+// instructions always stop execution, StopMask adds ScreenChanged and Breakpoint. The breakpoint
+// at the initial ProgramCounter is ignored so execution can resume from it. Idle loops are not
+// interpreted, their remaining iterations are only counted, see COUSCOUS_SKIP_IDLE_LOOPS.
+// If machine::InstructionsPerSecond is set, DT and ST count down whenever CurrentCycle crosses
+// a timer tick, and cycles spent waiting for a key pass without executing anything.
+// Returns all reasons that applied when execution stopped.
+static stop_reason
+RunCycles(machine* M, u64 MaxCycles, stop_reason StopMask);
+
+// The first cycle after machine::CurrentCycle at which DT and ST count down.
+// Requires machine::InstructionsPerSecond.
+static u64
+GetNextTimerCycle(machine* M);
+
+// Sets machine::InputState. A key that is pressed now but wasn't before
+// resolves a pending `LD Vx, K`, the lowest one if there are several.
+static void
+SetInputState(machine* M, u16 InputState);
+
+// Runs one frame of InstructionsPerFrame cycles with the given input, the way
+// movies record and play them back. Running into an invalid instruction
+// restarts the program at 0x200, which costs a cycle.
+static void
+RunFrame(machine* M, u16 InputState, u32 InstructionsPerFrame);
+
+static void
+SetBreakpoint(machine* M, u16 Address, bool IsSet);
+
+static bool
+IsBreakpoint(machine* M, u16 Address);
+
+static void
+ClearBreakpoints(machine* M);
+
 static bool
 IsKeyDown(u16 InputState, u16 KeyIndex);
 
@@ -230,6 +839,410 @@ static u16
 SetKeyDown(u16 InputState, u16 KeyIndex, bool32 IsDown);
 
 
+//
+// Snapshots, see couscous_snapshot.cpp.
+//
+
+enum
+{
+    // Everything after the hot registers up to the caches is captured in pages,
+    // followed by the pages of the xochip_state if there is one.
+    SNAPSHOT_PAGE_SIZE = MEMORY_PAGE_SIZE,
+    SNAPSHOT_NUM_MACHINE_PAGES = (offsetof(machine, DecodeCache) - CACHE_LINE_SIZE) / SNAPSHOT_PAGE_SIZE,
+    SNAPSHOT_NUM_XOCHIP_PAGES = sizeof(xochip_state) / SNAPSHOT_PAGE_SIZE,
+    SNAPSHOT_NUM_PAGES = SNAPSHOT_NUM_MACHINE_PAGES + SNAPSHOT_NUM_XOCHIP_PAGES,
+    SNAPSHOT_PAGES_PER_TABLE = SNAPSHOT_PAGE_SIZE / sizeof(u16),
+    SNAPSHOT_NUM_TABLES = (SNAPSHOT_NUM_PAGES + SNAPSHOT_PAGES_PER_TABLE - 1) / SNAPSHOT_PAGES_PER_TABLE,
+    SNAPSHOT_POOL_SIZE = 16 * 1024, // In pages, 1 MB.
+};
+
+// The state of a machine at some point, without its caches and breakpoints.
+// The pages are shared with other snapshots of the same pool as long as they
+// don't change, so a snapshot usually only costs a few new pages.
+struct machine_snapshot
+{
+    // The hot registers at the start of machine, copied as they are.
+    u8 Registers[CACHE_LINE_SIZE];
+
+    // Into snapshot_pool::Pages. Each table is a page of SNAPSHOT_PAGES_PER_TABLE
+    // more page indices. 0 if none of its pages exist.
+    u16 TableIndexPlusOne[SNAPSHOT_NUM_TABLES];
+};
+
+// Reference counted pages for the snapshots of one machine.
+struct snapshot_pool
+{
+    alignas(CACHE_LINE_SIZE) u8 Pages[SNAPSHOT_POOL_SIZE][SNAPSHOT_PAGE_SIZE];
+    u32 RefCounts[SNAPSHOT_POOL_SIZE];
+
+    u16 FreePages[SNAPSHOT_POOL_SIZE];
+    u32 NumFreePages;
+
+    // The snapshot last taken or restored, kept alive by the pool itself. Pages
+    // of machine::Memory that aren't in machine::WrittenPages are taken from it
+    // without comparing them.
+    machine_snapshot Latest;
+};
+
+static_assert(SNAPSHOT_POOL_SIZE < 0xFFFF, "Page indices are stored as u16.");
+static_assert(SNAPSHOT_NUM_MACHINE_PAGES * SNAPSHOT_PAGE_SIZE + CACHE_LINE_SIZE == offsetof(machine, DecodeCache), "Snapshot pages cover the machine without gaps.");
+static_assert(sizeof(xochip_state) % SNAPSHOT_PAGE_SIZE == 0, "Snapshot pages cover the XO-CHIP state without gaps.");
+
+static void
+InitSnapshotPool(snapshot_pool* Pool);
+
+// Captures the state of M. Takes machine::WrittenPages, so nothing else may
+// take them while snapshots are being taken. Returns false if the pool is
+// full, leaving M as it was.
+static bool
+SnapshotMachine(snapshot_pool* Pool, machine* M, machine_snapshot* Snapshot);
+
+// Puts M back into the state of Snapshot. M keeps its own xochip_state, if
+// any, and only the decoded instructions of pages that differ are invalidated.
+static void
+RestoreMachine(snapshot_pool* Pool, machine* M, machine_snapshot const* Snapshot);
+
+// Returns the pages that are only used by Snapshot to the pool.
+static void
+ReleaseSnapshot(snapshot_pool* Pool, machine_snapshot* Snapshot);
+
+//
+// Rewind
+//
+
+enum
+{
+    // The emulated state of a machine, the same bytes snapshots capture, and its xochip_state.
+    REWIND_MAX_STATE_SIZE = offsetof(machine, DecodeCache) + sizeof(xochip_state),
+
+    // Encoded frames never get larger than this, see couscous_snapshot.cpp.
+    REWIND_MAX_FRAME_SIZE = REWIND_MAX_STATE_SIZE / 2 * 3 + 16,
+
+    REWIND_MAX_FRAMES = 4096, // A bit more than a minute at 60 frames per second.
+    REWIND_DEFAULT_KEYFRAME_INTERVAL = 60,
+};
+
+struct rewind_frame
+{
+    u32 Offset; // Into rewind_buffer::Data.
+    u32 Size;
+    bool IsKeyframe;
+};
+
+// The last frames of a machine in a ring buffer. Every frame is stored as the
+// difference to the previous one, except for a keyframe every
+// KeyframeInterval frames, so restoring a frame decodes at most that many.
+// Frames are dropped oldest first when Data or Frames are full.
+struct rewind_buffer
+{
+    u8* Data;
+    u32 DataSize;
+    u32 DataUsed; // Where the next frame goes, unless it has to wrap around.
+
+    rewind_frame Frames[REWIND_MAX_FRAMES];
+    u32 FirstFrame; // Index into Frames of the oldest frame.
+    u32 NumFrames;
+
+    u32 KeyframeInterval;
+    u32 FramesSinceKeyframe;
+
+    // The state of the newest frame, which the next one is encoded against.
+    u32 StateSize;
+    u8 State[REWIND_MAX_STATE_SIZE];
+
+    u8 Scratch[REWIND_MAX_STATE_SIZE];
+    u8 Encoded[REWIND_MAX_FRAME_SIZE];
+};
+
+// Data must stay around as long as the rewind buffer is used.
+static void
+InitRewindBuffer(rewind_buffer* Rewind, u8* Data, u32 DataSize, u32 KeyframeInterval);
+
+// Adds the current state of M as the newest frame. Returns false if it
+// doesn't fit into the buffer at all.
+static bool
+RecordRewindFrame(rewind_buffer* Rewind, machine* M);
+
+// Puts M back into the state of the frame FramesBack frames before the newest
+// one, which is 0. The frames stay as they are, so this can go back and forth.
+static bool
+RestoreRewindFrame(rewind_buffer* Rewind, machine* M, u32 FramesBack);
+
+// Drops the NumFrames newest frames, so recording continues from an older one.
+static void
+DiscardRewindFrames(rewind_buffer* Rewind, u32 NumFrames);
+
+
+//
+// Movies, see couscous_movie.cpp.
+//
+
+enum
+{
+    MOVIE_MAGIC = 0x564F4D43, // "CMOV"
+    MOVIE_VERSION = 1,
+    MOVIE_HEADER_SIZE = 48,
+    MOVIE_XOCHIP = 0b1, // movie_header::Flags
+};
+
+// Everything besides the input that a movie needs to play back the same way
+// it was recorded. Stored little-endian at the start of a movie.
+struct movie_header
+{
+    u64 RomHash; // See `HashBytes`.
+    u64 Seed; // Of machine::RNG.
+    quirk_flags Quirks;
+    u32 InstructionsPerFrame;
+    u32 InstructionsPerSecond;
+    u32 Flags;
+    u32 NumFrames;
+    u32 InputSize; // Bytes of input following the header.
+};
+
+// The input of every frame of a machine. Runs of frames with the same input
+// are stored as the change to the previous input and the number of frames.
+struct movie
+{
+    movie_header Header;
+
+    // The whole movie including the header, owned by the host.
+    u8* Data;
+    u32 DataSize;
+    u32 Cursor; // Where the next run is written or read.
+
+    // The run being recorded or played back and the input of the one before.
+    u16 RunInputState;
+    u32 RunLength; // Frames recorded so far, or left to play back.
+    u16 PreviousInputState;
+    u32 RunCursor; // Where the run is written or was read from.
+    u32 RunFrame; // Frames of the run recorded or played back so far.
+
+    u32 Frame; // Number of frames recorded or played back.
+};
+
+// 64-bit FNV-1a, for ROM hashes and comparing machine states.
+static u64
+HashBytes(void const* Bytes, size_t NumBytes, u64 Hash = 0xCBF29CE484222325);
+
+// The emulated state of M, which is the same for the same ROM and input no
+// matter which engine ran it, or where the xochip_state is.
+static u64
+HashMachineState(machine const* M);
+
+// Seeds machine::RNG with Seed and starts recording M, taking the quirks
+// and the speed from M. Data must stay around until the recording ends.
+static void
+BeginMovieRecording(movie* Movie, u8* Data, u32 DataSize, machine* M, u64 RomHash, u64 Seed, u32 InstructionsPerFrame);
+
+// Runs a frame with `RunFrame` and records its input. Returns false without
+// running the frame if there is no more room in the movie.
+static bool
+RecordMovieFrame(movie* Movie, machine* M, u16 InputState);
+
+// Writes the header. Returns the size of the movie.
+static u32
+EndMovieRecording(movie* Movie);
+
+// Returns false if Data isn't a movie this version can play back.
+static bool
+BeginMoviePlayback(movie* Movie, u8* Data, u32 DataSize);
+
+// Puts the settings of the movie header into M. The host must have loaded the
+// ROM, the fonts and, with MOVIE_XOCHIP, enabled XO-CHIP like it did for the recording.
+static void
+StartMovieMachine(movie const* Movie, machine* M);
+
+// Runs the next frame with its recorded input. Returns false at the end of the movie.
+static bool
+PlayMovieFrame(movie* Movie, machine* M);
+
+// Plays back all remaining frames as fast as possible. Returns the number of frames.
+static u32
+PlayMovie(movie* Movie, machine* M);
+
+enum
+{
+    MOVIE_INDEX_MAGIC = 0x58494D43, // "CMIX"
+    MOVIE_INDEX_VERSION = 1,
+    MOVIE_INDEX_HEADER_SIZE = 24,
+    MOVIE_KEYFRAME_HEADER_SIZE = 20,
+    MOVIE_MAX_KEYFRAMES = 8192,
+
+    // 10 seconds at 60 frames per second. Longer intervals make the index
+    // smaller but seeking slower.
+    MOVIE_DEFAULT_KEYFRAME_INTERVAL = 600,
+};
+
+// Full machine states every KeyframeInterval frames of a movie, so seeking
+// never plays back more than KeyframeInterval frames.
+struct movie_index
+{
+    // The whole index including the header, owned by the host.
+    u8* Data;
+    u32 DataSize;
+    u32 DataUsed;
+
+    u32 KeyframeInterval;
+    u32 NumKeyframes;
+    u32 KeyframeOffsets[MOVIE_MAX_KEYFRAMES]; // Into Data.
+
+    u8 State[REWIND_MAX_STATE_SIZE];
+    u8 Encoded[REWIND_MAX_FRAME_SIZE];
+};
+
+// Starts an empty index. Data must stay around as long as the index is used.
+static void
+BeginMovieIndex(movie_index* Index, u8* Data, u32 DataSize, u32 KeyframeInterval);
+
+// Call before every `RecordMovieFrame` or `PlayMovieFrame`, and once after the
+// last one. Adds a keyframe whenever one is due. Returns false if there is no
+// more room in the index.
+static bool
+UpdateMovieIndex(movie_index* Index, movie const* Movie, machine const* M);
+
+// Writes the header, which ties the index to the finished Movie. Returns the size of the index.
+static u32
+EndMovieIndex(movie_index* Index, movie const* Movie);
+
+// Returns false if Data isn't an index of Movie this version can use.
+static bool
+LoadMovieIndex(movie_index* Index, u8* Data, u32 DataSize, movie const* Movie);
+
+// Puts M and the playback of Movie at the start of Frame by restoring the
+// keyframe before it and playing back the frames in between. Fails without
+// touching M if the keyframe is corrupt or was taken of a machine with or
+// without XO-CHIP unlike M.
+static bool
+SeekMovie(movie* Movie, movie_index* Index, machine* M, u32 Frame);
+
+
+//
+// Save states, see couscous_savestate.cpp.
+//
+
+enum
+{
+    SAVE_STATE_MAGIC = 0x54535343, // "CSST"
+    SAVE_STATE_VERSION = 1,
+    SAVE_STATE_HEADER_SIZE = 16,
+    SAVE_STATE_SECTION_ENTRY_SIZE = 16,
+    SAVE_STATE_SECTION_ALIGNMENT = CACHE_LINE_SIZE,
+    SAVE_STATE_XOCHIP = 0b1, // Header flags.
+
+    // Upper bound of `GetSaveStateSize`.
+    SAVE_STATE_MAX_SIZE = XOCHIP_MEMORY_SIZE + 8 * 1024,
+};
+
+// Sections in the order they are stored.
+enum save_state_section
+{
+    SAVE_STATE_REGISTERS = 1,
+    SAVE_STATE_QUIRKS,
+    SAVE_STATE_MEMORY,
+    SAVE_STATE_SCREEN,
+    SAVE_STATE_STACK,
+    SAVE_STATE_RNG,
+
+    SAVE_STATE_NUM_SECTIONS = SAVE_STATE_RNG,
+};
+
+// Size of the save state of M, see `WriteSaveState`.
+static u32
+GetSaveStateSize(machine const* M);
+
+// Writes the emulated state of M to Bytes. Returns the number of bytes
+// written, or 0 if they don't fit.
+static u32
+WriteSaveState(machine const* M, u8* Bytes, u32 NumBytes);
+
+// Puts the state saved in Bytes into M, which is meant to be a mapped file.
+// XO-CHIP must be enabled for M exactly when it was for the saved machine.
+// Returns false and leaves M alone if Bytes isn't a save state this version can load.
+static bool
+LoadSaveState(machine* M, u8 const* Bytes, size_t NumBytes);
+
+
+//
+// Reverse execution, see couscous_history.cpp.
+//
+
+enum
+{
+    HISTORY_MAX_SNAPSHOTS = 64,
+    HISTORY_MAX_EVENTS = 4096,
+    HISTORY_DEFAULT_SNAPSHOT_INTERVAL = 10'000, // In cycles, about 12 seconds at 825 instructions per second.
+};
+
+// Changes to a machine that don't come from running it.
+enum struct history_event_type : u16
+{
+    Input, // `SetInputState`
+    Jump, // machine::ProgramCounter, e.g. to restart the program.
+};
+
+struct history_event
+{
+    u64 Cycle;
+    history_event_type Type;
+    u16 Value;
+};
+
+struct history_snapshot
+{
+    machine_snapshot Snapshot;
+    u64 Cycle;
+    u32 EventIndex; // The first event after the snapshot was taken.
+};
+
+// Snapshots of a machine every SnapshotInterval cycles and everything the
+// host did to it in between, so any cycle since the oldest snapshot can be
+// reached again by restoring a snapshot and running the machine from there.
+struct history
+{
+    snapshot_pool Pool;
+
+    history_snapshot Snapshots[HISTORY_MAX_SNAPSHOTS];
+    u32 FirstSnapshot; // Index into Snapshots of the oldest one.
+    u32 NumSnapshots;
+
+    // Indexed by the number of events ever added, modulo HISTORY_MAX_EVENTS.
+    history_event Events[HISTORY_MAX_EVENTS];
+    u32 FirstEvent;
+    u32 NumEvents;
+
+    u64 SnapshotInterval;
+};
+
+// Forgets everything. Use it again whenever M changes in other ways than the
+// ones below, like loading a save state.
+static void
+InitHistory(history* History, u64 SnapshotInterval);
+
+// `SetInputState`, `RunCycles`, and setting machine::ProgramCounter, but
+// recorded. Nothing else may take machine::WrittenPages while recording.
+static void
+SetInputStateWithHistory(history* History, machine* M, u16 InputState);
+
+static void
+SetProgramCounterWithHistory(history* History, machine* M, u16 Address);
+
+static stop_reason
+RunCyclesWithHistory(history* History, machine* M, u64 MaxCycles, stop_reason StopMask);
+
+// Goes back NumCycles cycles, or to the oldest snapshot, and forgets
+// everything after. Runs at most SnapshotInterval cycles. Returns the number
+// of cycles it went back.
+static u64
+StepBack(history* History, machine* M, u64 NumCycles);
+
+// Goes back to the last cycle at which machine::ProgramCounter was at one of
+// the breakpoints and forgets everything after. Returns false and stops at
+// the oldest snapshot if there is none. Runs at most SnapshotInterval cycles
+// for every snapshot, twice for the one with the breakpoint.
+static bool
+ReverseContinue(history* History, machine* M);
+
+
 #if COUSCOUSC
 
 #define COUSCOUS_DISPOSE_LATER(Disposable) MTB_DEFER{ Deallocate(&Disposable); }
@@ -240,6 +1253,7 @@ GetNumArguments(instruction Instruction);
 struct instruction_signature
 {
     char const* Hint;
+    opcode_form Form;
     instruction_type Type;
     int NumParams;
     argument_type Params[3];
@@ -0,0 +1,262 @@
+//
+// Reverse execution.
+//
+// Machines are deterministic, so going back to a cycle is restoring the last
+// snapshot before it and running to it again, applying the recorded events on
+// the way. Snapshots are taken every SnapshotInterval cycles, which bounds how
+// far any replay has to run. The oldest snapshots and their events are dropped
+// when either ring or the snapshot_pool is full.
+//
+
+static history_snapshot*
+GetHistorySnapshot(history* History, u32 Index)
+{
+    MTB_ASSERT(Index < History->NumSnapshots);
+    return &History->Snapshots[(History->FirstSnapshot + Index) % HISTORY_MAX_SNAPSHOTS];
+}
+
+static history_event*
+GetHistoryEvent(history* History, u32 EventIndex)
+{
+    MTB_ASSERT(EventIndex - History->FirstEvent < History->NumEvents);
+    return &History->Events[EventIndex % HISTORY_MAX_EVENTS];
+}
+
+static void
+DropOldestHistorySnapshot(history* History)
+{
+    MTB_ASSERT(History->NumSnapshots > 0);
+    ReleaseSnapshot(&History->Pool, &GetHistorySnapshot(History, 0)->Snapshot);
+    History->FirstSnapshot = (History->FirstSnapshot + 1) % HISTORY_MAX_SNAPSHOTS;
+    --History->NumSnapshots;
+
+    // Events before the oldest snapshot can't be replayed anymore.
+    u32 EndEvent = History->FirstEvent + History->NumEvents;
+    u32 FirstEvent = History->NumSnapshots ? GetHistorySnapshot(History, 0)->EventIndex : EndEvent;
+    History->NumEvents -= FirstEvent - History->FirstEvent;
+    History->FirstEvent = FirstEvent;
+}
+
+static void
+TakeHistorySnapshot(history* History, machine* M)
+{
+    if (History->NumSnapshots == HISTORY_MAX_SNAPSHOTS)
+        DropOldestHistorySnapshot(History);
+
+    history_snapshot Snapshot;
+    while (!SnapshotMachine(&History->Pool, M, &Snapshot.Snapshot))
+    {
+        // Dropping the last snapshot still leaves the pool's latest one,
+        // whose pages stay shared with the next. A single machine always fits
+        // into an empty pool.
+        MTB_ASSERT(History->NumSnapshots > 0);
+        DropOldestHistorySnapshot(History);
+    }
+    Snapshot.Cycle = M->CurrentCycle;
+    Snapshot.EventIndex = History->FirstEvent + History->NumEvents;
+
+    u32 Index = (History->FirstSnapshot + History->NumSnapshots) % HISTORY_MAX_SNAPSHOTS;
+    History->Snapshots[Index] = Snapshot;
+    ++History->NumSnapshots;
+}
+
+static void
+AddHistoryEvent(history* History, machine* M, history_event_type Type, u16 Value)
+{
+    // Without a snapshot there is nothing to replay it from.
+    if (History->NumSnapshots == 0)
+        return;
+
+    while (History->NumEvents == HISTORY_MAX_EVENTS && History->NumSnapshots > 1)
+        DropOldestHistorySnapshot(History);
+
+    if (History->NumEvents == HISTORY_MAX_EVENTS)
+    {
+        // All events belong to the only snapshot left, start over from here.
+        DropOldestHistorySnapshot(History);
+        TakeHistorySnapshot(History, M);
+    }
+
+    history_event* Event = &History->Events[(History->FirstEvent + History->NumEvents) % HISTORY_MAX_EVENTS];
+    Event->Cycle = M->CurrentCycle;
+    Event->Type = Type;
+    Event->Value = Value;
+    ++History->NumEvents;
+}
+
+static void
+ApplyHistoryEvent(machine* M, history_event const* Event)
+{
+    switch (Event->Type)
+    {
+        case history_event_type::Input: SetInputState(M, Event->Value); break;
+        case history_event_type::Jump: M->ProgramCounter = Event->Value; break;
+    }
+}
+
+// Forgets the snapshots after SnapshotIndex and the events after M's current cycle.
+static void
+TruncateHistory(history* History, machine* M, u32 SnapshotIndex)
+{
+    while (History->NumSnapshots > SnapshotIndex + 1)
+    {
+        ReleaseSnapshot(&History->Pool, &GetHistorySnapshot(History, History->NumSnapshots - 1)->Snapshot);
+        --History->NumSnapshots;
+    }
+
+    while (History->NumEvents && GetHistoryEvent(History, History->FirstEvent + History->NumEvents - 1)->Cycle > M->CurrentCycle)
+        --History->NumEvents;
+}
+
+// Restores the snapshot at SnapshotIndex and runs M until TargetCycle. Returns
+// the last cycle before TargetCycle at which M was at a breakpoint, or ~0ull if
+// there was none or FindBreakpoints is false.
+static u64
+ReplayHistory(history* History, machine* M, u32 SnapshotIndex, u64 TargetCycle, bool FindBreakpoints)
+{
+    history_snapshot* Snapshot = GetHistorySnapshot(History, SnapshotIndex);
+    RestoreMachine(&History->Pool, M, &Snapshot->Snapshot);
+    MTB_ASSERT(M->CurrentCycle == Snapshot->Cycle);
+
+    u64 Result = ~0ull;
+    u32 EventIndex = Snapshot->EventIndex;
+    u32 EndEvent = History->FirstEvent + History->NumEvents;
+    while (true)
+    {
+        if (FindBreakpoints && M->CurrentCycle < TargetCycle && IsBreakpoint(M, M->ProgramCounter))
+            Result = M->CurrentCycle;
+
+        while (EventIndex != EndEvent && GetHistoryEvent(History, EventIndex)->Cycle <= M->CurrentCycle)
+            ApplyHistoryEvent(M, GetHistoryEvent(History, EventIndex++));
+
+        if (M->CurrentCycle >= TargetCycle)
+            break;
+
+        u64 EndCycle = TargetCycle;
+        if (EventIndex != EndEvent && GetHistoryEvent(History, EventIndex)->Cycle < EndCycle)
+            EndCycle = GetHistoryEvent(History, EventIndex)->Cycle;
+
+        u64 StartCycle = M->CurrentCycle;
+        stop_reason StopMask = FindBreakpoints ? stop_reason::Breakpoint : stop_reason::NONE;
+        stop_reason StopReason = RunCycles(M, EndCycle - StartCycle, StopMask);
+
+        // Only happens while waiting for a key without timers, or at an
+        // invalid instruction, for which the host never recorded what it did
+        // about it.
+        if (M->CurrentCycle == StartCycle && (StopReason & stop_reason::Breakpoint) == stop_reason::NONE)
+            break;
+    }
+
+    return Result;
+}
+
+void
+InitHistory(history* History, u64 SnapshotInterval)
+{
+    InitSnapshotPool(&History->Pool);
+    History->FirstSnapshot = 0;
+    History->NumSnapshots = 0;
+    History->FirstEvent = 0;
+    History->NumEvents = 0;
+    History->SnapshotInterval = SnapshotInterval ? SnapshotInterval : 1;
+}
+
+void
+SetInputStateWithHistory(history* History, machine* M, u16 InputState)
+{
+    if (InputState != M->InputState)
+        AddHistoryEvent(History, M, history_event_type::Input, InputState);
+
+    SetInputState(M, InputState);
+}
+
+void
+SetProgramCounterWithHistory(history* History, machine* M, u16 Address)
+{
+    AddHistoryEvent(History, M, history_event_type::Jump, Address);
+    M->ProgramCounter = Address;
+}
+
+stop_reason
+RunCyclesWithHistory(history* History, machine* M, u64 MaxCycles, stop_reason StopMask)
+{
+    u64 EndCycle = M->CurrentCycle + MaxCycles;
+    stop_reason Result;
+    bool IsFirst = true;
+    while (true)
+    {
+        if (History->NumSnapshots == 0 ||
+            M->CurrentCycle >= GetHistorySnapshot(History, History->NumSnapshots - 1)->Cycle + History->SnapshotInterval)
+        {
+            TakeHistorySnapshot(History, M);
+        }
+
+        // Splitting the budget must not skip a breakpoint `RunCycles` would have stopped at.
+        if (!IsFirst && (StopMask & stop_reason::Breakpoint) != stop_reason::NONE && IsBreakpoint(M, M->ProgramCounter))
+        {
+            Result = stop_reason::Breakpoint;
+            break;
+        }
+        IsFirst = false;
+
+        u64 SnapshotCycle = GetHistorySnapshot(History, History->NumSnapshots - 1)->Cycle + History->SnapshotInterval;
+        u64 NumCycles = (EndCycle < SnapshotCycle ? EndCycle : SnapshotCycle) - M->CurrentCycle;
+        Result = RunCycles(M, NumCycles, StopMask);
+        if (Result != stop_reason::CycleBudget || M->CurrentCycle == EndCycle)
+            break;
+    }
+
+    // Only the last part may have run out of cycles.
+    if (M->CurrentCycle != EndCycle)
+        Result = Result & ~stop_reason::CycleBudget;
+
+    return Result;
+}
+
+u64
+StepBack(history* History, machine* M, u64 NumCycles)
+{
+    if (History->NumSnapshots == 0)
+        return 0;
+
+    u64 CurrentCycle = M->CurrentCycle;
+    u64 OldestCycle = GetHistorySnapshot(History, 0)->Cycle;
+    u64 TargetCycle = CurrentCycle - OldestCycle > NumCycles ? CurrentCycle - NumCycles : OldestCycle;
+
+    u32 SnapshotIndex = History->NumSnapshots - 1;
+    while (GetHistorySnapshot(History, SnapshotIndex)->Cycle > TargetCycle)
+        --SnapshotIndex;
+
+    ReplayHistory(History, M, SnapshotIndex, TargetCycle, false);
+    TruncateHistory(History, M, SnapshotIndex);
+
+    return CurrentCycle - M->CurrentCycle;
+}
+
+bool
+ReverseContinue(history* History, machine* M)
+{
+    if (History->NumSnapshots == 0)
+        return false;
+
+    // Each replay restores the snapshot it starts from, so the search
+    // ends wherever the last one did and M has to be put back onto the
+    // hit, or the oldest snapshot, afterwards.
+    u64 EndCycle = M->CurrentCycle;
+    u32 SnapshotIndex = History->NumSnapshots;
+    u64 HitCycle = ~0ull;
+    while (SnapshotIndex > 0 && HitCycle == ~0ull)
+    {
+        --SnapshotIndex;
+        u64 StartCycle = GetHistorySnapshot(History, SnapshotIndex)->Cycle;
+        if (StartCycle < EndCycle)
+            HitCycle = ReplayHistory(History, M, SnapshotIndex, EndCycle, true);
+        EndCycle = StartCycle;
+    }
+
+    u64 TargetCycle = HitCycle != ~0ull ? HitCycle : GetHistorySnapshot(History, 0)->Cycle;
+    ReplayHistory(History, M, SnapshotIndex, TargetCycle, false);
+    TruncateHistory(History, M, SnapshotIndex);
+
+    return HitCycle != ~0ull;
+}
@@ -0,0 +1,700 @@
+//
+// x86-64 JIT for `code_block`s.
+//
+// The machine pointer is pinned in rbx and the registers are accessed
+// relative to it. There are not enough host registers to keep all of V[] in
+// them and most blocks only touch a few of them anyway. The ProgramCounter
+// of every op is known at compile time, so it is only written when leaving a
+// block or before calling back into C++.
+//
+// Blocks don't return to C++ when they are done. They jump to a shared
+// dispatcher which looks up the next block in the machine's block cache and
+// jumps to its native code if there is any. Only if there is none, or the
+// budget doesn't allow for the whole block, do we return to `ExecuteJit`.
+//
+// Register usage while running native code:
+//   rbx: machine*
+//   r12: Remaining instruction budget
+//   r13: Number of executed instructions, returned in rax.
+//   r14: jit_cache::Blocks
+//   r15: jit_cache::Code
+//
+
+#if COUSCOUS_JIT
+
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// Returns the number of executed instructions.
+using jit_enter_function = u64(machine* M, u64 MaxInstructions, jit_block* Blocks, u8* Code);
+
+enum
+{
+    // Upper bound of the native code for a single block.
+    JIT_MAX_BLOCK_CODE_SIZE = 64 + 48 * MAX_CODE_BLOCK_OPS,
+
+    // Upper bound of the code generated by `JitEmitStubs`.
+    JIT_MAX_STUB_CODE_SIZE = 256,
+};
+
+enum jit_register : u8
+{
+    JIT_EAX = 0,
+    JIT_ECX = 1,
+    JIT_EDX = 2,
+};
+
+struct jit_emitter
+{
+    u8* At;
+    u8* End;
+    quirk_flags Quirks;
+    bool IsXOChip;
+};
+
+#define JIT_OFFSET(Member) (u32)offsetof(machine, Member)
+
+// Ops that are not generated inline call these with the machine and the micro op.
+#define COUSCOUS_JIT_THUNK(Suffix)                     \
+    template<quirk_flags Quirks>                       \
+    static void                                        \
+    JitCall_##Suffix(machine* M, u32 Data)             \
+    {                                                  \
+        micro_op Op;                                   \
+        Op.Data = Data;                                \
+        ExecuteOp_##Suffix<Quirks>(M, Op);             \
+    }
+COUSCOUS_OPCODE_FORMS(COUSCOUS_JIT_THUNK)
+#undef COUSCOUS_JIT_THUNK
+
+using jit_call_function = void(machine* M, u32 Data);
+
+template<quirk_flags Quirks>
+static jit_call_function*
+GetJitCall(opcode_form Form)
+{
+#define COUSCOUS_JIT_THUNK_ADDRESS(Suffix) &JitCall_##Suffix<Quirks>,
+    static jit_call_function* const JitCallTable[] = { nullptr, COUSCOUS_OPCODE_FORMS(COUSCOUS_JIT_THUNK_ADDRESS) };
+    static_assert(MTB_ARRAY_COUNT(JitCallTable) == OP_COUNT, "Missing thunks.");
+#undef COUSCOUS_JIT_THUNK_ADDRESS
+
+    return JitCallTable[Form];
+}
+
+static void
+JitEmit8(jit_emitter* E, u8 Value)
+{
+    MTB_ASSERT(E->At < E->End);
+    *E->At++ = Value;
+}
+
+static void
+JitEmit16(jit_emitter* E, u16 Value)
+{
+    JitEmit8(E, (u8)(Value >> 0));
+    JitEmit8(E, (u8)(Value >> 8));
+}
+
+static void
+JitEmit32(jit_emitter* E, u32 Value)
+{
+    JitEmit16(E, (u16)(Value >> 0));
+    JitEmit16(E, (u16)(Value >> 16));
+}
+
+static void
+JitEmit64(jit_emitter* E, u64 Value)
+{
+    JitEmit32(E, (u32)(Value >> 0));
+    JitEmit32(E, (u32)(Value >> 32));
+}
+
+static void
+JitEmitBytes(jit_emitter* E, int NumBytes, u8 const* Bytes)
+{
+    for (int Index = 0; Index < NumBytes; ++Index)
+        JitEmit8(E, Bytes[Index]);
+}
+
+#define JIT_EMIT(E, ...)                                   \
+    do                                                     \
+    {                                                      \
+        u8 const JitBytes[]{ __VA_ARGS__ };                \
+        JitEmitBytes(E, MTB_ARRAY_COUNT(JitBytes), JitBytes); \
+    } while (false)
+
+// ModRM for the memory operand [rbx + Offset].
+static void
+JitEmitMachineOperand(jit_emitter* E, u8 Reg, u32 Offset)
+{
+    JitEmit8(E, (u8)(0x80 | (Reg << 3) | 3));
+    JitEmit32(E, Offset);
+}
+
+// movzx Reg, byte [rbx + Offset]
+static void
+JitEmitLoadByte(jit_emitter* E, jit_register Reg, u32 Offset)
+{
+    JIT_EMIT(E, 0x0F, 0xB6);
+    JitEmitMachineOperand(E, Reg, Offset);
+}
+
+// mov byte [rbx + Offset], Reg
+static void
+JitEmitStoreByte(jit_emitter* E, jit_register Reg, u32 Offset)
+{
+    JitEmit8(E, 0x88);
+    JitEmitMachineOperand(E, Reg, Offset);
+}
+
+// <Opcode> Reg, byte [rbx + Offset], e.g. `add`, `sub`, `cmp`.
+static void
+JitEmitByteOp(jit_emitter* E, u8 Opcode, jit_register Reg, u32 Offset)
+{
+    JitEmit8(E, Opcode);
+    JitEmitMachineOperand(E, Reg, Offset);
+}
+
+// mov word [rbx + Offset], Value
+static void
+JitEmitStoreWordImmediate(jit_emitter* E, u32 Offset, u16 Value)
+{
+    JIT_EMIT(E, 0x66, 0xC7);
+    JitEmitMachineOperand(E, 0, Offset);
+    JitEmit16(E, Value);
+}
+
+static void
+JitEmitSetProgramCounter(jit_emitter* E, u16 Address)
+{
+    JitEmitStoreWordImmediate(E, JIT_OFFSET(ProgramCounter), Address);
+}
+
+// ProgramCounter = NextAddress + 2 * eax, where eax is either 0 or 1. See `SkipInstruction`.
+static void
+JitEmitSkipIfEax(jit_emitter* E, u16 NextAddress)
+{
+    // The skipped instruction is outside of the block, so it may change
+    // without invalidating this code and has to be checked here.
+    if (E->IsXOChip && NextAddress < sizeof(machine::Memory) - 1)
+    {
+        JIT_EMIT(E, 0x66, 0x81); // cmp word [Memory + NextAddress], F0 00
+        JitEmitMachineOperand(E, 7, JIT_OFFSET(Memory) + NextAddress);
+        JitEmit16(E, 0x00F0);
+        JIT_EMIT(E, 0x75, 0x02); // jne +2
+        JIT_EMIT(E, 0x01, 0xC0); // add eax, eax
+    }
+
+    JIT_EMIT(E, 0x8D, 0x04, 0x45); // lea eax, [rax * 2 + NextAddress]
+    JitEmit32(E, NextAddress);
+    JIT_EMIT(E, 0x66, 0x89); // mov word [ProgramCounter], ax
+    JitEmitMachineOperand(E, JIT_EAX, JIT_OFFSET(ProgramCounter));
+}
+
+static void
+JitEmitCall(jit_emitter* E, micro_op Op)
+{
+#if defined(_WIN32)
+    JIT_EMIT(E, 0x48, 0x89, 0xD9); // mov rcx, rbx
+    JitEmit8(E, 0xBA);             // mov edx, Op
+#else
+    JIT_EMIT(E, 0x48, 0x89, 0xDF); // mov rdi, rbx
+    JitEmit8(E, 0xBE);             // mov esi, Op
+#endif
+    JitEmit32(E, Op.Data);
+
+    jit_call_function* Function = nullptr;
+    COUSCOUS_SELECT_QUIRKS(E->Quirks, Function = GetJitCall, (opcode_form)Op.Form);
+
+    JIT_EMIT(E, 0x48, 0xB8); // mov rax, JitCall_XXX
+    JitEmit64(E, (u64)(uintptr_t)Function);
+    JIT_EMIT(E, 0xFF, 0xD0); // call rax
+}
+
+static void
+JitEmitOp(jit_emitter* E, micro_op Op, u16 NextAddress)
+{
+    opcode_form const Form = (opcode_form)Op.Form;
+    u32 const VX = JIT_OFFSET(V) + Op.X;
+    u32 const VY = JIT_OFFSET(V) + Op.Y;
+    u32 const VF = JIT_OFFSET(V) + 0xF;
+
+    switch (Form)
+    {
+        case OP_1nnn:
+        {
+            JitEmitSetProgramCounter(E, Op.Imm);
+        } break;
+
+        case OP_3xkk:
+        case OP_4xkk:
+        {
+            JIT_EMIT(E, 0x31, 0xC0); // xor eax, eax
+            JitEmit8(E, 0x80);       // cmp byte [Vx], kk
+            JitEmitMachineOperand(E, 7, VX);
+            JitEmit8(E, (u8)Op.Imm);
+            JIT_EMIT(E, 0x0F, Form == OP_3xkk ? (u8)0x94 : (u8)0x95, 0xC0); // sete/setne al
+            JitEmitSkipIfEax(E, NextAddress);
+        } break;
+
+        case OP_5xy0:
+        case OP_9xy0:
+        {
+            JitEmitLoadByte(E, JIT_ECX, VX);
+            JIT_EMIT(E, 0x31, 0xC0);                 // xor eax, eax
+            JitEmitByteOp(E, 0x3A, JIT_ECX, VY);     // cmp cl, [Vy]
+            JIT_EMIT(E, 0x0F, Form == OP_5xy0 ? (u8)0x94 : (u8)0x95, 0xC0); // sete/setne al
+            JitEmitSkipIfEax(E, NextAddress);
+        } break;
+
+        case OP_6xkk:
+        {
+            JitEmit8(E, 0xC6); // mov byte [Vx], kk
+            JitEmitMachineOperand(E, 0, VX);
+            JitEmit8(E, (u8)Op.Imm);
+        } break;
+
+        case OP_7xkk:
+        {
+            JitEmit8(E, 0x80); // add byte [Vx], kk
+            JitEmitMachineOperand(E, 0, VX);
+            JitEmit8(E, (u8)Op.Imm);
+        } break;
+
+        case OP_8xy0:
+        case OP_8xy1:
+        case OP_8xy2:
+        case OP_8xy3:
+        {
+            u8 const Opcodes[]{ 0x88 /* mov */, 0x08 /* or */, 0x20 /* and */, 0x30 /* xor */ };
+            JitEmitLoadByte(E, JIT_EAX, VY);
+            JitEmitByteOp(E, Opcodes[Form - OP_8xy0], JIT_EAX, VX); // <op> [Vx], al
+        } break;
+
+        case OP_8xy4:
+        {
+            JitEmitLoadByte(E, JIT_EAX, VX);
+            JitEmitByteOp(E, 0x02, JIT_EAX, VY); // add al, [Vy]
+            JIT_EMIT(E, 0x0F, 0x92, 0xC1);       // setc cl
+            JitEmitStoreByte(E, JIT_ECX, VF);
+            JitEmitStoreByte(E, JIT_EAX, VX);
+        } break;
+
+        // VF is written before the result is computed, just like
+        // `ExecuteInstruction` does. This matters if x or y is F.
+        case OP_8xy5:
+        case OP_8xy7:
+        {
+            u32 const Minuend = Form == OP_8xy5 ? VX : VY;
+            u32 const Subtrahend = Form == OP_8xy5 ? VY : VX;
+            JitEmitLoadByte(E, JIT_EAX, Minuend);
+            JitEmitByteOp(E, 0x3A, JIT_EAX, Subtrahend); // cmp al, [Subtrahend]
+            JIT_EMIT(E, 0x0F, 0x97, 0xC1);               // seta cl
+            JitEmitStoreByte(E, JIT_ECX, VF);
+            JitEmitLoadByte(E, JIT_EAX, Minuend);
+            JitEmitByteOp(E, 0x2A, JIT_EAX, Subtrahend); // sub al, [Subtrahend]
+            JitEmitStoreByte(E, JIT_EAX, VX);
+        } break;
+
+        case OP_8xy6:
+        case OP_8xyE:
+        {
+            u32 const Source = (E->Quirks & quirk_flags::ShiftReadsVx) != quirk_flags::NONE ? VX : VY;
+            JitEmitLoadByte(E, JIT_EAX, Source);
+            JIT_EMIT(E, 0x24, 0x01); // and al, 1
+            JitEmitStoreByte(E, JIT_EAX, VF);
+            JitEmitLoadByte(E, JIT_EAX, Source);
+            JIT_EMIT(E, 0xD0, Form == OP_8xy6 ? (u8)0xE8 : (u8)0xE0); // shr/shl al, 1
+            JitEmitStoreByte(E, JIT_EAX, Source);
+            JitEmitStoreByte(E, JIT_EAX, VX);
+        } break;
+
+        case OP_Annn:
+        {
+            JitEmitStoreWordImmediate(E, JIT_OFFSET(I), Op.Imm);
+        } break;
+
+        case OP_Ex9E:
+        case OP_ExA1:
+        {
+            JIT_EMIT(E, 0x0F, 0xB7); // movzx eax, word [InputState]
+            JitEmitMachineOperand(E, JIT_EAX, JIT_OFFSET(InputState));
+            JIT_EMIT(E, 0xC1, 0xE8, (u8)Op.X); // shr eax, x
+            JIT_EMIT(E, 0x83, 0xE0, 0x01);          // and eax, 1
+            if (Form == OP_ExA1)
+                JIT_EMIT(E, 0x83, 0xF0, 0x01);      // xor eax, 1
+            JitEmitSkipIfEax(E, NextAddress);
+        } break;
+
+        case OP_Fx07:
+        {
+            JitEmitLoadByte(E, JIT_EAX, JIT_OFFSET(DT));
+            JitEmitStoreByte(E, JIT_EAX, VX);
+        } break;
+
+        case OP_Fx15:
+        case OP_Fx18:
+        {
+            JitEmitLoadByte(E, JIT_EAX, VX);
+            JitEmitStoreByte(E, JIT_EAX, Form == OP_Fx15 ? JIT_OFFSET(DT) : JIT_OFFSET(ST));
+        } break;
+
+        case OP_Fx1E:
+        {
+            JitEmitLoadByte(E, JIT_EAX, VX);
+            JIT_EMIT(E, 0x66, 0x01); // add word [I], ax
+            JitEmitMachineOperand(E, JIT_EAX, JIT_OFFSET(I));
+        } break;
+
+        default:
+        {
+            // Everything else calls back into C++, e.g. DRW, RND, and LD Vx, K.
+            JitEmitSetProgramCounter(E, NextAddress);
+            JitEmitCall(E, Op);
+        } break;
+    }
+}
+
+// Whether the op sets the ProgramCounter itself when it is generated by `JitEmitOp`.
+static bool
+JitSetsProgramCounter(opcode_form Form)
+{
+    bool Result = true;
+    switch (Form)
+    {
+        case OP_6xkk: case OP_7xkk:
+        case OP_8xy0: case OP_8xy1: case OP_8xy2: case OP_8xy3:
+        case OP_8xy4: case OP_8xy5: case OP_8xy6: case OP_8xy7: case OP_8xyE:
+        case OP_Annn:
+        case OP_Fx07: case OP_Fx15: case OP_Fx18: case OP_Fx1E:
+            Result = false;
+            break;
+
+        default:
+            break;
+    }
+
+    return Result;
+}
+
+static void
+JitSetExecutable(jit_cache* Jit, bool Executable)
+{
+#if defined(_WIN32)
+    DWORD OldProtection;
+    VirtualProtect(Jit->Code, JIT_CODE_SIZE, Executable ? PAGE_EXECUTE_READ : PAGE_READWRITE, &OldProtection);
+    if (Executable)
+        FlushInstructionCache(GetCurrentProcess(), Jit->Code, JIT_CODE_SIZE);
+#else
+    mprotect(Jit->Code, JIT_CODE_SIZE, Executable ? (PROT_READ | PROT_EXEC) : (PROT_READ | PROT_WRITE));
+#endif
+}
+
+// jcc/jmp rel32 to Target. Condition is the second opcode byte of jcc, e.g. 0x84 for `je`, or 0 for `jmp`.
+static void
+JitEmitJump(jit_emitter* E, u8 Condition, u8 const* Target)
+{
+    if (Condition)
+        JIT_EMIT(E, 0x0F, Condition);
+    else
+        JitEmit8(E, 0xE9);
+    JitEmit32(E, (u32)(Target - (E->At + 4)));
+}
+
+// Emits the code that enters, dispatches between, and leaves native blocks.
+static void
+JitEmitStubs(jit_cache* Jit)
+{
+    u8* Begin = Jit->Code + Jit->CodeUsed;
+    jit_emitter Emitter{ Begin, Begin + JIT_MAX_STUB_CODE_SIZE };
+    jit_emitter* E = &Emitter;
+
+    u32 const SizeOfCodeBlock = sizeof(code_block);
+    u32 const SizeOfJitBlock = sizeof(jit_block);
+    static_assert(sizeof(code_block) < 128 && sizeof(jit_block) < 128, "Sizes must fit into imul imm8.");
+
+    // Exit
+    Jit->ExitOffset = (u32)(E->At - Jit->Code);
+    u8* Exit = E->At;
+    JIT_EMIT(E, 0x4C, 0x89, 0xE8);       // mov rax, r13
+    JIT_EMIT(E, 0x48, 0x83, 0xC4, 0x20); // add rsp, 32
+    JIT_EMIT(E, 0x41, 0x5F);             // pop r15
+    JIT_EMIT(E, 0x41, 0x5E);             // pop r14
+    JIT_EMIT(E, 0x41, 0x5D);             // pop r13
+    JIT_EMIT(E, 0x41, 0x5C);             // pop r12
+    JIT_EMIT(E, 0x5B);                   // pop rbx
+    JIT_EMIT(E, 0xC3);                   // ret
+
+    // Enter. Five pushes plus the return address keep the stack 16-byte
+    // aligned, the 32 bytes on top are the shadow space required on Windows.
+    Jit->EnterOffset = (u32)(E->At - Jit->Code);
+    JIT_EMIT(E, 0x53);                   // push rbx
+    JIT_EMIT(E, 0x41, 0x54);             // push r12
+    JIT_EMIT(E, 0x41, 0x55);             // push r13
+    JIT_EMIT(E, 0x41, 0x56);             // push r14
+    JIT_EMIT(E, 0x41, 0x57);             // push r15
+    JIT_EMIT(E, 0x48, 0x83, 0xEC, 0x20); // sub rsp, 32
+#if defined(_WIN32)
+    JIT_EMIT(E, 0x48, 0x89, 0xCB); // mov rbx, rcx
+    JIT_EMIT(E, 0x49, 0x89, 0xD4); // mov r12, rdx
+    JIT_EMIT(E, 0x4D, 0x89, 0xC6); // mov r14, r8
+    JIT_EMIT(E, 0x4D, 0x89, 0xCF); // mov r15, r9
+#else
+    JIT_EMIT(E, 0x48, 0x89, 0xFB); // mov rbx, rdi
+    JIT_EMIT(E, 0x49, 0x89, 0xF4); // mov r12, rsi
+    JIT_EMIT(E, 0x49, 0x89, 0xD6); // mov r14, rdx
+    JIT_EMIT(E, 0x49, 0x89, 0xCF); // mov r15, rcx
+#endif
+    JIT_EMIT(E, 0x45, 0x31, 0xED); // xor r13d, r13d
+
+    // Dispatch. This mirrors the checks in `ExecuteJit`.
+    Jit->DispatchOffset = (u32)(E->At - Jit->Code);
+    JIT_EMIT(E, 0x0F, 0xB7); // movzx eax, word [ProgramCounter]
+    JitEmitMachineOperand(E, JIT_EAX, JIT_OFFSET(ProgramCounter));
+    JIT_EMIT(E, 0x3D, 0xFF, 0x0F, 0x00, 0x00); // cmp eax, 0xFFF
+    JitEmitJump(E, 0x87, Exit);                // ja Exit
+
+    JIT_EMIT(E, 0x0F, 0xB7, 0x84, 0x43); // movzx eax, word [rbx + rax * 2 + BlockIndexPlusOne]
+    JitEmit32(E, JIT_OFFSET(BlockCache.BlockIndexPlusOne));
+    JIT_EMIT(E, 0x85, 0xC0);    // test eax, eax
+    JitEmitJump(E, 0x84, Exit); // jz Exit
+
+    // The index is still "PlusOne", which the displacements below account for.
+    JIT_EMIT(E, 0x6B, 0xC8, (u8)SizeOfCodeBlock); // imul ecx, eax, sizeof(code_block)
+    JIT_EMIT(E, 0x0F, 0xB7, 0x94, 0x0B);          // movzx edx, word [rbx + rcx + code_block::NumInstructions]
+    JitEmit32(E, JIT_OFFSET(BlockCache.Blocks) - SizeOfCodeBlock + (u32)offsetof(code_block, NumInstructions));
+    JIT_EMIT(E, 0x4C, 0x39, 0xE2); // cmp rdx, r12
+    JitEmitJump(E, 0x87, Exit);    // ja Exit
+
+    JIT_EMIT(E, 0x8B, 0x94, 0x0B); // mov edx, [rbx + rcx + code_block::Id]
+    JitEmit32(E, JIT_OFFSET(BlockCache.Blocks) - SizeOfCodeBlock + (u32)offsetof(code_block, Id));
+    JIT_EMIT(E, 0x6B, 0xC0, (u8)SizeOfJitBlock); // imul eax, eax, sizeof(jit_block)
+    JIT_EMIT(E, 0x41, 0x3B, 0x94, 0x06);         // cmp edx, [r14 + rax + jit_block::BlockId]
+    JitEmit32(E, (u32)offsetof(jit_block, BlockId) - SizeOfJitBlock);
+    JitEmitJump(E, 0x85, Exit);                  // jne Exit
+
+    JIT_EMIT(E, 0x41, 0x8B, 0x94, 0x06); // mov edx, [r14 + rax + jit_block::NativeOffsetPlusOne]
+    JitEmit32(E, (u32)offsetof(jit_block, NativeOffsetPlusOne) - SizeOfJitBlock);
+    JIT_EMIT(E, 0x85, 0xD2);    // test edx, edx
+    JitEmitJump(E, 0x84, Exit); // jz Exit
+
+    JIT_EMIT(E, 0x49, 0x8D, 0x44, 0x17, 0xFF); // lea rax, [r15 + rdx - 1]
+    JIT_EMIT(E, 0xFF, 0xE0);                   // jmp rax
+
+    Jit->CodeUsed += ((u32)(E->At - Begin) + 15) & ~15u;
+}
+
+// Drops all native code. The code memory must be writable.
+static void
+ResetJit(jit_cache* Jit)
+{
+    Jit->CodeUsed = 0;
+    mtb::SliceSetZero(mtb::ArraySlice(Jit->Blocks));
+    JitEmitStubs(Jit);
+}
+
+// Returns the offset of the generated code in Jit->Code, plus one.
+static u32
+JitCompileBlock(jit_cache* Jit, machine* M, code_block* Block)
+{
+    JitSetExecutable(Jit, false);
+
+    if (JIT_CODE_SIZE - Jit->CodeUsed < JIT_MAX_BLOCK_CODE_SIZE)
+        ResetJit(Jit);
+
+    u8* Begin = Jit->Code + Jit->CodeUsed;
+    jit_emitter Emitter{ Begin, Begin + JIT_MAX_BLOCK_CODE_SIZE, Jit->Quirks, Jit->IsXOChip };
+    jit_emitter* E = &Emitter;
+
+    // The block ops may be fused, so the instructions are fetched again,
+    // which the decode cache keeps in sync with memory.
+    u16 NextAddress = Block->StartAddress;
+    micro_op Op{};
+    opcode_form Form = OP_INVALID;
+    bool FollowsSkip = false;
+    bool IsGuardedJump = false;
+    for (int Index = 0; Index < Block->NumInstructions; ++Index)
+    {
+        Op = FetchMicroOp(M, NextAddress);
+        Form = (opcode_form)Op.Form;
+        NextAddress += 2;
+
+        IsGuardedJump = FollowsSkip;
+        if (FollowsSkip)
+        {
+            // Only jump if the skip before this didn't skip over us. A skipped
+            // jump doesn't count as executed.
+            MTB_ASSERT(Form == OP_1nnn);
+            JitEmit8(E, 0x3D);             // cmp eax, AddressOfThisJump
+            JitEmit32(E, (u16)(NextAddress - 2));
+            JIT_EMIT(E, 0x74, 8);          // je Jump
+            JIT_EMIT(E, 0x49, 0xFF, 0xCD); // dec r13
+            JIT_EMIT(E, 0x49, 0xFF, 0xC4); // inc r12
+            JIT_EMIT(E, 0xEB, 9);          // jmp over Jump
+            JitEmitSetProgramCounter(E, (u16)Op.Imm); // Jump:
+        }
+        else
+        {
+            JitEmitOp(E, Op, NextAddress);
+        }
+
+        FollowsSkip = Form == OP_3xkk || Form == OP_4xkk || Form == OP_5xy0 || Form == OP_9xy0;
+        if (Index == Block->NumInstructions - 1 && !JitSetsProgramCounter(Form))
+            JitEmitSetProgramCounter(E, NextAddress);
+    }
+
+    u32 NumInstructions = Block->NumInstructions;
+    JIT_EMIT(E, 0x49, 0x81, 0xC5); // add r13, NumInstructions
+    JitEmit32(E, NumInstructions);
+    JIT_EMIT(E, 0x49, 0x81, 0xEC); // sub r12, NumInstructions
+    JitEmit32(E, NumInstructions);
+
+    // Blocks that jump back to their own start (e.g. idle loops) don't need
+    // to go through the dispatcher. If the jump is guarded by a skip, the
+    // loop is only taken if the jump actually happened.
+    if (Form == OP_1nnn && Op.Imm == Block->StartAddress)
+    {
+        if (IsGuardedJump)
+        {
+            JIT_EMIT(E, 0x66, 0x81); // cmp word [ProgramCounter], StartAddress
+            JitEmitMachineOperand(E, 7, JIT_OFFSET(ProgramCounter));
+            JitEmit16(E, Block->StartAddress);
+            JitEmitJump(E, 0x85, Jit->Code + Jit->DispatchOffset); // jne Dispatch
+        }
+
+        JIT_EMIT(E, 0x49, 0x81, 0xFC); // cmp r12, NumInstructions
+        JitEmit32(E, NumInstructions);
+        JitEmitJump(E, 0x83, Begin);   // jae Begin
+    }
+
+    // LD Vx, K always ends a block. The host has to provide the key before anything else runs.
+    if (Form == OP_Fx0A)
+        JitEmitJump(E, 0, Jit->Code + Jit->ExitOffset); // jmp Exit
+    else
+        JitEmitJump(E, 0, Jit->Code + Jit->DispatchOffset); // jmp Dispatch
+
+    JitSetExecutable(Jit, true);
+
+    u32 Result = Jit->CodeUsed + 1;
+    Jit->CodeUsed += ((u32)(E->At - Begin) + 15) & ~15u;
+    return Result;
+}
+
+bool
+InitJit(jit_cache* Jit)
+{
+    mtb::ItemSetZero(*Jit);
+    Jit->HotThreshold = JIT_DEFAULT_HOT_THRESHOLD;
+
+#if defined(_WIN32)
+    Jit->Code = (u8*)VirtualAlloc(nullptr, JIT_CODE_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    void* Memory = mmap(nullptr, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    Jit->Code = Memory != MAP_FAILED ? (u8*)Memory : nullptr;
+#endif
+
+    if (Jit->Code)
+    {
+        ResetJit(Jit);
+        JitSetExecutable(Jit, true);
+    }
+
+    return Jit->Code != nullptr;
+}
+
+void
+Deallocate(jit_cache* Jit)
+{
+    if (Jit->Code)
+    {
+#if defined(_WIN32)
+        VirtualFree(Jit->Code, 0, MEM_RELEASE);
+#else
+        munmap(Jit->Code, JIT_CODE_SIZE);
+#endif
+    }
+
+    mtb::ItemSetZero(*Jit);
+}
+
+u64
+ExecuteJit(machine* M, jit_cache* Jit, u64 MaxInstructions)
+{
+    if (!Jit->Code)
+        return ExecuteBlocks(M, MaxInstructions);
+
+    // Native code has the quirks and the way skips work baked in.
+    bool IsXOChip = M->XOChip != nullptr;
+    if (Jit->Quirks != M->Quirks || Jit->IsXOChip != IsXOChip)
+    {
+        JitSetExecutable(Jit, false);
+        ResetJit(Jit);
+        JitSetExecutable(Jit, true);
+        Jit->Quirks = M->Quirks;
+        Jit->IsXOChip = IsXOChip;
+    }
+
+    block_cache* Cache = &M->BlockCache;
+    u64 NumExecuted = 0;
+    while (NumExecuted < MaxInstructions && !M->RequiredInputRegisterIndexPlusOne)
+    {
+        u64 Remaining = MaxInstructions - NumExecuted;
+        code_block* Block;
+        u16 BlockIndexPlusOne = Cache->BlockIndexPlusOne[M->ProgramCounter & 0xFFF];
+        if (BlockIndexPlusOne && M->ProgramCounter < MTB_ARRAY_SIZE(M->Memory))
+            Block = Cache->Blocks + (BlockIndexPlusOne - 1);
+        else
+            Block = FindOrBuildBlock(M, M->ProgramCounter);
+
+        if (Block && Block->NumInstructions <= Remaining)
+        {
+            jit_block* Entry = Jit->Blocks + (Block - Cache->Blocks);
+            if (Entry->BlockId != Block->Id)
+            {
+                Entry->BlockId = Block->Id;
+                Entry->NativeOffsetPlusOne = 0;
+                Entry->HitCount = 0;
+            }
+
+            if (!Entry->NativeOffsetPlusOne && ++Entry->HitCount >= Jit->HotThreshold)
+            {
+                u32 NativeOffsetPlusOne = JitCompileBlock(Jit, M, Block);
+
+                // Compiling may have reset the whole cache.
+                Entry->BlockId = Block->Id;
+                Entry->NativeOffsetPlusOne = NativeOffsetPlusOne;
+            }
+
+            if (Entry->NativeOffsetPlusOne)
+            {
+                jit_enter_function* Enter = (jit_enter_function*)(Jit->Code + Jit->EnterOffset);
+                NumExecuted += Enter(M, Remaining, Jit->Blocks, Jit->Code);
+            }
+            else
+            {
+                NumExecuted += ExecuteBlocks(M, Block->NumInstructions);
+            }
+        }
+        else
+        {
+            // Not enough budget left for the whole block or no valid instruction to begin with.
+            u64 NumInterpreted = ExecuteThreaded(M, Block ? Remaining : 1);
+            if (NumInterpreted == 0)
+                break;
+
+            NumExecuted += NumInterpreted;
+        }
+    }
+
+    return NumExecuted;
+}
+
+#undef JIT_EMIT
+#undef JIT_OFFSET
+
+#endif // COUSCOUS_JIT
@@ -0,0 +1,387 @@
+//
+// Input movies.
+//
+// A machine runs the same way for the same ROM, RNG seed, quirks, speed and
+// input, so a movie only stores those. Frames always run with `RunFrame`,
+// both while recording and during playback, so hosts can't slice them
+// differently. Inputs are stored as runs, each the XOR with the previous
+// input followed by the number of frames, both as varints, see
+// `WriteVarint`.
+//
+
+enum
+{
+    MOVIE_MAX_RUN_SIZE = 3 + 5, // A u16 and a u32 varint.
+};
+
+static void
+WriteU32LE(u8* Bytes, u32 Value)
+{
+    for (int ByteIndex = 0; ByteIndex < 4; ++ByteIndex)
+        Bytes[ByteIndex] = (u8)(Value >> (8 * ByteIndex));
+}
+
+static void
+WriteU64LE(u8* Bytes, u64 Value)
+{
+    WriteU32LE(Bytes, (u32)Value);
+    WriteU32LE(Bytes + 4, (u32)(Value >> 32));
+}
+
+static u32
+ReadU32LE(u8 const* Bytes)
+{
+    u32 Result = 0;
+    for (int ByteIndex = 0; ByteIndex < 4; ++ByteIndex)
+        Result |= (u32)Bytes[ByteIndex] << (8 * ByteIndex);
+
+    return Result;
+}
+
+static u64
+ReadU64LE(u8 const* Bytes)
+{
+    u64 Result = ReadU32LE(Bytes) | (u64)ReadU32LE(Bytes + 4) << 32;
+    return Result;
+}
+
+u64
+HashBytes(void const* Bytes, size_t NumBytes, u64 Hash)
+{
+    u8 const* Byte = (u8 const*)Bytes;
+    for (size_t ByteIndex = 0; ByteIndex < NumBytes; ++ByteIndex)
+    {
+        Hash ^= Byte[ByteIndex];
+        Hash *= 0x100000001B3;
+    }
+
+    return Hash;
+}
+
+u64
+HashMachineState(machine const* M)
+{
+    // Skips the XO-CHIP pointer and the written pages, which are
+    // bookkeeping for snapshots.
+    u64 Result = HashBytes(M, offsetof(machine, XOChip));
+    size_t AfterXOChip = offsetof(machine, XOChip) + sizeof(M->XOChip);
+    Result = HashBytes((u8 const*)M + AfterXOChip, offsetof(machine, WrittenPages) - AfterXOChip, Result);
+    size_t AfterWrittenPages = offsetof(machine, WrittenPages) + sizeof(M->WrittenPages);
+    Result = HashBytes((u8 const*)M + AfterWrittenPages, offsetof(machine, DecodeCache) - AfterWrittenPages, Result);
+    if (M->XOChip)
+        Result = HashBytes(M->XOChip, sizeof(xochip_state), Result);
+
+    return Result;
+}
+
+static void
+WriteMovieRun(movie* Movie)
+{
+    u8* At = Movie->Data + Movie->Cursor;
+    At = WriteVarint(At, (u32)(Movie->RunInputState ^ Movie->PreviousInputState));
+    At = WriteVarint(At, Movie->RunLength);
+    Movie->Cursor = (u32)(At - Movie->Data);
+
+    Movie->PreviousInputState = Movie->RunInputState;
+    Movie->RunLength = 0;
+}
+
+void
+BeginMovieRecording(movie* Movie, u8* Data, u32 DataSize, machine* M, u64 RomHash, u64 Seed, u32 InstructionsPerFrame)
+{
+    *Movie = {};
+    Movie->Header.RomHash = RomHash;
+    Movie->Header.Seed = Seed;
+    Movie->Header.Quirks = M->Quirks;
+    Movie->Header.InstructionsPerFrame = InstructionsPerFrame;
+    Movie->Header.InstructionsPerSecond = M->InstructionsPerSecond;
+    Movie->Header.Flags = M->XOChip ? MOVIE_XOCHIP : 0;
+    Movie->Data = Data;
+    Movie->DataSize = DataSize;
+    Movie->Cursor = MOVIE_HEADER_SIZE;
+    Movie->RunCursor = MOVIE_HEADER_SIZE;
+
+    StartMovieMachine(Movie, M);
+}
+
+bool
+RecordMovieFrame(movie* Movie, machine* M, u16 InputState)
+{
+    if (Movie->RunLength == 0 || InputState != Movie->RunInputState)
+    {
+        // Leave room for the run that `EndMovieRecording` writes.
+        if (Movie->Cursor + 2 * MOVIE_MAX_RUN_SIZE > Movie->DataSize)
+            return false;
+
+        if (Movie->RunLength > 0)
+            WriteMovieRun(Movie);
+        Movie->RunInputState = InputState;
+        Movie->RunCursor = Movie->Cursor;
+        Movie->RunFrame = 0;
+    }
+
+    ++Movie->RunLength;
+    ++Movie->RunFrame;
+    ++Movie->Frame;
+    RunFrame(M, InputState, Movie->Header.InstructionsPerFrame);
+
+    return true;
+}
+
+u32
+EndMovieRecording(movie* Movie)
+{
+    if (Movie->RunLength > 0)
+        WriteMovieRun(Movie);
+
+    movie_header* Header = &Movie->Header;
+    Header->NumFrames = Movie->Frame;
+    Header->InputSize = Movie->Cursor - MOVIE_HEADER_SIZE;
+
+    u8* Bytes = Movie->Data;
+    WriteU32LE(Bytes + 0, MOVIE_MAGIC);
+    WriteU32LE(Bytes + 4, MOVIE_VERSION);
+    WriteU64LE(Bytes + 8, Header->RomHash);
+    WriteU64LE(Bytes + 16, Header->Seed);
+    WriteU32LE(Bytes + 24, (u32)Header->Quirks);
+    WriteU32LE(Bytes + 28, Header->InstructionsPerFrame);
+    WriteU32LE(Bytes + 32, Header->InstructionsPerSecond);
+    WriteU32LE(Bytes + 36, Header->Flags);
+    WriteU32LE(Bytes + 40, Header->NumFrames);
+    WriteU32LE(Bytes + 44, Header->InputSize);
+
+    return Movie->Cursor;
+}
+
+bool
+BeginMoviePlayback(movie* Movie, u8* Data, u32 DataSize)
+{
+    *Movie = {};
+    if (DataSize < MOVIE_HEADER_SIZE || ReadU32LE(Data) != MOVIE_MAGIC || ReadU32LE(Data + 4) != MOVIE_VERSION)
+        return false;
+
+    movie_header* Header = &Movie->Header;
+    Header->RomHash = ReadU64LE(Data + 8);
+    Header->Seed = ReadU64LE(Data + 16);
+    Header->Quirks = (quirk_flags)ReadU32LE(Data + 24) & quirk_flags::ALL;
+    Header->InstructionsPerFrame = ReadU32LE(Data + 28);
+    Header->InstructionsPerSecond = ReadU32LE(Data + 32);
+    Header->Flags = ReadU32LE(Data + 36);
+    Header->NumFrames = ReadU32LE(Data + 40);
+    Header->InputSize = ReadU32LE(Data + 44);
+    if (Header->InputSize > DataSize - MOVIE_HEADER_SIZE)
+        return false;
+
+    Movie->Data = Data;
+    Movie->DataSize = MOVIE_HEADER_SIZE + Header->InputSize;
+    Movie->Cursor = MOVIE_HEADER_SIZE;
+    Movie->RunCursor = MOVIE_HEADER_SIZE;
+
+    return true;
+}
+
+void
+StartMovieMachine(movie const* Movie, machine* M)
+{
+    M->RNG = mtb::tRNG::Seed(Movie->Header.Seed);
+    SetQuirks(M, Movie->Header.Quirks);
+    M->InstructionsPerSecond = Movie->Header.InstructionsPerSecond;
+}
+
+static bool
+ReadMovieRun(movie* Movie)
+{
+    if (Movie->Cursor >= Movie->DataSize)
+        return false;
+
+    u32 Delta, RunLength;
+    u8 const* At = Movie->Data + Movie->Cursor;
+    u8 const* End = Movie->Data + Movie->DataSize;
+    At = ReadVarint(At, End, &Delta);
+    At = At ? ReadVarint(At, End, &RunLength) : nullptr;
+    if (!At)
+        return false;
+
+    Movie->RunCursor = Movie->Cursor;
+    Movie->RunLength = RunLength;
+    Movie->Cursor = (u32)(At - Movie->Data);
+
+    Movie->RunInputState = (u16)(Movie->PreviousInputState ^ Delta);
+    Movie->PreviousInputState = Movie->RunInputState;
+    Movie->RunFrame = 0;
+
+    return Movie->RunLength > 0;
+}
+
+bool
+PlayMovieFrame(movie* Movie, machine* M)
+{
+    if (Movie->Frame >= Movie->Header.NumFrames)
+        return false;
+
+    if (Movie->RunLength == 0 && !ReadMovieRun(Movie))
+        return false;
+
+    --Movie->RunLength;
+    ++Movie->RunFrame;
+    ++Movie->Frame;
+    RunFrame(M, Movie->RunInputState, Movie->Header.InstructionsPerFrame);
+
+    return true;
+}
+
+u32
+PlayMovie(movie* Movie, machine* M)
+{
+    u32 Result = 0;
+    while (PlayMovieFrame(Movie, M))
+        ++Result;
+
+    return Result;
+}
+
+//
+// Seek index.
+//
+// The index is a separate file next to the movie, so movies stay small and
+// can be indexed later by playing them back once. Keyframes are taken
+// before frames that are a multiple of the keyframe interval and are
+// encoded like rewind keyframes, see `EncodeRewindFrame`. Each one starts
+// with MOVIE_KEYFRAME_HEADER_SIZE bytes:
+//
+//   u32 Frame
+//   u32 RunCursor
+//   u32 RunFrame
+//   u32 RunInputState
+//   u32 StateSize (encoded)
+//
+
+void
+BeginMovieIndex(movie_index* Index, u8* Data, u32 DataSize, u32 KeyframeInterval)
+{
+    Index->Data = Data;
+    Index->DataSize = DataSize;
+    Index->DataUsed = MOVIE_INDEX_HEADER_SIZE;
+    Index->KeyframeInterval = KeyframeInterval ? KeyframeInterval : 1;
+    Index->NumKeyframes = 0;
+}
+
+bool
+UpdateMovieIndex(movie_index* Index, movie const* Movie, machine const* M)
+{
+    if (Movie->Frame != Index->NumKeyframes * Index->KeyframeInterval)
+        return true;
+
+    if (Index->NumKeyframes == MOVIE_MAX_KEYFRAMES)
+        return false;
+
+    CopyStateFromMachine(M, Index->State);
+    u32 StateSize = EncodeRewindFrame(Index->State, nullptr, GetRewindStateSize(M), Index->Encoded);
+    if (Index->DataUsed + MOVIE_KEYFRAME_HEADER_SIZE + StateSize > Index->DataSize)
+        return false;
+
+    u8* Bytes = Index->Data + Index->DataUsed;
+    WriteU32LE(Bytes + 0, Movie->Frame);
+    WriteU32LE(Bytes + 4, Movie->RunCursor);
+    WriteU32LE(Bytes + 8, Movie->RunFrame);
+    WriteU32LE(Bytes + 12, Movie->RunInputState);
+    WriteU32LE(Bytes + 16, StateSize);
+    mtb::CopyBytes(Bytes + MOVIE_KEYFRAME_HEADER_SIZE, Index->Encoded, StateSize);
+
+    Index->KeyframeOffsets[Index->NumKeyframes++] = Index->DataUsed;
+    Index->DataUsed += MOVIE_KEYFRAME_HEADER_SIZE + StateSize;
+
+    return true;
+}
+
+u32
+EndMovieIndex(movie_index* Index, movie const* Movie)
+{
+    u8* Bytes = Index->Data;
+    WriteU32LE(Bytes + 0, MOVIE_INDEX_MAGIC);
+    WriteU32LE(Bytes + 4, MOVIE_INDEX_VERSION);
+    WriteU64LE(Bytes + 8, HashBytes(Movie->Data, MOVIE_HEADER_SIZE + Movie->Header.InputSize));
+    WriteU32LE(Bytes + 16, Index->KeyframeInterval);
+    WriteU32LE(Bytes + 20, Index->NumKeyframes);
+
+    return Index->DataUsed;
+}
+
+bool
+LoadMovieIndex(movie_index* Index, u8* Data, u32 DataSize, movie const* Movie)
+{
+    if (DataSize < MOVIE_INDEX_HEADER_SIZE || ReadU32LE(Data) != MOVIE_INDEX_MAGIC || ReadU32LE(Data + 4) != MOVIE_INDEX_VERSION ||
+        ReadU64LE(Data + 8) != HashBytes(Movie->Data, MOVIE_HEADER_SIZE + Movie->Header.InputSize))
+    {
+        return false;
+    }
+
+    BeginMovieIndex(Index, Data, DataSize, ReadU32LE(Data + 16));
+    u32 NumKeyframes = ReadU32LE(Data + 20);
+    if (NumKeyframes > MOVIE_MAX_KEYFRAMES)
+        return false;
+
+    // Only the offsets are gathered here, keyframes are decoded when seeking.
+    for (u32 KeyframeIndex = 0; KeyframeIndex < NumKeyframes; ++KeyframeIndex)
+    {
+        u32 Offset = Index->DataUsed;
+        if (Offset + MOVIE_KEYFRAME_HEADER_SIZE > DataSize)
+            return false;
+
+        u32 StateSize = ReadU32LE(Data + Offset + 16);
+        if (StateSize > DataSize - Offset - MOVIE_KEYFRAME_HEADER_SIZE)
+            return false;
+
+        Index->KeyframeOffsets[Index->NumKeyframes++] = Offset;
+        Index->DataUsed += MOVIE_KEYFRAME_HEADER_SIZE + StateSize;
+    }
+
+    return true;
+}
+
+bool
+SeekMovie(movie* Movie, movie_index* Index, machine* M, u32 Frame)
+{
+    if (Index->NumKeyframes == 0 || Frame > Movie->Header.NumFrames)
+        return false;
+
+    u32 KeyframeIndex = Frame / Index->KeyframeInterval;
+    if (KeyframeIndex >= Index->NumKeyframes)
+        KeyframeIndex = Index->NumKeyframes - 1;
+
+    u8 const* Bytes = Index->Data + Index->KeyframeOffsets[KeyframeIndex];
+    u32 KeyframeFrame = ReadU32LE(Bytes + 0);
+    u32 RunCursor = ReadU32LE(Bytes + 4);
+    if (KeyframeFrame > Frame || RunCursor < MOVIE_HEADER_SIZE || RunCursor > Movie->DataSize)
+        return false;
+
+    // The keyframe must have been taken of a machine like M, with or without XO-CHIP.
+    u32 StateSize = GetRewindStateSize(M);
+    mtb::SetZero(Index->State, StateSize);
+    if (ApplyRewindFrame(Index->State, StateSize, Bytes + MOVIE_KEYFRAME_HEADER_SIZE, ReadU32LE(Bytes + 16)) != StateSize)
+        return false;
+
+    CopyStateToMachine(M, Index->State);
+
+    Movie->Frame = KeyframeFrame;
+    Movie->Cursor = RunCursor;
+    Movie->RunLength = 0;
+    u32 RunFrame = ReadU32LE(Bytes + 8);
+    if (RunFrame > 0)
+    {
+        // Continue in the middle of the run.
+        if (!ReadMovieRun(Movie) || Movie->RunLength < RunFrame)
+            return false;
+
+        Movie->RunLength -= RunFrame;
+        Movie->RunFrame = RunFrame;
+    }
+    Movie->RunInputState = (u16)ReadU32LE(Bytes + 12);
+    Movie->PreviousInputState = Movie->RunInputState;
+
+    while (Movie->Frame < Frame && PlayMovieFrame(Movie, M))
+    {
+    }
+
+    return Movie->Frame == Frame;
+}
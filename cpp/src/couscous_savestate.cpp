@@ -0,0 +1,219 @@
+//
+// Save states.
+//
+// A save state starts with a header and a table of sections, all
+// little-endian u32:
+//
+//   Magic, Version, NumSections, Flags
+//   NumSections times: Id, Offset, Size, Reserved
+//
+// Sections are stored in the order of `save_state_section` and start on
+// their own cache line, so loading one is a single copy out of the mapped
+// file. All platforms couscous runs on are little-endian, so the screen
+// rows, the stack and the RNG are copied as they are.
+//
+
+// Saved like this in the SAVE_STATE_REGISTERS section.
+struct save_state_registers
+{
+    u8 V[16];
+    u16 I;
+    u16 ProgramCounter;
+    u8 StackPointer;
+    u8 DT;
+    u8 ST;
+    u8 RequiredInputRegisterIndexPlusOne;
+    u16 InputState;
+    u8 SelectedPlanes;
+    u8 IsHighResolution;
+    u32 InstructionsPerSecond;
+    u64 CurrentCycle;
+    u8 FlagRegisters[NUM_FLAG_REGISTERS];
+    u8 AudioPattern[AUDIO_PATTERN_SIZE];
+    u8 AudioPitch;
+    u8 Reserved[7];
+};
+
+static_assert(sizeof(save_state_registers) == 72, "The registers section must not change within a version.");
+static_assert(sizeof(machine::Stack) == 32 && sizeof(machine::RNG) == 16, "The stack and RNG sections must not change within a version.");
+
+struct save_state_layout
+{
+    u32 Offsets[SAVE_STATE_NUM_SECTIONS];
+    u32 Sizes[SAVE_STATE_NUM_SECTIONS];
+    u32 Size;
+};
+
+static u32
+AlignSaveStateOffset(u32 Offset)
+{
+    return (Offset + SAVE_STATE_SECTION_ALIGNMENT - 1) & ~(u32)(SAVE_STATE_SECTION_ALIGNMENT - 1);
+}
+
+static save_state_layout
+GetSaveStateLayout(bool IsXOChip)
+{
+    save_state_layout Result;
+    Result.Sizes[SAVE_STATE_REGISTERS - 1] = sizeof(save_state_registers);
+    Result.Sizes[SAVE_STATE_QUIRKS - 1] = sizeof(u32);
+    Result.Sizes[SAVE_STATE_MEMORY - 1] = IsXOChip ? XOCHIP_MEMORY_SIZE : sizeof(machine::Memory);
+    Result.Sizes[SAVE_STATE_SCREEN - 1] = (IsXOChip ? XOCHIP_MAX_PLANES : 1) * sizeof(machine::HighResScreen);
+    Result.Sizes[SAVE_STATE_STACK - 1] = sizeof(machine::Stack);
+    Result.Sizes[SAVE_STATE_RNG - 1] = sizeof(machine::RNG);
+
+    u32 Offset = AlignSaveStateOffset(SAVE_STATE_HEADER_SIZE + SAVE_STATE_NUM_SECTIONS * SAVE_STATE_SECTION_ENTRY_SIZE);
+    for (int SectionIndex = 0; SectionIndex < SAVE_STATE_NUM_SECTIONS; ++SectionIndex)
+    {
+        Result.Offsets[SectionIndex] = Offset;
+        Offset = AlignSaveStateOffset(Offset + Result.Sizes[SectionIndex]);
+    }
+    Result.Size = Offset;
+
+    MTB_ASSERT(Result.Size <= SAVE_STATE_MAX_SIZE);
+    return Result;
+}
+
+u32
+GetSaveStateSize(machine const* M)
+{
+    return GetSaveStateLayout(M->XOChip != nullptr).Size;
+}
+
+u32
+WriteSaveState(machine const* M, u8* Bytes, u32 NumBytes)
+{
+    save_state_layout Layout = GetSaveStateLayout(M->XOChip != nullptr);
+    if (Layout.Size > NumBytes)
+        return 0;
+
+    mtb::SetZero(Bytes, Layout.Size);
+    WriteU32LE(Bytes + 0, SAVE_STATE_MAGIC);
+    WriteU32LE(Bytes + 4, SAVE_STATE_VERSION);
+    WriteU32LE(Bytes + 8, SAVE_STATE_NUM_SECTIONS);
+    WriteU32LE(Bytes + 12, M->XOChip ? SAVE_STATE_XOCHIP : 0);
+    for (int SectionIndex = 0; SectionIndex < SAVE_STATE_NUM_SECTIONS; ++SectionIndex)
+    {
+        u8* Entry = Bytes + SAVE_STATE_HEADER_SIZE + SectionIndex * SAVE_STATE_SECTION_ENTRY_SIZE;
+        WriteU32LE(Entry + 0, SectionIndex + 1);
+        WriteU32LE(Entry + 4, Layout.Offsets[SectionIndex]);
+        WriteU32LE(Entry + 8, Layout.Sizes[SectionIndex]);
+    }
+
+    save_state_registers Registers{};
+    mtb::CopyBytes(Registers.V, M->V, sizeof(M->V));
+    Registers.I = M->I;
+    Registers.ProgramCounter = M->ProgramCounter;
+    Registers.StackPointer = M->StackPointer;
+    Registers.DT = M->DT;
+    Registers.ST = M->ST;
+    Registers.RequiredInputRegisterIndexPlusOne = M->RequiredInputRegisterIndexPlusOne;
+    Registers.InputState = M->InputState;
+    Registers.SelectedPlanes = M->SelectedPlanes;
+    Registers.IsHighResolution = M->IsHighResolution;
+    Registers.InstructionsPerSecond = M->InstructionsPerSecond;
+    Registers.CurrentCycle = M->CurrentCycle;
+    mtb::CopyBytes(Registers.FlagRegisters, M->FlagRegisters, sizeof(M->FlagRegisters));
+    mtb::CopyBytes(Registers.AudioPattern, M->AudioPattern, sizeof(M->AudioPattern));
+    Registers.AudioPitch = M->AudioPitch;
+    mtb::CopyBytes(Bytes + Layout.Offsets[SAVE_STATE_REGISTERS - 1], &Registers, sizeof(Registers));
+
+    WriteU32LE(Bytes + Layout.Offsets[SAVE_STATE_QUIRKS - 1], (u32)M->Quirks);
+
+    u8* Memory = Bytes + Layout.Offsets[SAVE_STATE_MEMORY - 1];
+    mtb::CopyBytes(Memory, M->Memory, sizeof(M->Memory));
+    if (M->XOChip)
+        mtb::CopyBytes(Memory + sizeof(M->Memory), M->XOChip->ExtendedMemory, sizeof(M->XOChip->ExtendedMemory));
+
+    u8* Screen = Bytes + Layout.Offsets[SAVE_STATE_SCREEN - 1];
+    mtb::CopyBytes(Screen, M->HighResScreen, sizeof(M->HighResScreen));
+    if (M->XOChip)
+        mtb::CopyBytes(Screen + sizeof(M->HighResScreen), M->XOChip->Planes, sizeof(M->XOChip->Planes));
+
+    mtb::CopyBytes(Bytes + Layout.Offsets[SAVE_STATE_STACK - 1], M->Stack, sizeof(M->Stack));
+    mtb::CopyBytes(Bytes + Layout.Offsets[SAVE_STATE_RNG - 1], &M->RNG, sizeof(M->RNG));
+
+    return Layout.Size;
+}
+
+bool
+LoadSaveState(machine* M, u8 const* Bytes, size_t NumBytes)
+{
+    bool IsXOChip = M->XOChip != nullptr;
+    if (NumBytes < SAVE_STATE_HEADER_SIZE + SAVE_STATE_NUM_SECTIONS * SAVE_STATE_SECTION_ENTRY_SIZE ||
+        ReadU32LE(Bytes + 0) != SAVE_STATE_MAGIC ||
+        ReadU32LE(Bytes + 4) != SAVE_STATE_VERSION ||
+        ReadU32LE(Bytes + 8) != SAVE_STATE_NUM_SECTIONS ||
+        ((ReadU32LE(Bytes + 12) & SAVE_STATE_XOCHIP) != 0) != IsXOChip)
+    {
+        return false;
+    }
+
+    // Sections are always where this version puts them, so the table is
+    // only checked, not searched.
+    save_state_layout Layout = GetSaveStateLayout(IsXOChip);
+    for (int SectionIndex = 0; SectionIndex < SAVE_STATE_NUM_SECTIONS; ++SectionIndex)
+    {
+        u8 const* Entry = Bytes + SAVE_STATE_HEADER_SIZE + SectionIndex * SAVE_STATE_SECTION_ENTRY_SIZE;
+        if (ReadU32LE(Entry + 0) != (u32)SectionIndex + 1 ||
+            ReadU32LE(Entry + 4) != Layout.Offsets[SectionIndex] ||
+            ReadU32LE(Entry + 8) != Layout.Sizes[SectionIndex])
+        {
+            return false;
+        }
+    }
+
+    if (NumBytes < Layout.Size)
+        return false;
+
+    // Registers that index into the machine must be in range, the file may come from anywhere.
+    save_state_registers Registers;
+    mtb::CopyBytes(&Registers, Bytes + Layout.Offsets[SAVE_STATE_REGISTERS - 1], sizeof(Registers));
+    if (Registers.RequiredInputRegisterIndexPlusOne > MTB_ARRAY_COUNT(M->V) ||
+        Registers.SelectedPlanes >= 1 << XOCHIP_MAX_PLANES ||
+        Registers.IsHighResolution > 1 ||
+        Registers.StackPointer > MTB_ARRAY_COUNT(M->Stack))
+    {
+        return false;
+    }
+
+    mtb::CopyBytes(M->V, Registers.V, sizeof(M->V));
+    M->I = Registers.I;
+    M->ProgramCounter = Registers.ProgramCounter;
+    M->StackPointer = Registers.StackPointer;
+    M->DT = Registers.DT;
+    M->ST = Registers.ST;
+    M->RequiredInputRegisterIndexPlusOne = Registers.RequiredInputRegisterIndexPlusOne;
+    M->InputState = Registers.InputState;
+    M->SelectedPlanes = Registers.SelectedPlanes;
+    M->IsHighResolution = Registers.IsHighResolution != 0;
+    M->InstructionsPerSecond = Registers.InstructionsPerSecond;
+    M->CurrentCycle = Registers.CurrentCycle;
+    mtb::CopyBytes(M->FlagRegisters, Registers.FlagRegisters, sizeof(M->FlagRegisters));
+    mtb::CopyBytes(M->AudioPattern, Registers.AudioPattern, sizeof(M->AudioPattern));
+    M->AudioPitch = Registers.AudioPitch;
+
+    SetQuirks(M, (quirk_flags)ReadU32LE(Bytes + Layout.Offsets[SAVE_STATE_QUIRKS - 1]));
+
+    // Pages that didn't change keep their decoded instructions, which helps
+    // when loading many states of the same ROM.
+    u8 const* Memory = Bytes + Layout.Offsets[SAVE_STATE_MEMORY - 1];
+    for (u32 PageIndex = 0; PageIndex < sizeof(M->Memory) / MEMORY_PAGE_SIZE; ++PageIndex)
+        RestoreMemoryPage(M, PageIndex, Memory + PageIndex * MEMORY_PAGE_SIZE);
+    if (M->XOChip)
+        mtb::CopyBytes(M->XOChip->ExtendedMemory, Memory + sizeof(M->Memory), sizeof(M->XOChip->ExtendedMemory));
+
+    u8 const* Screen = Bytes + Layout.Offsets[SAVE_STATE_SCREEN - 1];
+    mtb::CopyBytes(M->HighResScreen, Screen, sizeof(M->HighResScreen));
+    if (M->XOChip)
+        mtb::CopyBytes(M->XOChip->Planes, Screen + sizeof(M->HighResScreen), sizeof(M->XOChip->Planes));
+
+    mtb::CopyBytes(M->Stack, Bytes + Layout.Offsets[SAVE_STATE_STACK - 1], sizeof(M->Stack));
+    mtb::CopyBytes(&M->RNG, Bytes + Layout.Offsets[SAVE_STATE_RNG - 1], sizeof(M->RNG));
+
+    // The whole screen and all of memory may have changed.
+    ++M->DisplayGeneration;
+    M->DirtyRows = ~0ull;
+    M->WrittenPages = ~0ull;
+
+    return true;
+}
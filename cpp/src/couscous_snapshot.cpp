@@ -0,0 +1,556 @@
+//
+// Copy-on-write snapshots of a `machine`, and the rewind buffer.
+//
+// A snapshot is the hot registers plus one level of page tables. The tables
+// and the pages they point to live in the snapshot_pool and are reference
+// counted, tables by the snapshots using them, pages by the tables using
+// them. A snapshot copies only the pages that changed since the pool's latest
+// snapshot and shares everything else, including whole tables.
+//
+
+// Copies a page of machine::Memory, invalidating its decoded instructions only if it changed.
+static void
+RestoreMemoryPage(machine* M, u32 PageIndex, u8 const* Bytes)
+{
+    u8* Page = M->Memory + PageIndex * MEMORY_PAGE_SIZE;
+    if (!mtb::BytesAreEqual(Page, Bytes, MEMORY_PAGE_SIZE))
+    {
+        mtb::CopyBytes(Page, Bytes, MEMORY_PAGE_SIZE);
+        InvalidateDecodeCache(M, (u16)(PageIndex * MEMORY_PAGE_SIZE), MEMORY_PAGE_SIZE);
+    }
+}
+
+// Copies the hot registers, including the quirks. M keeps its own xochip_state, if any.
+static void
+RestoreRegisters(machine* M, u8 const* Bytes)
+{
+    xochip_state* XOChip = M->XOChip;
+    mtb::CopyBytes(M, Bytes, CACHE_LINE_SIZE);
+    M->XOChip = XOChip;
+    SetQuirks(M, M->Quirks);
+}
+
+static u8*
+GetSnapshotPageBytes(machine* M, u32 PageIndex)
+{
+    u8* Result = nullptr;
+    if (PageIndex < SNAPSHOT_NUM_MACHINE_PAGES)
+        Result = (u8*)M + CACHE_LINE_SIZE + PageIndex * SNAPSHOT_PAGE_SIZE;
+    else if (M->XOChip && PageIndex < SNAPSHOT_NUM_PAGES)
+        Result = (u8*)M->XOChip + (PageIndex - SNAPSHOT_NUM_MACHINE_PAGES) * SNAPSHOT_PAGE_SIZE;
+
+    return Result;
+}
+
+static u16*
+GetSnapshotTable(snapshot_pool* Pool, u16 TableIndexPlusOne)
+{
+    u16* Result = nullptr;
+    if (TableIndexPlusOne)
+        Result = (u16*)Pool->Pages[TableIndexPlusOne - 1];
+
+    return Result;
+}
+
+// Returns 0 if the pool is full.
+static u16
+AllocateSnapshotPage(snapshot_pool* Pool, void const* Bytes)
+{
+    u16 Result = 0;
+    if (Pool->NumFreePages > 0)
+    {
+        u16 PageIndex = Pool->FreePages[--Pool->NumFreePages];
+        mtb::CopyBytes(Pool->Pages[PageIndex], Bytes, SNAPSHOT_PAGE_SIZE);
+        Pool->RefCounts[PageIndex] = 1;
+        Result = (u16)(PageIndex + 1);
+    }
+
+    return Result;
+}
+
+static void
+AddSnapshotPageRef(snapshot_pool* Pool, u16 PageIndexPlusOne)
+{
+    if (PageIndexPlusOne)
+        ++Pool->RefCounts[PageIndexPlusOne - 1];
+}
+
+// Returns true if the page is free now.
+static bool
+ReleaseSnapshotPage(snapshot_pool* Pool, u16 PageIndexPlusOne)
+{
+    bool Result = false;
+    if (PageIndexPlusOne)
+    {
+        u16 PageIndex = (u16)(PageIndexPlusOne - 1);
+        MTB_ASSERT(Pool->RefCounts[PageIndex] > 0);
+        if (--Pool->RefCounts[PageIndex] == 0)
+        {
+            Pool->FreePages[Pool->NumFreePages++] = PageIndex;
+            Result = true;
+        }
+    }
+
+    return Result;
+}
+
+static void
+ReleaseSnapshotTable(snapshot_pool* Pool, u16 TableIndexPlusOne)
+{
+    u16 const* Table = GetSnapshotTable(Pool, TableIndexPlusOne);
+    if (ReleaseSnapshotPage(Pool, TableIndexPlusOne))
+    {
+        // The table is on the free list now but nothing else could have
+        // taken it yet.
+        for (int EntryIndex = 0; EntryIndex < SNAPSHOT_PAGES_PER_TABLE; ++EntryIndex)
+            ReleaseSnapshotPage(Pool, Table[EntryIndex]);
+    }
+}
+
+static void
+AddSnapshotRef(snapshot_pool* Pool, machine_snapshot const* Snapshot)
+{
+    for (int TableIndex = 0; TableIndex < SNAPSHOT_NUM_TABLES; ++TableIndex)
+        AddSnapshotPageRef(Pool, Snapshot->TableIndexPlusOne[TableIndex]);
+}
+
+static void
+SetLatestSnapshot(snapshot_pool* Pool, machine_snapshot const* Snapshot)
+{
+    AddSnapshotRef(Pool, Snapshot);
+    ReleaseSnapshot(Pool, &Pool->Latest);
+    Pool->Latest = *Snapshot;
+}
+
+void
+InitSnapshotPool(snapshot_pool* Pool)
+{
+    mtb::SliceSetZero(mtb::ArraySlice(Pool->RefCounts));
+    for (u32 PageIndex = 0; PageIndex < SNAPSHOT_POOL_SIZE; ++PageIndex)
+        Pool->FreePages[PageIndex] = (u16)(SNAPSHOT_POOL_SIZE - 1 - PageIndex);
+    Pool->NumFreePages = SNAPSHOT_POOL_SIZE;
+    Pool->Latest = {};
+}
+
+bool
+SnapshotMachine(snapshot_pool* Pool, machine* M, machine_snapshot* Snapshot)
+{
+    bool Result = true;
+
+    u64 WrittenPages = TakeWrittenPages(M);
+
+    machine_snapshot NewSnapshot{};
+    mtb::CopyBytes(NewSnapshot.Registers, M, CACHE_LINE_SIZE);
+
+    for (u32 TableIndex = 0; Result && TableIndex < SNAPSHOT_NUM_TABLES; ++TableIndex)
+    {
+        u16 BaseTableIndexPlusOne = Pool->Latest.TableIndexPlusOne[TableIndex];
+        u16 const* BaseTable = GetSnapshotTable(Pool, BaseTableIndexPlusOne);
+
+        // Unchanged pages are taken from the base table as they are, changed ones get a new page.
+        u16 Table[SNAPSHOT_PAGES_PER_TABLE];
+        bool IsSameAsBase = BaseTable != nullptr;
+        bool IsEmpty = true;
+        for (u32 EntryIndex = 0; EntryIndex < SNAPSHOT_PAGES_PER_TABLE; ++EntryIndex)
+        {
+            u32 PageIndex = TableIndex * SNAPSHOT_PAGES_PER_TABLE + EntryIndex;
+            u16 BasePage = BaseTable ? BaseTable[EntryIndex] : 0;
+            u8 const* Bytes = GetSnapshotPageBytes(M, PageIndex);
+
+            u16 Page = 0;
+            if (Bytes && BasePage)
+            {
+                bool IsUnwrittenMemory = PageIndex < sizeof(M->Memory) / SNAPSHOT_PAGE_SIZE && !IsBitSet(WrittenPages, (u64)PageIndex);
+                if (IsUnwrittenMemory || mtb::BytesAreEqual(Bytes, Pool->Pages[BasePage - 1], SNAPSHOT_PAGE_SIZE))
+                    Page = BasePage;
+            }
+            if (Bytes && !Page)
+            {
+                Page = AllocateSnapshotPage(Pool, Bytes);
+                if (!Page)
+                    Result = false;
+            }
+
+            Table[EntryIndex] = Page;
+            IsSameAsBase &= Page == BasePage;
+            IsEmpty &= Page == 0;
+        }
+
+        u16 TableIndexPlusOne = 0;
+        if (Result && IsSameAsBase)
+        {
+            TableIndexPlusOne = BaseTableIndexPlusOne;
+            AddSnapshotPageRef(Pool, TableIndexPlusOne);
+        }
+        else if (Result && !IsEmpty)
+        {
+            TableIndexPlusOne = AllocateSnapshotPage(Pool, Table);
+            if (!TableIndexPlusOne)
+                Result = false;
+        }
+
+        // The new table holds a reference to every page, the shared ones only had the base table's so far.
+        for (u32 EntryIndex = 0; EntryIndex < SNAPSHOT_PAGES_PER_TABLE; ++EntryIndex)
+        {
+            u16 BasePage = BaseTable ? BaseTable[EntryIndex] : 0;
+            if (Table[EntryIndex] == BasePage)
+            {
+                if (Result && !IsSameAsBase)
+                    AddSnapshotPageRef(Pool, Table[EntryIndex]);
+            }
+            else if (!Result)
+            {
+                ReleaseSnapshotPage(Pool, Table[EntryIndex]);
+            }
+        }
+
+        NewSnapshot.TableIndexPlusOne[TableIndex] = TableIndexPlusOne;
+    }
+
+    if (Result)
+    {
+        SetLatestSnapshot(Pool, &NewSnapshot);
+        *Snapshot = NewSnapshot;
+    }
+    else
+    {
+        ReleaseSnapshot(Pool, &NewSnapshot);
+        M->WrittenPages |= WrittenPages;
+    }
+
+    return Result;
+}
+
+void
+RestoreMachine(snapshot_pool* Pool, machine* M, machine_snapshot const* Snapshot)
+{
+    RestoreRegisters(M, Snapshot->Registers);
+
+    for (u32 TableIndex = 0; TableIndex < SNAPSHOT_NUM_TABLES; ++TableIndex)
+    {
+        u16 const* Table = GetSnapshotTable(Pool, Snapshot->TableIndexPlusOne[TableIndex]);
+        if (!Table)
+            continue;
+
+        for (u32 EntryIndex = 0; EntryIndex < SNAPSHOT_PAGES_PER_TABLE; ++EntryIndex)
+        {
+            u32 PageIndex = TableIndex * SNAPSHOT_PAGES_PER_TABLE + EntryIndex;
+            u16 Page = Table[EntryIndex];
+            u8* Bytes = GetSnapshotPageBytes(M, PageIndex);
+            if (!Page || !Bytes)
+                continue;
+
+            u8 const* SnapshotBytes = Pool->Pages[Page - 1];
+            if (PageIndex < sizeof(M->Memory) / SNAPSHOT_PAGE_SIZE)
+                RestoreMemoryPage(M, PageIndex, SnapshotBytes);
+            else
+                mtb::CopyBytes(Bytes, SnapshotBytes, SNAPSHOT_PAGE_SIZE);
+        }
+    }
+
+    M->WrittenPages = 0;
+    SetLatestSnapshot(Pool, Snapshot);
+}
+
+void
+ReleaseSnapshot(snapshot_pool* Pool, machine_snapshot* Snapshot)
+{
+    for (int TableIndex = 0; TableIndex < SNAPSHOT_NUM_TABLES; ++TableIndex)
+    {
+        ReleaseSnapshotTable(Pool, Snapshot->TableIndexPlusOne[TableIndex]);
+        Snapshot->TableIndexPlusOne[TableIndex] = 0;
+    }
+}
+
+
+//
+// Rewind
+//
+// A frame is the emulated state XORed with the previous frame, which leaves
+// mostly 0 bytes. It is stored as pairs of varints, the number of 0 bytes to
+// skip and the number of bytes that follow as they are. Keyframes are XORed
+// with nothing, so they are a plain copy with the runs of 0 left out.
+//
+
+static u8*
+WriteVarint(u8* At, u32 Value)
+{
+    while (Value >= 0x80)
+    {
+        *At++ = (u8)(Value | 0x80);
+        Value >>= 7;
+    }
+    *At++ = (u8)Value;
+
+    return At;
+}
+
+// Returns null if the varint doesn't end before End or is longer than a u32 needs.
+static u8 const*
+ReadVarint(u8 const* At, u8 const* End, u32* Value)
+{
+    u32 Result = 0;
+    for (int Shift = 0; ; Shift += 7)
+    {
+        if (At == End || Shift > 28)
+            return nullptr;
+
+        u8 Byte = *At++;
+        Result |= (u32)(Byte & 0x7F) << Shift;
+        if (!(Byte & 0x80))
+            break;
+    }
+    *Value = Result;
+
+    return At;
+}
+
+// Previous is null for keyframes. Returns the number of bytes written to Out,
+// which must hold REWIND_MAX_FRAME_SIZE.
+static u32
+EncodeRewindFrame(u8 const* State, u8 const* Previous, u32 StateSize, u8* Out)
+{
+    auto GetDelta = [=](u32 Index) -> u8 { return Previous ? (u8)(State[Index] ^ Previous[Index]) : State[Index]; };
+
+    u8* At = Out;
+    u32 Index = 0;
+    while (Index < StateSize)
+    {
+        u32 SkipStart = Index;
+        while (Index < StateSize && GetDelta(Index) == 0)
+            ++Index;
+
+        // A few 0 bytes in between are cheaper than starting a new pair.
+        u32 LiteralStart = Index;
+        u32 NumTrailingZeros = 0;
+        while (Index < StateSize && NumTrailingZeros < 3)
+        {
+            NumTrailingZeros = GetDelta(Index) ? 0 : NumTrailingZeros + 1;
+            ++Index;
+        }
+        Index -= NumTrailingZeros;
+
+        At = WriteVarint(At, LiteralStart - SkipStart);
+        At = WriteVarint(At, Index - LiteralStart);
+        for (u32 LiteralIndex = LiteralStart; LiteralIndex < Index; ++LiteralIndex)
+            *At++ = GetDelta(LiteralIndex);
+    }
+
+    u32 Result = (u32)(At - Out);
+    MTB_ASSERT(Result <= REWIND_MAX_FRAME_SIZE);
+    return Result;
+}
+
+// XORs an encoded frame into State. Returns the number of state bytes the frame
+// covers, or 0 if it is malformed or doesn't fit into StateSize. State may be
+// partially modified then.
+static u32
+ApplyRewindFrame(u8* State, u32 StateSize, u8 const* Encoded, u32 EncodedSize)
+{
+    u8 const* At = Encoded;
+    u8 const* End = Encoded + EncodedSize;
+    u32 Index = 0;
+    while (At < End)
+    {
+        u32 NumSkipped, NumLiterals;
+        At = ReadVarint(At, End, &NumSkipped);
+        At = At ? ReadVarint(At, End, &NumLiterals) : nullptr;
+        if (!At || NumSkipped > StateSize - Index)
+            return 0;
+
+        Index += NumSkipped;
+        if (NumLiterals > StateSize - Index || NumLiterals > (u32)(End - At))
+            return 0;
+
+        for (u32 LiteralIndex = 0; LiteralIndex < NumLiterals; ++LiteralIndex)
+            State[Index++] ^= *At++;
+    }
+
+    return Index;
+}
+
+static u32
+GetRewindStateSize(machine const* M)
+{
+    u32 Result = (u32)offsetof(machine, DecodeCache);
+    if (M->XOChip)
+        Result += (u32)sizeof(xochip_state);
+
+    return Result;
+}
+
+static void
+CopyStateFromMachine(machine const* M, u8* State)
+{
+    mtb::CopyBytes(State, M, offsetof(machine, DecodeCache));
+    if (M->XOChip)
+        mtb::CopyBytes(State + offsetof(machine, DecodeCache), M->XOChip, sizeof(xochip_state));
+}
+
+static void
+CopyStateToMachine(machine* M, u8 const* State)
+{
+    RestoreRegisters(M, State);
+
+    for (u32 PageIndex = 0; PageIndex < sizeof(M->Memory) / MEMORY_PAGE_SIZE; ++PageIndex)
+        RestoreMemoryPage(M, PageIndex, State + offsetof(machine, Memory) + PageIndex * MEMORY_PAGE_SIZE);
+
+    size_t RestOffset = offsetof(machine, Memory) + sizeof(M->Memory);
+    mtb::CopyBytes((u8*)M + RestOffset, State + RestOffset, offsetof(machine, DecodeCache) - RestOffset);
+
+    if (M->XOChip)
+        mtb::CopyBytes(M->XOChip, State + offsetof(machine, DecodeCache), sizeof(xochip_state));
+
+    // Snapshots can't rely on the written pages anymore, see `SnapshotMachine`.
+    M->WrittenPages = ~0ull;
+}
+
+// Index 0 is the oldest frame.
+static rewind_frame*
+GetRewindFrame(rewind_buffer* Rewind, u32 Index)
+{
+    return Rewind->Frames + (Rewind->FirstFrame + Index) % REWIND_MAX_FRAMES;
+}
+
+static void
+DropOldestRewindFrame(rewind_buffer* Rewind)
+{
+    Rewind->FirstFrame = (Rewind->FirstFrame + 1) % REWIND_MAX_FRAMES;
+    --Rewind->NumFrames;
+}
+
+// Returns where the frame goes in Rewind->Data, dropping the oldest frames
+// that are in the way. Frames are stored in the order they were recorded, so
+// the oldest frame is always the next one after Rewind->DataUsed.
+static u32
+AllocateRewindFrame(rewind_buffer* Rewind, u32 Size)
+{
+    u32 Offset = Rewind->DataUsed;
+    if (Offset + Size > Rewind->DataSize)
+    {
+        while (Rewind->NumFrames > 0 && GetRewindFrame(Rewind, 0)->Offset >= Offset)
+            DropOldestRewindFrame(Rewind);
+        Offset = 0;
+    }
+
+    while (Rewind->NumFrames > 0)
+    {
+        rewind_frame* Oldest = GetRewindFrame(Rewind, 0);
+        bool IsInTheWay = Oldest->Offset < Offset + Size && Offset < Oldest->Offset + Oldest->Size;
+        if (!IsInTheWay && Rewind->NumFrames < REWIND_MAX_FRAMES)
+            break;
+
+        DropOldestRewindFrame(Rewind);
+    }
+
+    // Frames can only be decoded starting from a keyframe.
+    while (Rewind->NumFrames > 0 && !GetRewindFrame(Rewind, 0)->IsKeyframe)
+        DropOldestRewindFrame(Rewind);
+
+    Rewind->DataUsed = Offset + Size;
+    return Offset;
+}
+
+// Decodes the frame at Index into State. Returns the number of frames since the last keyframe.
+static u32
+DecodeRewindFrame(rewind_buffer* Rewind, u32 Index, u8* State)
+{
+    u32 KeyframeIndex = Index;
+    while (!GetRewindFrame(Rewind, KeyframeIndex)->IsKeyframe)
+    {
+        MTB_ASSERT(KeyframeIndex > 0);
+        --KeyframeIndex;
+    }
+
+    mtb::SetZero(State, REWIND_MAX_STATE_SIZE);
+    for (u32 FrameIndex = KeyframeIndex; FrameIndex <= Index; ++FrameIndex)
+    {
+        rewind_frame* Frame = GetRewindFrame(Rewind, FrameIndex);
+        u32 DecodedSize = ApplyRewindFrame(State, REWIND_MAX_STATE_SIZE, Rewind->Data + Frame->Offset, Frame->Size);
+        MTB_ASSERT(DecodedSize > 0);
+    }
+
+    return Index - KeyframeIndex;
+}
+
+void
+InitRewindBuffer(rewind_buffer* Rewind, u8* Data, u32 DataSize, u32 KeyframeInterval)
+{
+    Rewind->Data = Data;
+    Rewind->DataSize = DataSize;
+    Rewind->DataUsed = 0;
+    Rewind->FirstFrame = 0;
+    Rewind->NumFrames = 0;
+    Rewind->KeyframeInterval = KeyframeInterval ? KeyframeInterval : 1;
+    Rewind->FramesSinceKeyframe = 0;
+    Rewind->StateSize = 0;
+}
+
+bool
+RecordRewindFrame(rewind_buffer* Rewind, machine* M)
+{
+    u32 StateSize = GetRewindStateSize(M);
+    CopyStateFromMachine(M, Rewind->Scratch);
+
+    bool IsKeyframe = Rewind->NumFrames == 0 || StateSize != Rewind->StateSize ||
+                      Rewind->FramesSinceKeyframe + 1 >= Rewind->KeyframeInterval;
+    u32 Size = EncodeRewindFrame(Rewind->Scratch, IsKeyframe ? nullptr : Rewind->State, StateSize, Rewind->Encoded);
+    if (Size > Rewind->DataSize)
+        return false;
+
+    u32 Offset = AllocateRewindFrame(Rewind, Size);
+    if (!IsKeyframe && Rewind->NumFrames == 0)
+    {
+        // Making room dropped the keyframe this frame is based on.
+        IsKeyframe = true;
+        Size = EncodeRewindFrame(Rewind->Scratch, nullptr, StateSize, Rewind->Encoded);
+        if (Size > Rewind->DataSize)
+            return false;
+
+        Rewind->DataUsed = 0;
+        Offset = AllocateRewindFrame(Rewind, Size);
+    }
+
+    mtb::CopyBytes(Rewind->Data + Offset, Rewind->Encoded, Size);
+    rewind_frame* Frame = GetRewindFrame(Rewind, Rewind->NumFrames++);
+    Frame->Offset = Offset;
+    Frame->Size = Size;
+    Frame->IsKeyframe = IsKeyframe;
+
+    Rewind->FramesSinceKeyframe = IsKeyframe ? 0 : Rewind->FramesSinceKeyframe + 1;
+    Rewind->StateSize = StateSize;
+    mtb::CopyBytes(Rewind->State, Rewind->Scratch, StateSize);
+
+    return true;
+}
+
+bool
+RestoreRewindFrame(rewind_buffer* Rewind, machine* M, u32 FramesBack)
+{
+    bool Result = false;
+    if (FramesBack < Rewind->NumFrames)
+    {
+        DecodeRewindFrame(Rewind, Rewind->NumFrames - 1 - FramesBack, Rewind->Scratch);
+        CopyStateToMachine(M, Rewind->Scratch);
+        Result = true;
+    }
+
+    return Result;
+}
+
+void
+DiscardRewindFrames(rewind_buffer* Rewind, u32 NumFrames)
+{
+    Rewind->NumFrames -= NumFrames < Rewind->NumFrames ? NumFrames : Rewind->NumFrames;
+    if (Rewind->NumFrames > 0)
+    {
+        rewind_frame* Newest = GetRewindFrame(Rewind, Rewind->NumFrames - 1);
+        Rewind->DataUsed = Newest->Offset + Newest->Size;
+        Rewind->FramesSinceKeyframe = DecodeRewindFrame(Rewind, Rewind->NumFrames - 1, Rewind->State);
+    }
+    else
+    {
+        Rewind->DataUsed = 0;
+        Rewind->FramesSinceKeyframe = 0;
+    }
+}
@@ -1,8 +1,17 @@
+// Regenerate with `couscousc -recompile roms/zophar.net/MAZE cpp/src/generated/recompiled_maze.cpp`
+// from the repository root whenever the recompiler changes. In its own namespace so hosts can still
+// include the ROM they recompiled.
+namespace recompiled_maze
+{
+#include "generated/recompiled_maze.cpp"
+}
+
 
+// Up to the last member, the padding after it may not be initialized.
 static bool
 operator==(machine const& A, machine const& B)
 {
-  return mtb::CompareBytes(&A, &B, sizeof(machine)) == 0;
+  return mtb::CompareBytes(&A, &B, offsetof(machine, EngineHandler) + sizeof(machine::EngineHandler)) == 0;
 }
 
 static bool
@@ -11,6 +20,13 @@ operator!=(machine const& A, machine const& B)
   return !(A == B);
 }
 
+// Ignores caches like `machine::DecodeCache`.
+static bool
+HasSameState(machine const& A, machine const& B)
+{
+  return mtb::CompareBytes(&A, &B, offsetof(machine, DecodeCache)) == 0;
+}
+
 
 //
 // ===============================================
@@ -42,6 +58,13 @@ RunTests()
 
     instruction Inst{ instruction_type::CLS };
     ExecuteInstruction(A, Inst);
+    MTB_ASSERT( *A != *B );
+    B->DisplayGeneration = 1;
+    B->DirtyRows = 0b1;
+    MTB_ASSERT( *A == *B );
+
+    // Nothing to clear, nothing changes.
+    ExecuteInstruction(A, Inst);
     MTB_ASSERT( *A == *B );
 
     Inst = INST2(LD, V, 0, CONSTANT, 42);
@@ -55,6 +78,717 @@ RunTests()
     B->I = 512;
     MTB_ASSERT( *A == *B );
   }
+
+  // Sprites wrap around the screen edges.
+  {
+    *A = {};
+    u8 const Sprite[]{ 0xFF, 0x81 };
+    DrawSprite(A, 60, 31, sprite{ 2, (u8*)Sprite });
+    MTB_ASSERT( A->Screen[31] == 0xF00000000000000F && A->Screen[0] == 0x1000000000000008 );
+    MTB_ASSERT( IsPixelSet(A->Screen, 60, 0) && IsPixelSet(A->Screen, 3, 0) && !IsPixelSet(A->Screen, 0, 0) );
+    MTB_ASSERT( A->V[0xF] == 0 );
+
+    MTB_ASSERT( A->DisplayGeneration == 1 && TakeDirtyRows(A) == 0x8000'0001 && A->DirtyRows == 0 );
+
+    DrawSprite(A, 124, 63, sprite{ 2, (u8*)Sprite });
+    MTB_ASSERT( A->Screen[31] == 0 && A->Screen[0] == 0 );
+    MTB_ASSERT( A->V[0xF] == 1 );
+    MTB_ASSERT( A->DisplayGeneration == 2 && A->DirtyRows == 0x8000'0001 );
+  }
+
+  // SUPER-CHIP high resolution: 16x16 sprites across both halves of a row, and scrolling.
+  {
+    *A = {};
+    A->ProgramCounter = 0x200;
+    A->I = 0x300;
+    A->V[0x0] = 120;
+    A->V[0x1] = 60;
+    A->Memory[0x300] = 0xFF;
+    A->Memory[0x301] = 0x01;
+    WriteWord(A->Memory + 0x200, 0x00FF); // HIGH
+    WriteWord(A->Memory + 0x202, 0xD010); // DRW V0, V1, 0
+    WriteWord(A->Memory + 0x204, 0x00FB); // SCR
+    WriteWord(A->Memory + 0x206, 0x00C2); // SCD 2
+    WriteWord(A->Memory + 0x208, 0x00FD); // EXIT
+    RunCycles(A, 2, stop_reason::NONE);
+    MTB_ASSERT( A->IsHighResolution && GetScreenWidth(A) == 128 && TakeDirtyRows(A) == ~0ull );
+    MTB_ASSERT( A->HighResScreen[60][0] == 0x0100'0000'0000'0000 && A->HighResScreen[60][1] == 0xFF );
+    MTB_ASSERT( IsPixelSet(A, 7, 60) && IsPixelSet(A, 120, 60) && !IsPixelSet(A, 8, 60) && A->V[0xF] == 0 );
+
+    RunCycles(A, 1, stop_reason::NONE);
+    MTB_ASSERT( A->HighResScreen[60][0] == 0x0010'0000'0000'0000 && A->HighResScreen[60][1] == 0x0F );
+    MTB_ASSERT( TakeDirtyRows(A) == 1ull << 60 );
+
+    RunCycles(A, 1, stop_reason::NONE);
+    MTB_ASSERT( A->HighResScreen[60][0] == 0 && A->HighResScreen[62][0] == 0x0010'0000'0000'0000 );
+    MTB_ASSERT( TakeDirtyRows(A) == 0x5000'0000'0000'0000 );
+
+    // EXIT loops on itself.
+    RunCycles(A, 10, stop_reason::NONE);
+    MTB_ASSERT( A->ProgramCounter == 0x208 && A->CurrentCycle == 14 );
+  }
+
+  // Self-modifying code must not execute stale decoded instructions.
+  {
+    *A = {};
+    A->ProgramCounter = 0x200;
+    WriteWord(A->Memory + 0x200, 0x6001); // LD V0, 0x01
+    Tick(A);
+    MTB_ASSERT( A->V[0x0] == 0x01 );
+
+    // Overwrite the instruction at 0x200 with LD V0, 0x02 via LD [I], Vx.
+    A->V[0x0] = 0x60;
+    A->V[0x1] = 0x02;
+    A->I = 0x200;
+    ExecuteInstruction(A, INST2(LD, ATI,, V, 2));
+
+    A->ProgramCounter = 0x200;
+    Tick(A);
+    MTB_ASSERT( A->V[0x0] == 0x02 );
+
+    // Stores mark the 64 byte pages they touch, also across a page boundary.
+    MTB_ASSERT( TakeWrittenPages(A) == 1ull << 8 && A->WrittenPages == 0 );
+    A->I = 0x23F;
+    ExecuteInstruction(A, INST2(LD, B,, V, 0));
+    MTB_ASSERT( TakeWrittenPages(A) == 0b11ull << 8 );
+    A->I = 0xFFF;
+    ExecuteInstruction(A, INST2(LD, ATI,, V, 2));
+    MTB_ASSERT( TakeWrittenPages(A) == (1ull << 63 | 1ull) );
+  }
+
+  // Running off the end of memory stops at an invalid instruction instead of executing what follows it.
+  {
+    *A = {};
+    for (u64& Row : A->Screen)
+      Row = 0x0170'0170'0170'0170; // ADD V0, 0x01 when read as code.
+    A->ProgramCounter = 0xFFE;
+    WriteWord(A->Memory + 0xFFE, 0x6010); // LD V0, 0x10
+    MTB_ASSERT( RunCycles(A, 10, stop_reason::NONE) == stop_reason::InvalidOpcode );
+    MTB_ASSERT( A->ProgramCounter == 0x1000 && A->V[0x0] == 0x10 && A->CurrentCycle == 1 );
+
+    A->ProgramCounter = 0x200;
+    WriteWord(A->Memory + 0x200, 0xBFFE); // JP V0, 0xFFE
+    MTB_ASSERT( RunCycles(A, 10, stop_reason::NONE) == stop_reason::InvalidOpcode );
+    MTB_ASSERT( A->ProgramCounter == 0x100E && A->V[0x0] == 0x10 && A->CurrentCycle == 2 );
+    MTB_ASSERT( FetchMicroOp(A, 0xFFF).Form == OP_INVALID && FetchMicroOp(A, 0x100E).Form == OP_INVALID );
+  }
+
+  // The opcode table must agree with `DecodeInstruction` and `InstructionSignatures` on every opcode.
+  for (u32 Opcode = 0; Opcode <= 0xFFFF; ++Opcode)
+  {
+    instruction_decoder Decoder;
+    Decoder.Data = (u16)Opcode;
+    micro_op Op = DecodeMicroOp(Decoder);
+    instruction Instruction = DecodeInstruction(Decoder);
+    MTB_ASSERT( (Op.Form == OP_INVALID) == (Instruction.Type == instruction_type::INVALID) );
+    if (Op.Form != OP_INVALID)
+    {
+      instruction_signature* Signature = FindSignature(Instruction);
+      MTB_ASSERT( Signature && Signature->Form == (opcode_form)Op.Form );
+    }
+  }
+
+#if COUSCOUS_JIT
+  jit_cache Jit;
+  MTB_ASSERT( InitJit(&Jit) );
+  Jit.HotThreshold = 1; // Compile every block right away.
+#endif
+
+  // The threaded engine and the JIT must behave exactly like `ExecuteInstruction`, with all quirks.
+  for (u32 Quirks = 0; Quirks <= (u32)quirk_flags::ALL; ++Quirks)
+  {
+    u8 const LowBytes[]{ 0x00, 0x07, 0x0A, 0x0E, 0x15, 0x18, 0x1E, 0x29, 0x33, 0x55, 0x65, 0x9E, 0xA1, 0xE0, 0xEE, 0x5C,
+                         0xC3, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF, 0x30, 0x75, 0x85, 0xD3, 0x01, 0x02, 0x3A };
+    u8 const XYs[]{ 0x0, 0x3, 0xA, 0xF };
+
+    machine Base{};
+    Base.RNG = mtb::tRNG::Seed(1337);
+    for (int Index = 0; Index < MTB_ARRAY_COUNT(Base.V); ++Index)
+      Base.V[Index] = (u8)(Index * 37 + 11);
+    for (int Index = 0; Index < MTB_ARRAY_COUNT(Base.Memory); ++Index)
+      Base.Memory[Index] = (u8)(Index * 13);
+    Base.I = 0x321;
+    Base.DT = 7;
+    Base.StackPointer = 3;
+    Base.InputState = 0b1000'0100'0000'1001;
+    SetQuirks(&Base, (quirk_flags)Quirks);
+    WriteWord(Base.Memory + 0x402, 0x0000); // Invalid, so blocks at 0x400 consist of a single instruction.
+
+    for (u16 Group = 0x0; Group <= 0xF; ++Group)
+    for (u8 X : XYs)
+    for (u8 LowByte : LowBytes)
+    {
+      instruction_decoder Decoder;
+      Decoder.Group = Group;
+      Decoder.X = X;
+      Decoder.LSB = LowByte | (Group == 0x8 || Group == 0xD ? (u8)(X << 4) : 0);
+
+      opcode_form Form = GetOpcodeForm(Decoder.Data);
+      instruction Instruction = DecodeInstruction(Decoder);
+      MTB_ASSERT( (Form == OP_INVALID) == (Instruction.Type == instruction_type::INVALID) );
+      if (Form == OP_INVALID || Form == OP_0nnn)
+        continue;
+
+      *A = Base;
+      *B = Base;
+      WriteWord(A->Memory + 0x400, Decoder.Data);
+      WriteWord(B->Memory + 0x400, Decoder.Data);
+      A->ProgramCounter = B->ProgramCounter = 0x400;
+
+      A->ProgramCounter += 2;
+      ExecuteInstruction(A, Instruction);
+      MTB_ASSERT( ExecuteThreaded(B, 1) == 1 );
+      MTB_ASSERT( HasSameState(*A, *B) );
+
+#if COUSCOUS_JIT
+      *B = Base;
+      WriteWord(B->Memory + 0x400, Decoder.Data);
+      B->ProgramCounter = 0x400;
+      MTB_ASSERT( ExecuteJit(B, &Jit, 1) == 1 );
+      MTB_ASSERT( HasSameState(*A, *B) );
+#endif
+    }
+  }
+
+  // XO-CHIP: long loads, skipping over them, memory beyond 4 KB, and drawing to two planes.
+  {
+    static xochip_state XOChipStates[3];
+    machine MachineC;
+    machine* C = &MachineC;
+    machine* Machines[]{ A, B, C };
+    for (int Index = 0; Index < 3; ++Index)
+    {
+      machine* M = Machines[Index];
+      *M = {};
+      XOChipStates[Index] = {};
+      EnableXOChip(M, XOChipStates + Index);
+      M->ProgramCounter = 0x200;
+      WriteWord(M->Memory + 0x200, 0xF000); // LD I, LONG
+      WriteWord(M->Memory + 0x202, 0x1234);
+      WriteWord(M->Memory + 0x204, 0x6005); // LD V0, 0x05
+      WriteWord(M->Memory + 0x206, 0x6107); // LD V1, 0x07
+      WriteWord(M->Memory + 0x208, 0x5012); // LD [I], V0, V1
+      WriteWord(M->Memory + 0x20A, 0x5233); // LD V2, V3, [I]
+      WriteWord(M->Memory + 0x20C, 0x3205); // SE V2, 0x05
+      WriteWord(M->Memory + 0x20E, 0xF000); // LD I, LONG, skipped along with its address.
+      WriteWord(M->Memory + 0x210, 0x0000);
+      WriteWord(M->Memory + 0x212, 0xF301); // PLANE 3
+      WriteWord(M->Memory + 0x214, 0xD011); // DRW V0, V1, 1
+      WriteWord(M->Memory + 0x216, 0x00D1); // SCU 1
+      WriteWord(M->Memory + 0x218, 0x00FD); // EXIT
+    }
+
+    MTB_ASSERT( ExecuteThreaded(A, 20) == 20 );
+    MTB_ASSERT( ExecuteBlocks(B, 20) == 20 );
+    MTB_ASSERT( A->I == 0x1234 && A->V[0x2] == 0x05 && A->V[0x3] == 0x07 && A->ProgramCounter == 0x218 );
+    MTB_ASSERT( XOChipStates[0].ExtendedMemory[0x234] == 0x05 && XOChipStates[0].ExtendedMemory[0x235] == 0x07 );
+    MTB_ASSERT( GetPixelColorIndex(A, 10, 6) == 0b11 && GetPixelColorIndex(A, 11, 6) == 0b10 && GetPixelColorIndex(A, 12, 6) == 0b11 );
+    MTB_ASSERT( GetPixelColorIndex(A, 10, 7) == 0 && IsPixelSet(A, 10, 6) && !IsPixelSet(A, 11, 6) );
+
+#if COUSCOUS_JIT
+    MTB_ASSERT( ExecuteJit(C, &Jit, 20) == 20 );
+#else
+    MTB_ASSERT( ExecuteThreaded(C, 20) == 20 );
+#endif
+
+    for (int Index = 1; Index < 3; ++Index)
+    {
+      machine* M = Machines[Index];
+      MTB_ASSERT( mtb::BytesAreEqual(XOChipStates + 0, XOChipStates + Index, sizeof(xochip_state)) );
+      M->XOChip = A->XOChip;
+      MTB_ASSERT( HasSameState(*A, *M) );
+    }
+  }
+
+  // Fused ops, including a jump into the middle of a fused pair and a skip over a jump.
+  {
+    *A = {};
+    A->V[0x1] = 2;
+    A->ProgramCounter = 0x200;
+    WriteWord(A->Memory + 0x200, 0x6003); // LD V0, 0x03
+    WriteWord(A->Memory + 0x202, 0x70FF); // ADD V0, 0xFF
+    WriteWord(A->Memory + 0x204, 0x3000); // SE V0, 0x00
+    WriteWord(A->Memory + 0x206, 0x1202); // JP 0x202
+    WriteWord(A->Memory + 0x208, 0xA210); // LD I, 0x210
+    WriteWord(A->Memory + 0x20A, 0xD015); // DRW V0, V1, 5
+    WriteWord(A->Memory + 0x20C, 0x120C); // JP 0x20C
+    *B = *A;
+
+    for (u64 NumInstructions = 1; NumInstructions < 8; ++NumInstructions)
+    {
+      MTB_ASSERT( ExecuteThreaded(A, NumInstructions) == NumInstructions );
+      MTB_ASSERT( ExecuteBlocks(B, NumInstructions) == NumInstructions );
+      MTB_ASSERT( HasSameState(*A, *B) );
+    }
+  }
+
+  // Quirks change what the same instructions do.
+  {
+    *A = {};
+    A->V[0x1] = 0b110;
+    A->V[0x2] = 0b011;
+    SetQuirks(A, quirk_flags::ShiftReadsVx | quirk_flags::JumpOffsetFromVx);
+    A->ProgramCounter = 0x200;
+    WriteWord(A->Memory + 0x200, 0x8126); // SHR V1, V2
+    WriteWord(A->Memory + 0x202, 0xB130); // JP V0, 0x130, but with V1
+    MTB_ASSERT( ExecuteBlocks(A, 2) == 2 );
+    MTB_ASSERT( A->V[0x1] == 0b011 && A->V[0x2] == 0b011 && A->V[0xF] == 0 );
+    MTB_ASSERT( A->ProgramCounter == 0x133 );
+  }
+
+  // No engine executes anything while waiting for a key.
+  {
+    *A = {};
+    A->ProgramCounter = 0x200;
+    WriteWord(A->Memory + 0x200, 0xF10A); // LD V1, K
+    WriteWord(A->Memory + 0x202, 0x7001); // ADD V0, 0x01
+    WriteWord(A->Memory + 0x204, 0x1202); // JP 0x202
+    MTB_ASSERT( ExecuteSwitch(A, 10) == 1 && A->RequiredInputRegisterIndexPlusOne == 2 );
+    *B = *A;
+
+    MTB_ASSERT( ExecuteSwitch(A, 10) == 0 && ExecuteThreaded(A, 10) == 0 && ExecuteBlocks(A, 10) == 0 );
+#if COUSCOUS_JIT
+    MTB_ASSERT( ExecuteJit(A, &Jit, 10) == 0 );
+#endif
+    MTB_ASSERT( HasSameState(*A, *B) );
+
+    SetInputState(A, 1 << 0x7);
+    MTB_ASSERT( A->V[0x1] == 0x7 && ExecuteThreaded(A, 10) == 10 && A->V[0x0] == 5 );
+  }
+
+  // Recompiled ROMs run exactly like `ExecuteThreaded`, also after their code was modified.
+  for (u32 Quirks = 0; Quirks <= (u32)quirk_flags::ALL; ++Quirks)
+  {
+    *A = {};
+    SetQuirks(A, (quirk_flags)Quirks);
+    A->RNG = mtb::tRNG::Seed(Quirks + 1);
+    A->ProgramCounter = 0x200;
+    WriteMemory(A, 0x200, sizeof(recompiled_maze::RecompiledRom), recompiled_maze::RecompiledRom);
+    *B = *A;
+
+    for (u64 NumInstructions = 1; NumInstructions < 40; ++NumInstructions)
+    {
+      MTB_ASSERT( ExecuteThreaded(A, NumInstructions) == NumInstructions );
+      MTB_ASSERT( recompiled_maze::ExecuteRecompiled(B, NumInstructions) == NumInstructions );
+      MTB_ASSERT( HasSameState(*A, *B) );
+    }
+
+    u8 const Modified[]{ 0x71, 0x08 }; // ADD V1, 0x08 instead of 0x04
+    WriteMemory(A, 0x212, sizeof(Modified), Modified);
+    WriteMemory(B, 0x212, sizeof(Modified), Modified);
+    for (u64 NumInstructions = 1; NumInstructions < 40; ++NumInstructions)
+    {
+      MTB_ASSERT( ExecuteThreaded(A, NumInstructions) == NumInstructions );
+      MTB_ASSERT( recompiled_maze::ExecuteRecompiled(B, NumInstructions) == NumInstructions );
+      MTB_ASSERT( HasSameState(*A, *B) );
+    }
+    MTB_ASSERT( A->ProgramCounter == 0x218 );
+  }
+
+  // Stop reasons of `RunCycles`.
+  {
+    *A = {};
+    A->ProgramCounter = 0x200;
+    WriteWord(A->Memory + 0x200, 0x6005); // LD V0, 0x05
+    WriteWord(A->Memory + 0x202, 0xF10A); // LD V1, K
+    WriteWord(A->Memory + 0x204, 0xD005); // DRW V0, V0, 5
+    WriteWord(A->Memory + 0x206, 0x7001); // ADD V0, 0x01
+    WriteWord(A->Memory + 0x208, 0x0000); // Invalid
+    A->Memory[0x000] = 0x80; // The sprite drawn by DRW.
+
+    MTB_ASSERT( RunCycles(A, 1, stop_reason::ALL) == stop_reason::CycleBudget );
+    MTB_ASSERT( RunCycles(A, 100, stop_reason::NONE) == stop_reason::WaitingForKey );
+    MTB_ASSERT( A->ProgramCounter == 0x204 && A->CurrentCycle == 2 );
+    MTB_ASSERT( RunCycles(A, 100, stop_reason::NONE) == stop_reason::WaitingForKey );
+    MTB_ASSERT( A->CurrentCycle == 2 );
+
+    A->RequiredInputRegisterIndexPlusOne = 0;
+    SetBreakpoint(A, 0x206, true);
+    MTB_ASSERT( RunCycles(A, 100, stop_reason::Breakpoint) == stop_reason::Breakpoint );
+    MTB_ASSERT( A->ProgramCounter == 0x206 );
+    MTB_ASSERT( RunCycles(A, 100, stop_reason::ALL) == stop_reason::InvalidOpcode );
+    MTB_ASSERT( A->ProgramCounter == 0x208 && A->CurrentCycle == 4 );
+    SetBreakpoint(A, 0x206, false);
+    MTB_ASSERT( A->NumBreakpoints == 0 );
+
+    A->ProgramCounter = 0x204;
+    MTB_ASSERT( RunCycles(A, 100, stop_reason::ScreenChanged) == stop_reason::ScreenChanged );
+    MTB_ASSERT( A->ProgramCounter == 0x206 );
+  }
+
+  // Skipped idle loops must end up exactly where interpreting them would.
+  for (u64 NumInstructions = 1000000; NumInstructions < 1000003; ++NumInstructions)
+  {
+    *A = {};
+    A->DT = 5;
+    A->ProgramCounter = 0x200;
+    WriteWord(A->Memory + 0x200, 0x6107); // LD V1, 0x07
+    WriteWord(A->Memory + 0x202, 0xF007); // LD V0, DT
+    WriteWord(A->Memory + 0x204, 0x3000); // SE V0, 0x00
+    WriteWord(A->Memory + 0x206, 0x1202); // JP 0x202
+    *B = *A;
+
+    MTB_ASSERT( RunCycles(A, NumInstructions, stop_reason::NONE) == stop_reason::CycleBudget );
+    MTB_ASSERT( ExecuteThreaded(B, NumInstructions) == NumInstructions );
+    B->CurrentCycle = NumInstructions;
+    MTB_ASSERT( HasSameState(*A, *B) );
+  }
+
+  // DT and ST count down every InstructionsPerSecond / 60 cycles, also while waiting for a key.
+  {
+    *A = {};
+    A->InstructionsPerSecond = 600;
+    A->DT = 3;
+    A->ST = 1;
+    A->ProgramCounter = 0x200;
+    WriteWord(A->Memory + 0x200, 0xF007); // LD V0, DT
+    WriteWord(A->Memory + 0x202, 0x3000); // SE V0, 0x00
+    WriteWord(A->Memory + 0x204, 0x1200); // JP 0x200
+    WriteWord(A->Memory + 0x206, 0xF10A); // LD V1, K
+
+    MTB_ASSERT( GetNextTimerCycle(A) == 10 );
+    MTB_ASSERT( RunCycles(A, 9, stop_reason::NONE) == stop_reason::CycleBudget );
+    MTB_ASSERT( A->DT == 3 && A->ST == 1 );
+    MTB_ASSERT( RunCycles(A, 1, stop_reason::NONE) == stop_reason::CycleBudget );
+    MTB_ASSERT( A->DT == 2 && A->ST == 0 );
+    MTB_ASSERT( RunCycles(A, 1000, stop_reason::NONE) == stop_reason::WaitingForKey );
+    MTB_ASSERT( A->DT == 0 && A->ProgramCounter == 0x208 && A->CurrentCycle == 33 );
+
+    A->DT = 2;
+    MTB_ASSERT( RunCycles(A, 100, stop_reason::NONE) == (stop_reason::WaitingForKey | stop_reason::CycleBudget) );
+    MTB_ASSERT( A->DT == 0 && A->CurrentCycle == 133 );
+  }
+
+  // Snapshots only copy the pages that changed and restore the exact state, without stale decoded instructions.
+  {
+    static snapshot_pool Pool;
+    InitSnapshotPool(&Pool);
+
+    *A = {};
+    A->ProgramCounter = 0x200;
+    WriteWord(A->Memory + 0x200, 0x6001); // LD V0, 0x01
+    machine_snapshot First;
+    MTB_ASSERT( SnapshotMachine(&Pool, A, &First) );
+    u32 NumFreePages = Pool.NumFreePages;
+    *B = *A;
+
+    // Overwrite the instruction at 0x200 with LD V0, 0x02, which changes a single page.
+    Tick(A);
+    A->V[0x0] = 0x60;
+    A->V[0x1] = 0x02;
+    A->I = 0x200;
+    ExecuteInstruction(A, INST2(LD, ATI,, V, 2));
+    machine_snapshot Second;
+    MTB_ASSERT( SnapshotMachine(&Pool, A, &Second) );
+    MTB_ASSERT( NumFreePages - Pool.NumFreePages == 2 ); // The page and the table pointing to it.
+
+    RestoreMachine(&Pool, A, &First);
+    MTB_ASSERT( HasSameState(*A, *B) );
+    Tick(A);
+    MTB_ASSERT( A->V[0x0] == 0x01 );
+
+    RestoreMachine(&Pool, A, &Second);
+    A->ProgramCounter = 0x200;
+    Tick(A);
+    MTB_ASSERT( A->V[0x0] == 0x02 );
+
+    // Only the pool's reference to the latest snapshot is left.
+    ReleaseSnapshot(&Pool, &First);
+    ReleaseSnapshot(&Pool, &Second);
+    MTB_ASSERT( Pool.NumFreePages == NumFreePages );
+  }
+
+  // Rewinding restores recorded frames, also after the oldest ones were dropped to make room.
+  {
+    static u8 RewindData[1024];
+    static rewind_buffer Rewind;
+    InitRewindBuffer(&Rewind, RewindData, sizeof(RewindData), 4);
+
+    *A = {};
+    A->ProgramCounter = 0x200;
+    A->I = 0x300;
+    WriteWord(A->Memory + 0x200, 0x7001); // ADD V0, 0x01
+    WriteWord(A->Memory + 0x202, 0xF155); // LD [I], V1
+    WriteWord(A->Memory + 0x204, 0x1200); // JP 0x200
+    for (int Frame = 0; Frame < 100; ++Frame)
+    {
+      ExecuteThreaded(A, 3);
+      if (Frame == 90)
+        *B = *A;
+      MTB_ASSERT( RecordRewindFrame(&Rewind, A) );
+    }
+    MTB_ASSERT( Rewind.NumFrames > 10 && Rewind.NumFrames < 100 );
+    MTB_ASSERT( GetRewindFrame(&Rewind, 0)->IsKeyframe );
+
+    // Restoring marks all pages as written since the snapshots can't know what changed.
+    MTB_ASSERT( RestoreRewindFrame(&Rewind, A, 9) );
+    B->WrittenPages = ~0ull;
+    MTB_ASSERT( HasSameState(*A, *B) );
+    MTB_ASSERT( A->Memory[0x300] == 91 );
+
+    // Continue from there.
+    DiscardRewindFrames(&Rewind, 9);
+    ExecuteThreaded(A, 3);
+    *B = *A;
+    MTB_ASSERT( RecordRewindFrame(&Rewind, A) );
+    MTB_ASSERT( RestoreRewindFrame(&Rewind, A, 0) );
+    MTB_ASSERT( HasSameState(*A, *B) && A->Memory[0x300] == 92 );
+  }
+
+  // Playing back a movie ends in the same state as recording it.
+  {
+    static u8 MovieData[256];
+    u8 Rom[]{ 0xC3, 0xFF, 0xE1, 0x9E, 0x72, 0x01, 0x12, 0x00 }; // RND V3, 0xFF; SKP V1; ADD V2, 0x01; JP 0x200
+
+    *A = {};
+    A->V[0x1] = 0x5;
+    A->ProgramCounter = 0x200;
+    A->InstructionsPerSecond = 600;
+    WriteMemory(A, 0x200, sizeof(Rom), Rom);
+    *B = *A;
+
+    movie Movie;
+    BeginMovieRecording(&Movie, MovieData, sizeof(MovieData), A, HashBytes(Rom, sizeof(Rom)), 42, 10);
+    for (int Frame = 0; Frame < 200; ++Frame)
+      MTB_ASSERT( RecordMovieFrame(&Movie, A, (Frame / 30) % 2 ? 1 << 0x5 : 0) );
+    u32 MovieSize = EndMovieRecording(&Movie);
+    MTB_ASSERT( MovieSize < 64 );
+
+    MTB_ASSERT( BeginMoviePlayback(&Movie, MovieData, MovieSize) );
+    MTB_ASSERT( Movie.Header.NumFrames == 200 && Movie.Header.RomHash == HashBytes(Rom, sizeof(Rom)) );
+    StartMovieMachine(&Movie, B);
+    MTB_ASSERT( PlayMovie(&Movie, B) == 200 );
+    MTB_ASSERT( HasSameState(*A, *B) && HashMachineState(A) == HashMachineState(B) );
+    MTB_ASSERT( A->CurrentCycle == 2000 && A->V[0x2] != 0 );
+
+    // Runs whose varints are cut off or too long end the playback.
+    u32 InputSizes[]{ 3, 6 };
+    for (u32 InputSize : InputSizes)
+    {
+      WriteU32LE(MovieData + 44, InputSize);
+      mtb::SetBytes(MovieData + MOVIE_HEADER_SIZE, 0xFF, InputSize);
+      MTB_ASSERT( BeginMoviePlayback(&Movie, MovieData, MOVIE_HEADER_SIZE + InputSize) );
+      MTB_ASSERT( !PlayMovieFrame(&Movie, B) && Movie.Frame == 0 );
+    }
+  }
+
+  // Seeking restores the keyframe before the frame and plays back the rest.
+  // Indexing while playing back gives the same index as while recording.
+  {
+    static u8 MovieData[256];
+    static u8 IndexData[64 * 1024];
+    static u8 PlaybackIndexData[64 * 1024];
+    static movie_index Index;
+    u8 Rom[]{ 0xC3, 0xFF, 0xA3, 0x00, 0xF3, 0x33, 0xE1, 0x9E, 0x72, 0x01, 0x12, 0x00 }; // RND V3, 0xFF; LD I, 0x300; LD B, V3; SKP V1; ADD V2, 0x01; JP 0x200
+
+    *A = {};
+    A->V[0x1] = 0x5;
+    A->ProgramCounter = 0x200;
+    A->InstructionsPerSecond = 600;
+    WriteMemory(A, 0x200, sizeof(Rom), Rom);
+    static machine StartMachine;
+    machine* Start = &StartMachine;
+    *Start = *A;
+
+    movie Movie;
+    BeginMovieRecording(&Movie, MovieData, sizeof(MovieData), A, HashBytes(Rom, sizeof(Rom)), 7, 10);
+    BeginMovieIndex(&Index, IndexData, sizeof(IndexData), 64);
+    for (int Frame = 0; Frame < 500; ++Frame)
+    {
+      if (Frame == 300)
+        *B = *A;
+      MTB_ASSERT( UpdateMovieIndex(&Index, &Movie, A) );
+      MTB_ASSERT( RecordMovieFrame(&Movie, A, (Frame / 45) % 3 ? 1 << 0x5 : 0) );
+    }
+    MTB_ASSERT( UpdateMovieIndex(&Index, &Movie, A) );
+    u32 MovieSize = EndMovieRecording(&Movie);
+    u32 IndexSize = EndMovieIndex(&Index, &Movie);
+    MTB_ASSERT( Index.NumKeyframes == 8 );
+
+    MTB_ASSERT( BeginMoviePlayback(&Movie, MovieData, MovieSize) );
+    MTB_ASSERT( LoadMovieIndex(&Index, IndexData, IndexSize, &Movie) && Index.NumKeyframes == 8 );
+    *A = *Start;
+    MTB_ASSERT( SeekMovie(&Movie, &Index, A, 300) );
+    B->WrittenPages = A->WrittenPages;
+    MTB_ASSERT( HasSameState(*A, *B) );
+
+    // Back and forth, and to the very end.
+    MTB_ASSERT( SeekMovie(&Movie, &Index, A, 5) && SeekMovie(&Movie, &Index, A, 300) );
+    MTB_ASSERT( HasSameState(*A, *B) );
+    MTB_ASSERT( SeekMovie(&Movie, &Index, A, 500) && !PlayMovieFrame(&Movie, A) );
+    MTB_ASSERT( !SeekMovie(&Movie, &Index, A, 501) );
+
+    MTB_ASSERT( BeginMoviePlayback(&Movie, MovieData, MovieSize) );
+    *A = *Start;
+    StartMovieMachine(&Movie, A);
+    BeginMovieIndex(&Index, PlaybackIndexData, sizeof(PlaybackIndexData), 64);
+    do
+    {
+      MTB_ASSERT( UpdateMovieIndex(&Index, &Movie, A) );
+    } while (PlayMovieFrame(&Movie, A));
+    MTB_ASSERT( EndMovieIndex(&Index, &Movie) == IndexSize );
+    MTB_ASSERT( mtb::CompareBytes(IndexData, PlaybackIndexData, IndexSize) == 0 );
+
+    // Keyframes that don't fit M or are corrupt are refused without touching M.
+    static xochip_state XOChip;
+    MTB_ASSERT( LoadMovieIndex(&Index, IndexData, IndexSize, &Movie) );
+    *A = *Start;
+    EnableXOChip(A, &XOChip);
+    *B = *A;
+    MTB_ASSERT( !SeekMovie(&Movie, &Index, A, 300) && *A == *B );
+
+    *A = *Start;
+    *B = *A;
+    mtb::SetBytes(IndexData + Index.KeyframeOffsets[0] + MOVIE_KEYFRAME_HEADER_SIZE, 0xFF, 5);
+    MTB_ASSERT( !SeekMovie(&Movie, &Index, A, 5) && *A == *B );
+    WriteU32LE(IndexData + Index.KeyframeOffsets[1] + 4, ~0u); // RunCursor
+    MTB_ASSERT( !SeekMovie(&Movie, &Index, A, 100) && *A == *B );
+  }
+
+  // Save states restore everything that is emulated and refuse what they can't load.
+  {
+    static u8 SaveState[SAVE_STATE_MAX_SIZE];
+    static xochip_state XOChip;
+
+    *A = {};
+    A->ProgramCounter = 0x200;
+    A->RNG = mtb::tRNG::Seed(3);
+    SetQuirks(A, quirk_flags::JumpOffsetFromVx);
+    WriteWord(A->Memory + 0x200, 0xC0FF); // RND V0, 0xFF
+    WriteWord(A->Memory + 0x202, 0x2200); // CALL 0x200
+    ExecuteThreaded(A, 11);
+    A->ST = 7;
+    A->Screen[3] = 0xF0F0;
+    MTB_ASSERT( A->StackPointer == 5 );
+
+    u32 Size = WriteSaveState(A, SaveState, sizeof(SaveState));
+    MTB_ASSERT( Size == GetSaveStateSize(A) && Size % SAVE_STATE_SECTION_ALIGNMENT == 0 );
+    MTB_ASSERT( WriteSaveState(A, SaveState, Size - 1) == 0 );
+
+    *B = {};
+    B->DisplayGeneration = A->DisplayGeneration - 1;
+    MTB_ASSERT( LoadSaveState(B, SaveState, Size) );
+    MTB_ASSERT( B->DirtyRows == ~0ull && B->WrittenPages == ~0ull );
+    B->DirtyRows = A->DirtyRows;
+    B->WrittenPages = A->WrittenPages;
+    MTB_ASSERT( HasSameState(*A, *B) );
+
+    MTB_ASSERT( !LoadSaveState(B, SaveState, Size - 1) );
+
+    // Registers that would index past the machine are refused without touching it.
+    u8* Registers = SaveState + ReadU32LE(SaveState + SAVE_STATE_HEADER_SIZE + 4); // The first section's offset.
+    size_t const BadRegisters[][2]{
+      { offsetof(save_state_registers, RequiredInputRegisterIndexPlusOne), 17 },
+      { offsetof(save_state_registers, SelectedPlanes), 1 << XOCHIP_MAX_PLANES },
+      { offsetof(save_state_registers, IsHighResolution), 2 },
+      { offsetof(save_state_registers, StackPointer), MTB_ARRAY_COUNT(A->Stack) + 1 },
+    };
+    for (auto& Bad : BadRegisters)
+    {
+      u8 Good = Registers[Bad[0]];
+      Registers[Bad[0]] = (u8)Bad[1];
+      *A = *B;
+      MTB_ASSERT( !LoadSaveState(A, SaveState, Size) && *A == *B );
+      Registers[Bad[0]] = Good;
+    }
+    MTB_ASSERT( LoadSaveState(A, SaveState, Size) );
+
+    EnableXOChip(B, &XOChip);
+    MTB_ASSERT( !LoadSaveState(B, SaveState, Size) );
+    SaveState[4] = SAVE_STATE_VERSION + 1;
+    MTB_ASSERT( !LoadSaveState(A, SaveState, Size) );
+  }
+
+  // Stepping back and reverse continuing end where running forward had been.
+  {
+    static history History;
+    u64 Hits[128];
+    int NumHits = 0;
+    u8 Rom[]{ 0xC3, 0xFF, 0xA3, 0x00, 0xF3, 0x33, 0xE1, 0x9E, 0x72, 0x01, 0x12, 0x00 }; // RND V3, 0xFF; LD I, 0x300; LD B, V3; SKP V1; ADD V2, 0x01; JP 0x200
+
+    *A = {};
+    A->V[0x1] = 0x5;
+    A->ProgramCounter = 0x200;
+    A->InstructionsPerSecond = 600;
+    A->RNG = mtb::tRNG::Seed(5);
+    WriteMemory(A, 0x200, sizeof(Rom), Rom);
+    SetBreakpoint(A, 0x208, true);
+
+    InitHistory(&History, 100);
+    for (int Frame = 0; Frame < 60; ++Frame)
+    {
+      SetInputStateWithHistory(&History, A, (Frame / 7) % 3 ? 1 << 0x5 : 0);
+      if (Frame == 40)
+        *B = *A;
+
+      u64 EndCycle = A->CurrentCycle + 10;
+      while (A->CurrentCycle < EndCycle)
+      {
+        if (IsBreakpoint(A, A->ProgramCounter) && (NumHits == 0 || Hits[NumHits - 1] != A->CurrentCycle))
+          Hits[NumHits++] = A->CurrentCycle;
+        RunCyclesWithHistory(&History, A, EndCycle - A->CurrentCycle, stop_reason::Breakpoint);
+      }
+    }
+    MTB_ASSERT( History.NumSnapshots == 6 && NumHits > 4 && NumHits < MTB_ARRAY_COUNT(Hits) );
+
+    MTB_ASSERT( StepBack(&History, A, 200) == 200 && A->CurrentCycle == 400 );
+    B->WrittenPages = A->WrittenPages;
+    MTB_ASSERT( HasSameState(*A, *B) );
+
+    int HitIndex = NumHits;
+    while (Hits[HitIndex - 1] >= 400)
+      --HitIndex;
+    for (int Step = 0; Step < 2; ++Step)
+    {
+      MTB_ASSERT( ReverseContinue(&History, A) );
+      MTB_ASSERT( A->CurrentCycle == Hits[--HitIndex] && A->ProgramCounter == 0x208 );
+    }
+
+    // Forward again from there and back to the start of the history.
+    RunCyclesWithHistory(&History, A, 350, stop_reason::NONE);
+    SetBreakpoint(A, 0x208, false);
+    MTB_ASSERT( !ReverseContinue(&History, A) && A->CurrentCycle == 0 );
+    MTB_ASSERT( StepBack(&History, A, 1) == 0 && History.NumSnapshots == 1 );
+
+    // A full event ring only drops as many of the oldest snapshots as needed.
+    *A = {};
+    A->V[0x1] = 0x5;
+    A->ProgramCounter = 0x200;
+    A->InstructionsPerSecond = 600;
+    WriteMemory(A, 0x200, sizeof(Rom), Rom);
+    InitHistory(&History, 100);
+    for (int Cycle = 0; Cycle < 5000; ++Cycle)
+    {
+      SetInputStateWithHistory(&History, A, Cycle % 2 ? 1 << 0x5 : 0);
+      if (Cycle == 1500)
+        *B = *A;
+      RunCyclesWithHistory(&History, A, 1, stop_reason::NONE);
+    }
+    MTB_ASSERT( History.NumEvents <= HISTORY_MAX_EVENTS && History.NumSnapshots == 40 );
+    MTB_ASSERT( GetHistorySnapshot(&History, 0)->Cycle == 1000 );
+    MTB_ASSERT( StepBack(&History, A, 3500) == 3500 );
+    B->WrittenPages = A->WrittenPages;
+    MTB_ASSERT( HasSameState(*A, *B) );
+  }
+
+#if COUSCOUS_JIT
+  // Blocks that jump back to their own start keep running natively while the budget allows.
+  {
+    *A = {};
+    A->V[0x1] = 3;
+    A->ProgramCounter = 0x200;
+    WriteWord(A->Memory + 0x200, 0x7001); // ADD V0, 0x01
+    WriteWord(A->Memory + 0x202, 0x8014); // ADD V0, V1
+    WriteWord(A->Memory + 0x204, 0x1200); // JP 0x200
+    *B = *A;
+
+    MTB_ASSERT( ExecuteThreaded(A, 1001) == 1001 );
+    MTB_ASSERT( ExecuteJit(B, &Jit, 1001) == 1001 );
+    MTB_ASSERT( HasSameState(*A, *B) );
+  }
+
+  Deallocate(&Jit);
+#endif
 }
 
 #undef INST3
@@ -5,8 +5,10 @@
 #include "couscous_mtb.h"
 
 #include <stdio.h>
+#include <time.h>
 
 #define COUSCOUSC 1
+#define COUSCOUS_FUSION_STATS 1
 
 using u8 = uint8_t;
 using u16 = uint16_t;
@@ -26,6 +28,12 @@ using bool32 = int;
 #include "couscous.h"
 
 #include "couscous.cpp"
+#include "couscous_jit.cpp"
+#include "couscous_snapshot.cpp"
+#include "couscous_movie.cpp"
+#include "couscous_savestate.cpp"
+#include "couscous_history.cpp"
+#include "charmap.cpp"
 #include "generated/all_generated.cpp"
 
 struct my_parser_context
@@ -149,10 +157,437 @@ OnError(parser_context* BaseContext, parser_error_info* ErrorInfo)
     }
 }
 
+//
+// Recompiler
+//
+
+enum
+{
+    RECOMPILE_BASE_ADDRESS = 0x200,
+};
+
+struct recompiled_rom
+{
+    u8 const* Bytes;
+    int Size;
+
+    // By address.
+    bool IsReachable[4096];
+    bool IsBlockStart[4096];
+};
+
+static bool
+FetchRecompiledOp(recompiled_rom* Rom, int Address, instruction_decoder* OutDecoder, opcode_form* OutForm)
+{
+    bool Result = false;
+    int Offset = Address - RECOMPILE_BASE_ADDRESS;
+    if (Offset >= 0 && Offset + 1 < Rom->Size)
+    {
+        OutDecoder->Data = ReadWord((void*)(Rom->Bytes + Offset));
+        *OutForm = GetOpcodeForm(OutDecoder->Data);
+        Result = *OutForm != OP_INVALID;
+    }
+
+    return Result;
+}
+
+// Walks all statically known control flow, starting at the entry point.
+// Computed jumps (JP V0, addr) are left to the fallback dispatcher.
+static void
+FindReachableCode(recompiled_rom* Rom)
+{
+    u16 Pending[4096];
+    int NumPending = 0;
+
+    auto AddBlockStart = [&](int Address)
+    {
+        if (Address < (int)MTB_ARRAY_COUNT(Rom->IsBlockStart))
+        {
+            Rom->IsBlockStart[Address] = true;
+            if (!Rom->IsReachable[Address])
+            {
+                Rom->IsReachable[Address] = true;
+                Pending[NumPending++] = (u16)Address;
+            }
+        }
+    };
+
+    AddBlockStart(RECOMPILE_BASE_ADDRESS);
+    while (NumPending > 0)
+    {
+        int Address = Pending[--NumPending];
+        while (true)
+        {
+            instruction_decoder Decoder;
+            opcode_form Form;
+            if (!FetchRecompiledOp(Rom, Address, &Decoder, &Form))
+                break;
+
+            int NextAddress = Address + 2;
+            if (EndsCodeBlock(Form))
+            {
+                switch (Form)
+                {
+                    case OP_1nnn: AddBlockStart(Decoder.Address); break;
+                    case OP_2nnn: AddBlockStart(Decoder.Address); AddBlockStart(NextAddress); break;
+                    case OP_3xkk: case OP_4xkk: case OP_5xy0: case OP_9xy0:
+                    case OP_Ex9E: case OP_ExA1:
+                    {
+                        AddBlockStart(NextAddress);
+                        AddBlockStart(NextAddress + 2);
+
+                        // With XO-CHIP, skipping `LD I, LONG` skips both of its words.
+                        instruction_decoder Skipped;
+                        opcode_form SkippedForm;
+                        if (FetchRecompiledOp(Rom, NextAddress, &Skipped, &SkippedForm) && SkippedForm == OP_F000)
+                            AddBlockStart(NextAddress + 4);
+                    } break;
+                    case OP_F000: AddBlockStart(NextAddress + 2); break;
+                    case OP_5xy2: case OP_Fx0A: case OP_Fx33: case OP_Fx55: AddBlockStart(NextAddress); break;
+                    default: break; // RET, SYS, EXIT, and JP V0, addr
+                }
+                break;
+            }
+
+            if (NextAddress >= (int)MTB_ARRAY_COUNT(Rom->IsReachable) || Rom->IsReachable[NextAddress])
+                break;
+
+            Rom->IsReachable[NextAddress] = true;
+            Address = NextAddress;
+        }
+    }
+}
+
+// Continues at the block at Address, or goes through the dispatcher if there is none.
+static void
+PrintGotoBlock(FILE* OutFile, recompiled_rom* Rom, char const* Indent, int Address)
+{
+    if (Address < (int)MTB_ARRAY_COUNT(Rom->IsBlockStart) && Rom->IsBlockStart[Address])
+        fprintf(OutFile, "%sgoto Block_%03X;\n", Indent, Address);
+    else
+        fprintf(OutFile, "%scontinue;\n", Indent);
+}
+
+static void
+PrintRecompiledOp(FILE* OutFile, recompiled_rom* Rom, instruction_decoder Decoder, opcode_form Form, int NextAddress)
+{
+#define COUSCOUS_FORM_NAME(Suffix) #Suffix,
+    static char const* const FormNames[] = { "INVALID", COUSCOUS_OPCODE_FORMS(COUSCOUS_FORM_NAME) };
+#undef COUSCOUS_FORM_NAME
+    fprintf(OutFile, "        // %04X (%s)\n", Decoder.Data, FormNames[Form]);
+
+    char const* SkipCondition = nullptr;
+    char Condition[64];
+    u16 X = Decoder.X;
+    u16 Y = Decoder.Y;
+    switch (Form)
+    {
+        case OP_1nnn:
+        {
+            fprintf(OutFile, "        M->ProgramCounter = 0x%03X;\n", Decoder.Address);
+            PrintGotoBlock(OutFile, Rom, "        ", Decoder.Address);
+        } break;
+
+        case OP_2nnn:
+        {
+            fprintf(OutFile, "        ExecuteOp_2nnn<Quirks>(M, micro_op{ 0x%08X });\n", DecodeMicroOp(Decoder).Data);
+            PrintGotoBlock(OutFile, Rom, "        ", Decoder.Address);
+        } break;
+
+        case OP_3xkk: snprintf(Condition, sizeof(Condition), "M->V[0x%X] == 0x%02X", X, Decoder.LSB); SkipCondition = Condition; break;
+        case OP_4xkk: snprintf(Condition, sizeof(Condition), "M->V[0x%X] != 0x%02X", X, Decoder.LSB); SkipCondition = Condition; break;
+        case OP_5xy0: snprintf(Condition, sizeof(Condition), "M->V[0x%X] == M->V[0x%X]", X, Y); SkipCondition = Condition; break;
+        case OP_9xy0: snprintf(Condition, sizeof(Condition), "M->V[0x%X] != M->V[0x%X]", X, Y); SkipCondition = Condition; break;
+        case OP_Ex9E: snprintf(Condition, sizeof(Condition), "IsKeyDown(M->InputState, 0x%X)", X); SkipCondition = Condition; break;
+        case OP_ExA1: snprintf(Condition, sizeof(Condition), "!IsKeyDown(M->InputState, 0x%X)", X); SkipCondition = Condition; break;
+
+        case OP_6xkk: fprintf(OutFile, "        M->V[0x%X] = 0x%02X;\n", X, Decoder.LSB); break;
+        case OP_7xkk: fprintf(OutFile, "        M->V[0x%X] += 0x%02X;\n", X, Decoder.LSB); break;
+        case OP_8xy0: fprintf(OutFile, "        M->V[0x%X] = M->V[0x%X];\n", X, Y); break;
+        case OP_8xy1: fprintf(OutFile, "        M->V[0x%X] |= M->V[0x%X];\n", X, Y); break;
+        case OP_8xy2: fprintf(OutFile, "        M->V[0x%X] &= M->V[0x%X];\n", X, Y); break;
+        case OP_8xy3: fprintf(OutFile, "        M->V[0x%X] ^= M->V[0x%X];\n", X, Y); break;
+        case OP_Annn: fprintf(OutFile, "        M->I = 0x%03X;\n", Decoder.Address); break;
+        case OP_Fx07: fprintf(OutFile, "        M->V[0x%X] = M->DT;\n", X); break;
+        case OP_Fx15: fprintf(OutFile, "        M->DT = M->V[0x%X];\n", X); break;
+        case OP_Fx18: fprintf(OutFile, "        M->ST = M->V[0x%X];\n", X); break;
+        case OP_Fx1E: fprintf(OutFile, "        M->I += M->V[0x%X];\n", X); break;
+        case OP_Fx29: fprintf(OutFile, "        M->I = GetDigitSpriteAddress(M, M->V[0x%X]);\n", X); break;
+
+        case OP_F000:
+        {
+            fprintf(OutFile, "        ExecuteOp_F000<Quirks>(M, micro_op{ 0x%08X });\n", DecodeMicroOp(Decoder).Data);
+            PrintGotoBlock(OutFile, Rom, "        ", NextAddress + 2);
+        } break;
+
+        case OP_00EE:
+        case OP_00FD:
+        case OP_0nnn:
+        case OP_Bnnn:
+        case OP_Fx0A:
+        {
+            fprintf(OutFile, "        ExecuteOp_%s<Quirks>(M, micro_op{ 0x%08X });\n", FormNames[Form], DecodeMicroOp(Decoder).Data);
+            fprintf(OutFile, "        continue;\n");
+        } break;
+
+        default:
+        {
+            // Everything else is simply forwarded to its handler, which the
+            // compiler inlines with a constant micro op anyway.
+#define COUSCOUS_HANDLER_NAME(Suffix) case OP_##Suffix: fprintf(OutFile, "        ExecuteOp_" #Suffix "<Quirks>(M, micro_op{ 0x%08X });\n", DecodeMicroOp(Decoder).Data); break;
+            switch (Form)
+            {
+                COUSCOUS_OPCODE_FORMS(COUSCOUS_HANDLER_NAME)
+                default: MTB_ASSERT(!"invalid code path"); break;
+            }
+#undef COUSCOUS_HANDLER_NAME
+        } break;
+    }
+
+    if (SkipCondition)
+    {
+        fprintf(OutFile, "        if (%s)\n", SkipCondition);
+        fprintf(OutFile, "        {\n");
+        fprintf(OutFile, "            SkipInstruction(M);\n");
+        if (NextAddress + 2 < (int)MTB_ARRAY_COUNT(Rom->IsBlockStart) && Rom->IsBlockStart[NextAddress + 2])
+        {
+            // Whether the skipped instruction is 4 bytes long is only known at runtime.
+            fprintf(OutFile, "            if (M->ProgramCounter == 0x%03X)\n", NextAddress + 2);
+            PrintGotoBlock(OutFile, Rom, "                ", NextAddress + 2);
+        }
+        fprintf(OutFile, "            continue;\n");
+        fprintf(OutFile, "        }\n");
+        PrintGotoBlock(OutFile, Rom, "        ", NextAddress);
+    }
+}
+
+// Writes a C++ file with one labeled block per statically reachable block of
+// the ROM. The file must be #included after couscous.cpp.
+static void
+Recompile(FILE* OutFile, char const* InFileName, u8 const* Bytes, int Size)
+{
+    static recompiled_rom Rom;
+    mtb::ItemSetZero(Rom);
+    Rom.Bytes = Bytes;
+    Rom.Size = Size;
+    if (Rom.Size > 4096 - RECOMPILE_BASE_ADDRESS)
+        Rom.Size = 4096 - RECOMPILE_BASE_ADDRESS;
+
+    FindReachableCode(&Rom);
+
+    fprintf(OutFile, "// Generated by `couscousc -recompile` from %s\n", InFileName);
+    fprintf(OutFile, "// #include this file after couscous.cpp.\n\n");
+
+    fprintf(OutFile, "static u8 const RecompiledRom[%d]\n{", Rom.Size);
+    for (int Offset = 0; Offset < Rom.Size; ++Offset)
+        fprintf(OutFile, "%s0x%02X,", Offset % 16 ? " " : "\n    ", Rom.Bytes[Offset]);
+    fprintf(OutFile, "\n};\n\n");
+
+    fprintf(OutFile, "// Same as `ExecuteThreaded`. Blocks whose code was modified at runtime, computed jumps,\n");
+    fprintf(OutFile, "// and anything else that was not reachable ahead of time are run by the interpreter.\n");
+    fprintf(OutFile, "template<quirk_flags Quirks>\n");
+    fprintf(OutFile, "static u64\n");
+    fprintf(OutFile, "ExecuteRecompiledWithQuirks(machine* M, u64 MaxInstructions)\n");
+    fprintf(OutFile, "{\n");
+    fprintf(OutFile, "    u64 NumExecuted = 0;\n");
+    fprintf(OutFile, "    while (NumExecuted < MaxInstructions && !M->RequiredInputRegisterIndexPlusOne)\n");
+    fprintf(OutFile, "    {\n");
+    fprintf(OutFile, "        switch (M->ProgramCounter)\n");
+    fprintf(OutFile, "        {\n");
+    for (int Address = 0; Address < (int)MTB_ARRAY_COUNT(Rom.IsBlockStart); ++Address)
+    {
+        if (Rom.IsBlockStart[Address])
+            fprintf(OutFile, "            case 0x%03X: goto Block_%03X;\n", Address, Address);
+    }
+    fprintf(OutFile, "        }\n\n");
+
+    fprintf(OutFile, "    Interpret:\n");
+    fprintf(OutFile, "        if (ExecuteThreadedWithQuirks<Quirks>(M, 1) == 0)\n");
+    fprintf(OutFile, "            break;\n");
+    fprintf(OutFile, "        ++NumExecuted;\n");
+    fprintf(OutFile, "        continue;\n");
+
+    for (int StartAddress = 0; StartAddress < (int)MTB_ARRAY_COUNT(Rom.IsBlockStart); ++StartAddress)
+    {
+        if (!Rom.IsBlockStart[StartAddress])
+            continue;
+
+        // Gather the ops of this block.
+        instruction_decoder Decoders[MAX_CODE_BLOCK_OPS];
+        opcode_form Forms[MAX_CODE_BLOCK_OPS];
+        int NumOps = 0;
+        int Address = StartAddress;
+        while (NumOps < MAX_CODE_BLOCK_OPS && FetchRecompiledOp(&Rom, Address, Decoders + NumOps, Forms + NumOps))
+        {
+            Address += 2;
+            if (EndsCodeBlock(Forms[NumOps++]) || (Address < (int)MTB_ARRAY_COUNT(Rom.IsBlockStart) && Rom.IsBlockStart[Address]))
+                break;
+        }
+
+        int EndAddress = StartAddress + 2 * NumOps;
+        fprintf(OutFile, "\n");
+        fprintf(OutFile, "    Block_%03X:\n", StartAddress);
+        if (NumOps == 0)
+        {
+            fprintf(OutFile, "        goto Interpret;\n");
+            continue;
+        }
+
+        fprintf(OutFile, "        if (NumExecuted == MaxInstructions)\n");
+        fprintf(OutFile, "            break;\n");
+        fprintf(OutFile, "        if (MaxInstructions - NumExecuted < %d || !mtb::BytesAreEqual(M->Memory + 0x%03X, RecompiledRom + 0x%03X, %d))\n",
+            NumOps, StartAddress, StartAddress - RECOMPILE_BASE_ADDRESS, EndAddress - StartAddress);
+        fprintf(OutFile, "            goto Interpret;\n");
+        fprintf(OutFile, "        NumExecuted += %d;\n", NumOps);
+        fprintf(OutFile, "        M->ProgramCounter = 0x%03X;\n", EndAddress);
+
+        for (int OpIndex = 0; OpIndex < NumOps; ++OpIndex)
+            PrintRecompiledOp(OutFile, &Rom, Decoders[OpIndex], Forms[OpIndex], StartAddress + 2 * (OpIndex + 1));
+
+        if (!EndsCodeBlock(Forms[NumOps - 1]))
+            PrintGotoBlock(OutFile, &Rom, "        ", EndAddress);
+    }
+
+    fprintf(OutFile, "    }\n\n");
+    fprintf(OutFile, "    return NumExecuted;\n");
+    fprintf(OutFile, "}\n\n");
+
+    fprintf(OutFile, "static u64\n");
+    fprintf(OutFile, "ExecuteRecompiled(machine* M, u64 MaxInstructions)\n");
+    fprintf(OutFile, "{\n");
+    fprintf(OutFile, "    COUSCOUS_SELECT_QUIRKS(M->Quirks, return ExecuteRecompiledWithQuirks, M, MaxInstructions);\n");
+    fprintf(OutFile, "}\n");
+}
+
+//
+// Fusion statistics
+//
+
+enum
+{
+    FUSION_STATS_NUM_INSTRUCTIONS = 10'000'000,
+    FUSION_STATS_INSTRUCTIONS_PER_FRAME = 1000,
+};
+
+// Runs the ROM on the block engine without any input and prints how often
+// each fused op was built and executed.
+static void
+PrintRomFusionStats(FILE* OutFile, u8 const* Bytes, int Size)
+{
+    static machine Machine;
+    machine* M = &Machine;
+    *M = {};
+    M->RNG = mtb::tRNG::Seed(1337);
+    if (Size > (int)MTB_ARRAY_SIZE(M->ProgramMemory))
+        Size = (int)MTB_ARRAY_SIZE(M->ProgramMemory);
+    mtb::CopyBytes(M->ProgramMemory, Bytes, Size);
+    M->ProgramCounter = 0x200;
+
+    u64 NumExecuted = 0;
+    while (NumExecuted < FUSION_STATS_NUM_INSTRUCTIONS)
+    {
+        if (M->DT > 0) --M->DT;
+        if (M->ST > 0) --M->ST;
+
+        // Pretend key 0 was pressed whenever the ROM waits for one.
+        if (M->RequiredInputRegisterIndexPlusOne)
+        {
+            M->V[M->RequiredInputRegisterIndexPlusOne - 1] = 0;
+            M->RequiredInputRegisterIndexPlusOne = 0;
+        }
+
+        u64 NumFrameInstructions = ExecuteBlocks(M, FUSION_STATS_INSTRUCTIONS_PER_FRAME);
+        NumExecuted += NumFrameInstructions;
+        if (NumFrameInstructions < FUSION_STATS_INSTRUCTIONS_PER_FRAME && !M->RequiredInputRegisterIndexPlusOne)
+            break;
+    }
+
+    fprintf(OutFile, "Executed %llu instructions.\n", (unsigned long long)NumExecuted);
+    PrintFusionStats(OutFile, &M->BlockCache);
+}
+
+//
+// Movie playback
+//
+
+// Plays the movie as fast as possible without a window and prints the
+// resulting machine state hash, which matches between runs of the same movie.
+static int
+PlayMovieBytes(FILE* OutFile, u8* MovieBytes, int MovieSize, u8 const* RomBytes, int RomSize)
+{
+    movie Movie;
+    if (!BeginMoviePlayback(&Movie, MovieBytes, (u32)MovieSize))
+    {
+        fprintf(stderr, "Not a movie file.\n");
+        return -1;
+    }
+
+    if (Movie.Header.RomHash != HashBytes(RomBytes, RomSize))
+    {
+        fprintf(stderr, "The movie was recorded with a different ROM.\n");
+        return -1;
+    }
+
+    static machine Machine;
+    static xochip_state XOChip;
+    machine* M = &Machine;
+    *M = {};
+    if (Movie.Header.Flags & MOVIE_XOCHIP)
+    {
+        mtb::ItemSetZero(XOChip);
+        EnableXOChip(M, &XOChip);
+    }
+
+    if (0x200 + RomSize > (int)GetMemorySize(M))
+    {
+        fprintf(stderr, "The ROM is too big.\n");
+        return -1;
+    }
+
+    mtb::CopyBytes(M->Memory + CHAR_MEMORY_OFFSET, GlobalCharMap, sizeof(GlobalCharMap));
+    mtb::CopyBytes(M->Memory + BIG_CHAR_MEMORY_OFFSET, GlobalBigCharMap, sizeof(GlobalBigCharMap));
+    WriteMemory(M, 0x200, (u32)RomSize, RomBytes);
+    M->ProgramCounter = 0x200;
+    StartMovieMachine(&Movie, M);
+
+    clock_t Start = clock();
+    u32 NumFrames = PlayMovie(&Movie, M);
+    f64 Seconds = (f64)(clock() - Start) / CLOCKS_PER_SEC;
+
+    fprintf(OutFile, "Played %u of %u frames, %llu cycles in %.3f s.\n", NumFrames, Movie.Header.NumFrames, (unsigned long long)M->CurrentCycle, Seconds);
+    fprintf(OutFile, "State hash: %016llX\n", (unsigned long long)HashMachineState(M));
+
+    return NumFrames == Movie.Header.NumFrames ? 0 : 1;
+}
+
+static int
+PlayMovieFile(FILE* OutFile, char const* MovieFileName, u8 const* RomBytes, int RomSize)
+{
+    FILE* MovieFile = fopen(MovieFileName, "rb");
+    if (!MovieFile)
+    {
+        fprintf(stderr, "Unable to open movie file: %s\n", MovieFileName);
+        return -1;
+    }
+
+    fseek(MovieFile, 0, SEEK_END);
+    int MovieSize = ftell(MovieFile);
+    fseek(MovieFile, 0, SEEK_SET);
+    u8* MovieBytes = (u8*)malloc(MovieSize);
+    fread(MovieBytes, MovieSize, 1, MovieFile);
+    fclose(MovieFile);
+
+    int Result = PlayMovieBytes(OutFile, MovieBytes, MovieSize, RomBytes, RomSize);
+    free(MovieBytes);
+
+    return Result;
+}
+
 static void
 PrintHelp(FILE* OutFile)
 {
-    fprintf(OutFile, "Usage: couscousc [-help] [-assemble|-disassemble] [-chd] <in_file> [<out_file>]\n");
+    fprintf(OutFile, "Usage: couscousc [-help] [-assemble|-disassemble|-recompile|-fusionstats] [-chd] <in_file> [<out_file>]\n");
+    fprintf(OutFile, "       couscousc -playmovie <rom_file> <movie_file>\n");
 }
 
 enum struct commandline_mode
@@ -161,6 +596,9 @@ enum struct commandline_mode
 
     Assemble,
     Disassemble,
+    Recompile,
+    FusionStats,
+    PlayMovie,
 };
 
 int main(int NumArgs, char const* Args[])
@@ -192,6 +630,18 @@ int main(int NumArgs, char const* Args[])
                 {
                     Mode = commandline_mode::Disassemble;
                 }
+                else if (mtb::string::StringEquals(mtb::string::ConstZ(ArgContent), mtb::string::ConstZ("recompile")))
+                {
+                    Mode = commandline_mode::Recompile;
+                }
+                else if (mtb::string::StringEquals(mtb::string::ConstZ(ArgContent), mtb::string::ConstZ("fusionstats")))
+                {
+                    Mode = commandline_mode::FusionStats;
+                }
+                else if (mtb::string::StringEquals(mtb::string::ConstZ(ArgContent), mtb::string::ConstZ("playmovie")))
+                {
+                    Mode = commandline_mode::PlayMovie;
+                }
                 else if(mtb::string::StringEquals(mtb::string::ConstZ(ArgContent), mtb::string::ConstZ("chd")))
                 {
                     GenerateDebugInfos = true;
@@ -245,7 +695,14 @@ int main(int NumArgs, char const* Args[])
 
     if (Mode == commandline_mode::NONE)
     {
-        fprintf(stderr, "Missing -assemble or -disassemble.\n");
+        fprintf(stderr, "Missing -assemble, -disassemble, -recompile, -fusionstats, or -playmovie.\n");
+        PrintHelp(stderr);
+        goto end;
+    }
+
+    if (Mode == commandline_mode::PlayMovie && FileIndex < 2)
+    {
+        fprintf(stderr, "Missing movie file path.\n");
         PrintHelp(stderr);
         goto end;
     }
@@ -270,7 +727,7 @@ int main(int NumArgs, char const* Args[])
 
         {
             FILE* OutFile = nullptr;
-            if (mtb::string::StringEquals(mtb::string::ConstZ(Files[1]), mtb::string::ConstZ("-")))
+            if (Mode == commandline_mode::PlayMovie || mtb::string::StringEquals(mtb::string::ConstZ(Files[1]), mtb::string::ConstZ("-")))
             {
                 OutFile = stdout;
                 GenerateDebugInfos = false;
@@ -368,6 +825,20 @@ int main(int NumArgs, char const* Args[])
 
                 Result = 0;
             }
+            else if (Mode == commandline_mode::Recompile)
+            {
+                Recompile(OutFile, Files[0], (u8 const*)ContentsBegin, (int)(ContentsEnd - ContentsBegin));
+                Result = 0;
+            }
+            else if (Mode == commandline_mode::FusionStats)
+            {
+                PrintRomFusionStats(OutFile, (u8 const*)ContentsBegin, (int)(ContentsEnd - ContentsBegin));
+                Result = 0;
+            }
+            else if (Mode == commandline_mode::PlayMovie)
+            {
+                Result = PlayMovieFile(OutFile, Files[1], (u8 const*)ContentsBegin, (int)(ContentsEnd - ContentsBegin));
+            }
             else
             {
                 MTB_ASSERT(!"invalid code path");
@@ -0,0 +1,152 @@
+// Generated by `couscousc -recompile` from roms/zophar.net/MAZE
+// #include this file after couscous.cpp.
+
+static u8 const RecompiledRom[34]
+{
+    0xA2, 0x1E, 0xC2, 0x01, 0x32, 0x01, 0xA2, 0x1A, 0xD0, 0x14, 0x70, 0x04, 0x30, 0x40, 0x12, 0x00,
+    0x60, 0x00, 0x71, 0x04, 0x31, 0x20, 0x12, 0x00, 0x12, 0x18, 0x80, 0x40, 0x20, 0x10, 0x20, 0x40,
+    0x80, 0x10,
+};
+
+// Same as `ExecuteThreaded`. Blocks whose code was modified at runtime, computed jumps,
+// and anything else that was not reachable ahead of time are run by the interpreter.
+template<quirk_flags Quirks>
+static u64
+ExecuteRecompiledWithQuirks(machine* M, u64 MaxInstructions)
+{
+    u64 NumExecuted = 0;
+    while (NumExecuted < MaxInstructions && !M->RequiredInputRegisterIndexPlusOne)
+    {
+        switch (M->ProgramCounter)
+        {
+            case 0x200: goto Block_200;
+            case 0x206: goto Block_206;
+            case 0x208: goto Block_208;
+            case 0x20E: goto Block_20E;
+            case 0x210: goto Block_210;
+            case 0x216: goto Block_216;
+            case 0x218: goto Block_218;
+        }
+
+    Interpret:
+        if (ExecuteThreadedWithQuirks<Quirks>(M, 1) == 0)
+            break;
+        ++NumExecuted;
+        continue;
+
+    Block_200:
+        if (NumExecuted == MaxInstructions)
+            break;
+        if (MaxInstructions - NumExecuted < 3 || !mtb::BytesAreEqual(M->Memory + 0x200, RecompiledRom + 0x000, 6))
+            goto Interpret;
+        NumExecuted += 3;
+        M->ProgramCounter = 0x206;
+        // A21E (Annn)
+        M->I = 0x21E;
+        // C201 (Cxkk)
+        ExecuteOp_Cxkk<Quirks>(M, micro_op{ 0x00010220 });
+        // 3201 (3xkk)
+        if (M->V[0x2] == 0x01)
+        {
+            SkipInstruction(M);
+            if (M->ProgramCounter == 0x208)
+                goto Block_208;
+            continue;
+        }
+        goto Block_206;
+
+    Block_206:
+        if (NumExecuted == MaxInstructions)
+            break;
+        if (MaxInstructions - NumExecuted < 1 || !mtb::BytesAreEqual(M->Memory + 0x206, RecompiledRom + 0x006, 2))
+            goto Interpret;
+        NumExecuted += 1;
+        M->ProgramCounter = 0x208;
+        // A21A (Annn)
+        M->I = 0x21A;
+        goto Block_208;
+
+    Block_208:
+        if (NumExecuted == MaxInstructions)
+            break;
+        if (MaxInstructions - NumExecuted < 3 || !mtb::BytesAreEqual(M->Memory + 0x208, RecompiledRom + 0x008, 6))
+            goto Interpret;
+        NumExecuted += 3;
+        M->ProgramCounter = 0x20E;
+        // D014 (Dxyn)
+        ExecuteOp_Dxyn<Quirks>(M, micro_op{ 0x00041021 });
+        // 7004 (7xkk)
+        M->V[0x0] += 0x04;
+        // 3040 (3xkk)
+        if (M->V[0x0] == 0x40)
+        {
+            SkipInstruction(M);
+            if (M->ProgramCounter == 0x210)
+                goto Block_210;
+            continue;
+        }
+        goto Block_20E;
+
+    Block_20E:
+        if (NumExecuted == MaxInstructions)
+            break;
+        if (MaxInstructions - NumExecuted < 1 || !mtb::BytesAreEqual(M->Memory + 0x20E, RecompiledRom + 0x00E, 2))
+            goto Interpret;
+        NumExecuted += 1;
+        M->ProgramCounter = 0x210;
+        // 1200 (1nnn)
+        M->ProgramCounter = 0x200;
+        goto Block_200;
+
+    Block_210:
+        if (NumExecuted == MaxInstructions)
+            break;
+        if (MaxInstructions - NumExecuted < 3 || !mtb::BytesAreEqual(M->Memory + 0x210, RecompiledRom + 0x010, 6))
+            goto Interpret;
+        NumExecuted += 3;
+        M->ProgramCounter = 0x216;
+        // 6000 (6xkk)
+        M->V[0x0] = 0x00;
+        // 7104 (7xkk)
+        M->V[0x1] += 0x04;
+        // 3120 (3xkk)
+        if (M->V[0x1] == 0x20)
+        {
+            SkipInstruction(M);
+            if (M->ProgramCounter == 0x218)
+                goto Block_218;
+            continue;
+        }
+        goto Block_216;
+
+    Block_216:
+        if (NumExecuted == MaxInstructions)
+            break;
+        if (MaxInstructions - NumExecuted < 1 || !mtb::BytesAreEqual(M->Memory + 0x216, RecompiledRom + 0x016, 2))
+            goto Interpret;
+        NumExecuted += 1;
+        M->ProgramCounter = 0x218;
+        // 1200 (1nnn)
+        M->ProgramCounter = 0x200;
+        goto Block_200;
+
+    Block_218:
+        if (NumExecuted == MaxInstructions)
+            break;
+        if (MaxInstructions - NumExecuted < 1 || !mtb::BytesAreEqual(M->Memory + 0x218, RecompiledRom + 0x018, 2))
+            goto Interpret;
+        NumExecuted += 1;
+        M->ProgramCounter = 0x21A;
+        // 1218 (1nnn)
+        M->ProgramCounter = 0x218;
+        goto Block_218;
+    }
+
+    return NumExecuted;
+}
+
+static u64
+ExecuteRecompiled(machine* M, u64 MaxInstructions)
+{
+    COUSCOUS_SELECT_QUIRKS(M->Quirks, return ExecuteRecompiledWithQuirks, M, MaxInstructions);
+}
@@ -27,6 +27,11 @@ using bool32 = int;
 #include "couscous.h"
 
 #include "couscous.cpp"
+#include "couscous_jit.cpp"
+#include "couscous_snapshot.cpp"
+#include "couscous_movie.cpp"
+#include "couscous_savestate.cpp"
+#include "couscous_history.cpp"
 
 #include "charmap.cpp"
 
@@ -72,17 +77,18 @@ struct mem_stack
 };
 
 static void*
-PushBytes(mem_stack* Memory, size_t NumBytes)
+PushBytes(mem_stack* Memory, size_t NumBytes, size_t Alignment = 1)
 {
-    if (Memory->Current + NumBytes > Memory->Length)
+    size_t Start = (Memory->Current + Alignment - 1) & ~(Alignment - 1);
+    if (Start + NumBytes > Memory->Length)
         return nullptr;
 
-    void* Ptr = Memory->Ptr + Memory->Current;
-    Memory->Current += NumBytes;
+    void* Ptr = Memory->Ptr + Start;
+    Memory->Current = Start + NumBytes;
     return Ptr;
 }
 
-#define PushStruct(Memory, Struct) ((Struct*)PushBytes((Memory), sizeof(Struct)))
+#define PushStruct(Memory, Struct) ((Struct*)PushBytes((Memory), sizeof(Struct), alignof(Struct)))
 
 
 struct win32_loaded_rom
@@ -142,14 +148,90 @@ Win32LoadFileContents(char const* FileName)
     return Result;
 }
 
+struct win32_mapped_file
+{
+    HANDLE FileHandle;
+    HANDLE MappingHandle;
+    u8 const* Data;
+    size_t Size;
+};
+
+// Maps the whole file read-only. Data is null if that didn't work.
+static win32_mapped_file
+Win32MapFile(char const* FileName)
+{
+    win32_mapped_file Result{};
+
+    Result.FileHandle = CreateFileA(FileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (Result.FileHandle != INVALID_HANDLE_VALUE)
+    {
+        LARGE_INTEGER FileSize;
+        if (GetFileSizeEx(Result.FileHandle, &FileSize) && FileSize.QuadPart > 0)
+        {
+            Result.MappingHandle = CreateFileMappingA(Result.FileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (Result.MappingHandle)
+            {
+                Result.Data = (u8 const*)MapViewOfFile(Result.MappingHandle, FILE_MAP_READ, 0, 0, 0);
+                Result.Size = (size_t)FileSize.QuadPart;
+            }
+        }
+    }
+
+    return Result;
+}
+
+static void
+Win32UnmapFile(win32_mapped_file* Mapped)
+{
+    if (Mapped->Data)
+        UnmapViewOfFile(Mapped->Data);
+    if (Mapped->MappingHandle)
+        CloseHandle(Mapped->MappingHandle);
+    if (Mapped->FileHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(Mapped->FileHandle);
+    *Mapped = {};
+}
+
+static bool
+Win32WriteFileContents(char const* FileName, void const* Data, DWORD Size)
+{
+    bool Result = false;
+
+    HANDLE FileHandle = CreateFileA(FileName, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, 0, nullptr);
+    if (FileHandle != INVALID_HANDLE_VALUE)
+    {
+        DWORD NumBytesWritten;
+        Result = WriteFile(FileHandle, Data, Size, &NumBytesWritten, nullptr) && NumBytesWritten == Size;
+        CloseHandle(FileHandle);
+    }
+
+    return Result;
+}
+
+// The XO-CHIP state is only allocated for ROMs that ask for it, either by
+// their .xo8 extension or by not fitting into 4 KiB.
 bool
-LoadRom(machine* M, size_t RomSize, u8* RomPtr)
+LoadRom(machine* M, mem_stack* Memory, bool WantsXOChip, size_t RomSize, u8* RomPtr)
 {
     bool Result = false;
 
-    if (RomSize <= MTB_ARRAY_SIZE(M->ProgramMemory))
+    // No ROM asks for any quirks yet.
+    SetQuirks(M, quirk_flags::NONE);
+
+    if (WantsXOChip || RomSize > MTB_ARRAY_SIZE(M->ProgramMemory))
     {
-        mtb::CopyBytes(M->ProgramMemory, RomPtr, RomSize);
+        xochip_state* XOChip = PushStruct(Memory, xochip_state);
+        if (XOChip)
+        {
+            mtb::ItemSetZero(*XOChip);
+            EnableXOChip(M, XOChip);
+        }
+    }
+
+    if (0x200 + RomSize <= GetMemorySize(M))
+    {
+        WriteMemory(M, 0x200, (u32)RomSize, RomPtr);
+        InvalidateDecodeCache(M);
         Result = true;
     }
 
@@ -166,25 +248,34 @@ struct win32_front_buffer
     DWORD Pitch;
     DWORD BytesPerPixel;
 
-    colorRGBA8 PixelColorOn;
-    colorRGBA8 PixelColorOff;
+    // Indexed by GetPixelColorIndex. Plain CHIP-8 only uses the first two entries.
+    colorRGBA8 Palette[1 << XOCHIP_MAX_PLANES];
 };
 
+// The front buffer is always HIRES_SCREEN_WIDTH x
+// HIRES_SCREEN_HEIGHT. Low resolution pixels are drawn as 2x2 pixels.
 static void
-Win32SwapBuffers(bool32* ScreenPixels, win32_front_buffer* Front)
+Win32SwapBuffers(machine const* M, u64 RowsToSwap, win32_front_buffer* Front)
 {
-    colorRGBA8* FrontPixel = Front->Pixels;
-    bool32* ScreenPixel = ScreenPixels;
-
-    for (size_t Y = 0; Y < SCREEN_HEIGHT; ++Y)
+    int const Width = GetScreenWidth(M);
+    int const Height = GetScreenHeight(M);
+    int const Scale = HIRES_SCREEN_WIDTH / Width;
+    for (int Y = 0; Y < Height; ++Y)
     {
-        for (size_t X = 0; X < SCREEN_WIDTH; ++X, ++ScreenPixel, ++FrontPixel)
+        if (!IsBitSet(RowsToSwap, (u64)Y))
+            continue;
+
+        colorRGBA8* FrontRow = Front->Pixels + Y * Scale * HIRES_SCREEN_WIDTH;
+        colorRGBA8* FrontPixel = FrontRow;
+        for (int X = 0; X < Width; ++X)
         {
-            colorRGBA8 NewColor;
-            if (*ScreenPixel) NewColor = Front->PixelColorOn;
-            else              NewColor = Front->PixelColorOff;
-            *FrontPixel = NewColor;
+            colorRGBA8 NewColor = Front->Palette[GetPixelColorIndex(M, X, Y)];
+            for (int Repeat = 0; Repeat < Scale; ++Repeat)
+                *FrontPixel++ = NewColor;
         }
+
+        for (int Repeat = 1; Repeat < Scale; ++Repeat)
+            mtb::CopyBytes(FrontRow + Repeat * HIRES_SCREEN_WIDTH, FrontRow, HIRES_SCREEN_WIDTH * sizeof(colorRGBA8));
     }
 }
 
@@ -238,6 +329,7 @@ enum struct win32_window_event_action_type
     Exit,
     TogglePause,
     SingleStep,
+    StepBack,
     ToggleFullscreen,
 
     AcceptText,
@@ -424,7 +516,11 @@ Win32MainWindowCallback(HWND WindowHandle, UINT Message, WPARAM WParam, LPARAM L
                 case VK_F10:
                 case VK_F11:
                 {
-                    if (KeyWasReleased)
+                    if (KeyWasReleased && ShiftKeyModifier)
+                    {
+                        *Add(&Window->Events) = { win32_window_event_type::Action, { win32_window_event_action_type::StepBack } };
+                    }
+                    else if (KeyWasReleased)
                     {
                         *Add(&Window->Events) = { win32_window_event_type::Action, { win32_window_event_action_type::SingleStep } };
                     }
@@ -683,31 +779,6 @@ Win32DeltaSeconds(win32_clock* Clock, win32_timestamp End, win32_timestamp Start
     return Result;
 }
 
-// See if input is required in order to continue execution.
-static bool
-Win32CanTick(machine* M, u16 OldInputState, u16 NewInputState)
-{
-    // See if input is required in order to continue execution.
-    bool CanTick = true;
-    if (M->RequiredInputRegisterIndexPlusOne)
-    {
-        CanTick = false;
-        for (u16 KeyIndex = 0; KeyIndex < 16; ++KeyIndex)
-        {
-            if (!IsBitSet(OldInputState, KeyIndex) && IsBitSet(NewInputState, KeyIndex))
-            {
-                u8* Reg = M->V + (M->RequiredInputRegisterIndexPlusOne - 1);
-                MTB_ASSERT((u16)(u8)KeyIndex == KeyIndex);
-                *Reg = (u8)KeyIndex;
-                M->RequiredInputRegisterIndexPlusOne = 0;
-                CanTick = true;
-            }
-        }
-    }
-
-    return CanTick;
-}
-
 static bool
 StringEndsWith(size_t StringLength, char const* String, size_t EndLength, char const* End)
 {
@@ -831,6 +902,29 @@ struct breakpoint
 };
 #include "generated/breakpoint_array.h"
 
+// Breakpoints are set on source lines, the machine needs the addresses they were assembled to.
+static void
+Win32UpdateMachineBreakpoints(machine* M, breakpoint_array* Breakpoints, debug_info_array* DebugInfos)
+{
+    ClearBreakpoints(M);
+    for (int BreakpointIndex = 0;
+        BreakpointIndex < Breakpoints->NumElements;
+        ++BreakpointIndex)
+    {
+        breakpoint* Breakpoint = Breakpoints->Data() + BreakpointIndex;
+        for (int InfoIndex = 0;
+            InfoIndex < DebugInfos->NumElements;
+            ++InfoIndex)
+        {
+            debug_info* Info = DebugInfos->Data() + InfoIndex;
+            if (Info->FileId == Breakpoint->FileId && Info->Line == Breakpoint->Line)
+            {
+                SetBreakpoint(M, Info->MemoryOffset, true);
+            }
+        }
+    }
+}
+
 struct to_string_result
 {
     bool Success;
@@ -999,7 +1093,7 @@ WinMain(HINSTANCE ProcessHandle, HINSTANCE PreviousProcessHandle, LPSTR CommandL
     char const* FileName = CommandLine;
 
     mem_stack MemStack{};
-    MemStack.Length = 1 * mtb::mebibytes_to_bytes;
+    MemStack.Length = 4 * mtb::mebibytes_to_bytes;
 
     LPVOID BaseAddress = nullptr;
     if (COUSCOUS_DEBUG)
@@ -1013,6 +1107,9 @@ WinMain(HINSTANCE ProcessHandle, HINSTANCE PreviousProcessHandle, LPSTR CommandL
     machine* M = (machine*)PushStruct(&MemStack, machine);
     mtb::ItemSetZero(*M);
 
+    history* History = PushStruct(&MemStack, history);
+    InitHistory(History, HISTORY_DEFAULT_SNAPSHOT_INTERVAL);
+
 #if defined(COUSCOUS_RANDOM_SEED)
     M->RNG = mtb::tRNG::Seed(COUSCOUS_RANDOM_SEED);
 #else
@@ -1027,10 +1124,10 @@ WinMain(HINSTANCE ProcessHandle, HINSTANCE PreviousProcessHandle, LPSTR CommandL
     {
 #if USE_TEST_PROGRAM
         win32_loaded_rom Rom{ MTB_ARRAY_COUNT(GlobalTestProgram), GlobalTestProgram };
-        RomLoaded = LoadRom(M, Rom.Length, Rom.Ptr);
+        RomLoaded = LoadRom(M, &MemStack, false, Rom.Length, Rom.Ptr);
 #else
         u8_array FileContents = Win32LoadFileContents(FileName);
-        RomLoaded = LoadRom(M, FileContents.NumElements, FileContents.Data());
+        RomLoaded = LoadRom(M, &MemStack, StringEndsWith(FileName, ".xo8"), FileContents.NumElements, FileContents.Data());
         Deallocate(&FileContents);
 #endif
     }
@@ -1159,8 +1256,8 @@ WinMain(HINSTANCE ProcessHandle, HINSTANCE PreviousProcessHandle, LPSTR CommandL
             //
             win32_front_buffer* FrontBuffer = &Window.FrontBuffer;
             FrontBuffer->BytesPerPixel = 4;
-            FrontBuffer->Width = SCREEN_WIDTH;
-            FrontBuffer->Height = SCREEN_HEIGHT;
+            FrontBuffer->Width = HIRES_SCREEN_WIDTH;
+            FrontBuffer->Height = HIRES_SCREEN_HEIGHT;
             FrontBuffer->Pitch = FrontBuffer->Width * FrontBuffer->BytesPerPixel;
             FrontBuffer->BitmapInfo.bmiHeader.biSize = sizeof(FrontBuffer->BitmapInfo.bmiHeader);
             FrontBuffer->BitmapInfo.bmiHeader.biWidth = (LONG)FrontBuffer->Width;
@@ -1169,11 +1266,18 @@ WinMain(HINSTANCE ProcessHandle, HINSTANCE PreviousProcessHandle, LPSTR CommandL
             FrontBuffer->BitmapInfo.bmiHeader.biBitCount = (WORD)(FrontBuffer->BytesPerPixel * 8);
             FrontBuffer->BitmapInfo.bmiHeader.biCompression = BI_RGB;
             FrontBuffer->Pixels = (decltype(FrontBuffer->Pixels))PushBytes(&MemStack, (size_t)FrontBuffer->Width * FrontBuffer->Height * FrontBuffer->BytesPerPixel);
-            FrontBuffer->PixelColorOff = { 16, 64, 16, 255 };
-            FrontBuffer->PixelColorOn = { 8, 16, 8, 255 };
+            colorRGBA8 const Palette[] =
+            {
+                { 16,  64,  16, 255 }, {   8,  16,   8, 255 }, { 96, 160,  64, 255 }, {  48,  96,  32, 255 },
+                { 64,  32,  16, 255 }, { 128,  64,  32, 255 }, { 32,  64, 128, 255 }, {  64, 128, 192, 255 },
+                { 96,  96,  96, 255 }, { 160, 160, 160, 255 }, { 128, 32,  32, 255 }, { 192,  64,  64, 255 },
+                { 32, 128, 128, 255 }, {  64, 192, 192, 255 }, { 192, 192, 64, 255 }, { 240, 240, 240, 255 },
+            };
+            static_assert(MTB_ARRAY_SIZE(Palette) == MTB_ARRAY_SIZE(FrontBuffer->Palette), "");
+            mtb::CopyBytes(FrontBuffer->Palette, Palette, sizeof(Palette));
 
             // Init swap to ensure properly cleared buffers.
-            Win32SwapBuffers(M->Screen, FrontBuffer);
+            Win32SwapBuffers(M, ~0ull, FrontBuffer);
 
             // Associate the back buffer with the window for presenting.
             SetWindowLongPtr(Window.Handle, GWLP_USERDATA, (LONG_PTR)&Window);
@@ -1183,6 +1287,8 @@ WinMain(HINSTANCE ProcessHandle, HINSTANCE PreviousProcessHandle, LPSTR CommandL
             //
             mtb::tSlice<u8> CharMemory = mtb::SliceOffset(mtb::ArraySlice(M->Memory), CHAR_MEMORY_OFFSET);
             mtb::SliceCopyBytes(CharMemory, mtb::ArraySlice(GlobalCharMap));
+            mtb::tSlice<u8> BigCharMemory = mtb::SliceOffset(mtb::ArraySlice(M->Memory), BIG_CHAR_MEMORY_OFFSET);
+            mtb::SliceCopyBytes(BigCharMemory, mtb::ArraySlice(GlobalBigCharMap));
 
             u16 InitialProgramCounter = BaseMemoryOffset;
             M->ProgramCounter = InitialProgramCounter;
@@ -1196,11 +1302,15 @@ WinMain(HINSTANCE ProcessHandle, HINSTANCE PreviousProcessHandle, LPSTR CommandL
             f64 const FrameTargetSeconds = 1.0 / 55.0; // 55Hz
             int const TicksPerFrame = 15;
 
+            // DT and ST are counted down by RunCycles.
+            M->InstructionsPerSecond = (u32)(TicksPerFrame / FrameTargetSeconds + 0.5);
+
             win32_timestamp EndOfLastFrame = Win32Now();
 
             int PendingTicks = 0;
 
             pause_state PauseState = pause_state::None;
+            pause_state PresentedPauseState = pause_state::None;
             text1024 TextInputBuffer{};
             text1024 DebugMessage{};
             breakpoint_array Breakpoints{};
@@ -1251,6 +1361,10 @@ WinMain(HINSTANCE ProcessHandle, HINSTANCE PreviousProcessHandle, LPSTR CommandL
                                         strc BreakCommand = Str("break");
                                         strc ShowCommand = Str("show");
                                         strc ClearCommand = Str("clear");
+                                        strc SaveCommand = Str("save");
+                                        strc LoadCommand = Str("load");
+                                        strc BackCommand = Str("back");
+                                        strc ReverseCommand = Str("reverse");
 
                                         if (StartsWith(Str(TextInputBuffer), BreakCommand))
                                         {
@@ -1260,7 +1374,6 @@ WinMain(HINSTANCE ProcessHandle, HINSTANCE PreviousProcessHandle, LPSTR CommandL
                                             {
                                                 BreakTarget.Size -= (int)ParseResult.RemainingSourceLen;
 
-                                                // TODO: Toggle breakpoint here.
                                                 breakpoint Breakpoint{};
                                                 Breakpoint.FileId = 1;
                                                 Breakpoint.Line = (int32_t)ParseResult.Value;
@@ -1295,6 +1408,8 @@ WinMain(HINSTANCE ProcessHandle, HINSTANCE PreviousProcessHandle, LPSTR CommandL
                                                         MTB_ASSERT(!"Unable to remove breakpoint that we found earlier?!");
                                                     }
                                                 }
+
+                                                Win32UpdateMachineBreakpoints(M, &Breakpoints, &DebugInfos);
                                             }
                                             else
                                             {
@@ -1331,8 +1446,68 @@ WinMain(HINSTANCE ProcessHandle, HINSTANCE PreviousProcessHandle, LPSTR CommandL
                                         else if (AreEqual(Str(TextInputBuffer), ClearCommand))
                                         {
                                             Clear(&Breakpoints);
+                                            Win32UpdateMachineBreakpoints(M, &Breakpoints, &DebugInfos);
                                             Append(&DebugMessage, Str("Cleared all breakpoints."));
                                         }
+                                        else if (StartsWith(Str(TextInputBuffer), SaveCommand))
+                                        {
+                                            strc SaveStateFileName = Trim(str{ TextInputBuffer.Size - SaveCommand.Size, TextInputBuffer.Data + SaveCommand.Size });
+                                            text1024 SaveStatePath = CreateText1024(SaveStateFileName);
+
+                                            static u8 SaveState[SAVE_STATE_MAX_SIZE];
+                                            u32 SaveStateSize = WriteSaveState(M, SaveState, sizeof(SaveState));
+                                            if (SaveStateFileName.Size > 0 && Win32WriteFileContents(SaveStatePath.Data, SaveState, SaveStateSize))
+                                                Append(&DebugMessage, Str("Saved state to: "));
+                                            else
+                                                Append(&DebugMessage, Str("Unable to save state to: "));
+                                            Append(&DebugMessage, SaveStateFileName);
+                                        }
+                                        else if (StartsWith(Str(TextInputBuffer), LoadCommand))
+                                        {
+                                            strc SaveStateFileName = Trim(str{ TextInputBuffer.Size - LoadCommand.Size, TextInputBuffer.Data + LoadCommand.Size });
+                                            text1024 SaveStatePath = CreateText1024(SaveStateFileName);
+
+                                            win32_mapped_file SaveState = Win32MapFile(SaveStatePath.Data);
+                                            if (SaveState.Data && LoadSaveState(M, SaveState.Data, SaveState.Size))
+                                            {
+                                                // The history can't go back past the loaded state.
+                                                InitHistory(History, HISTORY_DEFAULT_SNAPSHOT_INTERVAL);
+                                                Append(&DebugMessage, Str("Loaded state from: "));
+                                            }
+                                            else
+                                                Append(&DebugMessage, Str("Unable to load state from: "));
+                                            Append(&DebugMessage, SaveStateFileName);
+                                            Win32UnmapFile(&SaveState);
+                                        }
+                                        else if (StartsWith(Str(TextInputBuffer), BackCommand))
+                                        {
+                                            strc NumCyclesString = Trim(str{ TextInputBuffer.Size - BackCommand.Size, TextInputBuffer.Data + BackCommand.Size });
+                                            parse_string_result_s64 ParseResult = ParseString_s64(NumCyclesString.Size, NumCyclesString.Data, 0);
+                                            if (ParseResult.Success && ParseResult.Value > 0)
+                                            {
+                                                u64 NumSteppedBack = StepBack(History, M, (u64)ParseResult.Value);
+                                                Win32SwapBuffers(M, ~0ull, &Window.FrontBuffer);
+
+                                                char Buffer[64];
+                                                to_string_result ToStringResult = ToString((int32_t)NumSteppedBack, MTB_ARRAY_SIZE(Buffer), Buffer);
+                                                Append(&DebugMessage, Str("Cycles stepped back: "));
+                                                if (ToStringResult.Success)
+                                                    Append(&DebugMessage, str{ (int)ToStringResult.StrLen, ToStringResult.StrPtr });
+                                            }
+                                            else
+                                            {
+                                                Append(&DebugMessage, Str("Not a valid number of cycles: "));
+                                                Append(&DebugMessage, NumCyclesString);
+                                            }
+                                        }
+                                        else if (AreEqual(Str(TextInputBuffer), ReverseCommand))
+                                        {
+                                            if (ReverseContinue(History, M))
+                                                Append(&DebugMessage, Str("Breakpoint hit."));
+                                            else
+                                                Append(&DebugMessage, Str("No breakpoint hit, stopped at the oldest recorded state."));
+                                            Win32SwapBuffers(M, ~0ull, &Window.FrontBuffer);
+                                        }
                                         else
                                         {
                                             Append(&DebugMessage, Str("Unrecognized command: "));
@@ -1362,6 +1537,15 @@ WinMain(HINSTANCE ProcessHandle, HINSTANCE PreviousProcessHandle, LPSTR CommandL
                                     SingleStep = true;
                                 } break;
 
+                                case win32_window_event_action_type::StepBack:
+                                {
+                                    if (PauseState != pause_state::None)
+                                    {
+                                        StepBack(History, M, 1);
+                                        Win32SwapBuffers(M, ~0ull, &Window.FrontBuffer);
+                                    }
+                                } break;
+
                                 case win32_window_event_action_type::DeleteCharacter:
                                 {
                                     if (PauseState == pause_state::Prompt && TextInputBuffer.Size > 0)
@@ -1429,11 +1613,13 @@ WinMain(HINSTANCE ProcessHandle, HINSTANCE PreviousProcessHandle, LPSTR CommandL
                 }
                 else
                 {
-                    Win32AppendDebugText(&Window, Str("Paused | <F10>/<F11>: Single Step | <F5> Unpause | <Esc> Exit\n"));
+                    Win32AppendDebugText(&Window, Str("Paused | <F10>/<F11>: Single Step | <Shift+F10>/<Shift+F11>: Step Back | <F5> Unpause | <Esc> Exit\n"));
                     Win32AppendDebugText(&Window, Str("Commands:\n"));
                     Win32AppendDebugText(&Window, Str("\"break 123\" Set a new breakpoint on line 123\n"));
                     Win32AppendDebugText(&Window, Str("\"show\" show all breakpoints.\n"));
                     Win32AppendDebugText(&Window, Str("\"clear\" clear all breakpoints.\n"));
+                    Win32AppendDebugText(&Window, Str("\"save foo.state\" / \"load foo.state\" save or load the machine state.\n"));
+                    Win32AppendDebugText(&Window, Str("\"back 100\" go back 100 cycles, \"reverse\" go back to the last breakpoint hit.\n"));
                     Win32AppendDebugText(&Window, Str("> "));
 
                     Win32AppendDebugText(&Window, Str(TextInputBuffer));
@@ -1462,85 +1648,89 @@ WinMain(HINSTANCE ProcessHandle, HINSTANCE PreviousProcessHandle, LPSTR CommandL
                 if (TicksThisFrame > 0)
                 {
                     // Process game input.
-                    u16 OldInputState = M->InputState;
-                    u16 NewInputState = Window.InputState;
-                    M->InputState = NewInputState;
-
-                    if (M->DT > 0)
-                        --M->DT;
+                    SetInputStateWithHistory(History, M, Window.InputState);
 
                     u8 OldST = M->ST;
-                    if (M->ST > 0)
-                        --M->ST;
-
-                    if (!Win32CanTick(M, OldInputState, NewInputState))
-                    {
-                        TicksThisFrame = 0;
-                    }
 
                     while (TicksThisFrame > 0)
                     {
-                        ++M->CurrentCycle;
+                        u64 CycleBefore = M->CurrentCycle;
+                        stop_reason StopReason = RunCyclesWithHistory(History, M, (u64)TicksThisFrame, stop_reason::Breakpoint);
+                        int NumTicks = (int)(M->CurrentCycle - CycleBefore);
+
+                        // Running into an invalid instruction restarts the program and costs a tick.
+                        bool Restart = (StopReason & stop_reason::InvalidOpcode) != stop_reason::NONE;
+                        if (Restart)
+                        {
+                            SetProgramCounterWithHistory(History, M, InitialProgramCounter);
+                            ++NumTicks;
+                        }
+
+                        TicksThisFrame -= NumTicks;
+                        if (PauseState == pause_state::None)
+                            PendingTicks -= NumTicks;
 
-                        if (HasDebugInfo && false)
+                        if ((StopReason & stop_reason::Breakpoint) != stop_reason::NONE)
                         {
-                            u16 PC = M->ProgramCounter;
-                            bool FoundDebugInfo = false;
-                            for (int InfoIndex = 0;
-                                InfoIndex < DebugInfos.NumElements;
-                                ++InfoIndex)
+                            PauseState = pause_state::Prompt;
+                            Clear(&DebugMessage);
+                            Append(&DebugMessage, Str("Breakpoint hit."));
+
+                            if (HasDebugInfo)
                             {
-                                debug_info* Info = DebugInfos.Data() + InfoIndex;
-                                if (Info->MemoryOffset == PC)
+                                u16 PC = M->ProgramCounter;
+                                bool FoundDebugInfo = false;
+                                for (int InfoIndex = 0;
+                                    InfoIndex < DebugInfos.NumElements;
+                                    ++InfoIndex)
                                 {
-                                    int FileIndex = Info->FileId - 1;
-                                    strc SourceFilePath = *At(&DebugSourceFilePaths, FileIndex);
-                                    u16 Instruction = ReadWord(M->Memory + PC);
-                                    if (Instruction != Info->GeneratedInstruction)
-                                    {
-                                        printf("Detected discrepancy at 0x%04X: Generated " STR_FMT " 0x%04X vs. 0x%04X | " STR_FMT "(%d,%d)\n",
-                                            PC,
-                                            STR_FMTARG(Info->SourceLine),
-                                            Info->GeneratedInstruction,
-                                            Instruction,
-                                            STR_FMTARG(SourceFilePath),
-                                            Info->Line,
-                                            Info->Column
-                                        );
-                                    }
-                                    else
+                                    debug_info* Info = DebugInfos.Data() + InfoIndex;
+                                    if (Info->MemoryOffset == PC)
                                     {
-                                        printf("Executing instruction at 0x%04X: " STR_FMT " 0x%04X | " STR_FMT "(%d,%d)\n",
-                                            PC,
-                                            STR_FMTARG(Info->SourceLine),
-                                            Info->GeneratedInstruction,
-                                            STR_FMTARG(SourceFilePath),
-                                            Info->Line,
-                                            Info->Column
-                                        );
+                                        int FileIndex = Info->FileId - 1;
+                                        strc SourceFilePath = *At(&DebugSourceFilePaths, FileIndex);
+                                        u16 Instruction = ReadWord(M->Memory + PC);
+                                        if (Instruction != Info->GeneratedInstruction)
+                                        {
+                                            printf("Detected discrepancy at 0x%04X: Generated " STR_FMT " 0x%04X vs. 0x%04X | " STR_FMT "(%d,%d)\n",
+                                                PC,
+                                                STR_FMTARG(Info->SourceLine),
+                                                Info->GeneratedInstruction,
+                                                Instruction,
+                                                STR_FMTARG(SourceFilePath),
+                                                Info->Line,
+                                                Info->Column
+                                            );
+                                        }
+                                        else
+                                        {
+                                            printf("Stopped at 0x%04X: " STR_FMT " 0x%04X | " STR_FMT "(%d,%d)\n",
+                                                PC,
+                                                STR_FMTARG(Info->SourceLine),
+                                                Info->GeneratedInstruction,
+                                                STR_FMTARG(SourceFilePath),
+                                                Info->Line,
+                                                Info->Column
+                                            );
+                                        }
+
+                                        FoundDebugInfo = true;
+                                        break;
                                     }
+                                }
 
-                                    FoundDebugInfo = true;
-                                    break;
+                                if (!FoundDebugInfo)
+                                {
+                                    printf("Unable to find debug info for location: 0x%04X", PC);
                                 }
                             }
 
-                            if (!FoundDebugInfo)
-                            {
-                                printf("Unable to find debug info for location: 0x%04X", PC);
-                            }
                         }
 
-                        tick_result TickResult = Tick(M);
-
-                        --TicksThisFrame;
-                        if (PauseState == pause_state::None)
-                            --PendingTicks;
-
-                        if (!TickResult.Continue)
-                        {
-                            M->ProgramCounter = InitialProgramCounter;
-                        }
+                        // Time keeps passing while waiting for a key that was requested just now.
+                        bool Waiting = (StopReason & stop_reason::WaitingForKey) != stop_reason::NONE;
+                        if (!Restart && !(Waiting && NumTicks > 0))
+                            break;
                     }
 
                     if (OldST == 0 && M->ST != 0)
@@ -1551,11 +1741,24 @@ WinMain(HINSTANCE ProcessHandle, HINSTANCE PreviousProcessHandle, LPSTR CommandL
                     {
                         // TODO: Stop the sound
                     }
+                }
 
-                    Win32SwapBuffers(M->Screen, &Window.FrontBuffer);
+                // Only rows that changed are converted, and nothing is
+                // presented unless something changed. WM_PAINT takes care
+                // of presenting whenever Windows asks for it.
+                bool NeedsPresent = PauseState != pause_state::None || PauseState != PresentedPauseState;
+                u64 DirtyRows = TakeDirtyRows(M);
+                if (DirtyRows)
+                {
+                    Win32SwapBuffers(M, DirtyRows, &Window.FrontBuffer);
+                    NeedsPresent = true;
                 }
 
-                Win32Present(&Window);
+                if (NeedsPresent)
+                {
+                    Win32Present(&Window);
+                    PresentedPauseState = PauseState;
+                }
 
                 f64 SecondsSinceBigBang = Win32DeltaSeconds(&Clock, Win32Now(), BigBang);
                 if (SecondsSinceBigBang > 0)